@@ -0,0 +1,95 @@
+// Micro-benchmark of standard dynamics on a hashed EREM landscape: the cost
+// per tracer step of SpinSystem::step_with, one tracer at a time, against
+// SpinSystemBatch advancing 8 to 64 tracers in lockstep.
+//
+// Usage: bench_batch [N_spins] [log10 number of tracer steps]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "utils.h"
+#include "spin.h"
+#include "spin_batch.h"
+
+
+parameters::SimulationParameters tracer_parameters(parameters::SimulationParameters p,
+    const unsigned int tracer_index)
+{
+    p.seed = 123 + tracer_index;
+    p.tracer_index = tracer_index;
+    return p;
+}
+
+double ns_per_scalar_step(const parameters::SimulationParameters p, const long long n)
+{
+    EnergyMapping<1> emap(p);
+    SpinSystem<1> sys(p, emap);
+    double clock = 0.0;
+    const auto t_start = std::chrono::high_resolution_clock::now();
+    for (long long ii=0; ii<n; ii++)
+    {
+        clock += sys.step_with<dynamics::Standard, landscape::EREM>();
+    }
+    const double elapsed = time_utils::get_time_delta(t_start);
+
+    // Keep the loop from being optimized away
+    if (clock < 0.0){printf("%f\n", clock);}
+    return 1e9 * elapsed / n;
+}
+
+double ns_per_batch_lane_step(const parameters::SimulationParameters p,
+    const unsigned int n_lanes, const long long n)
+{
+    std::vector<parameters::SimulationParameters> params;
+    std::vector<std::unique_ptr<EnergyMapping<1>>> emaps;
+    std::vector<std::unique_ptr<SpinSystem<1>>> systems;
+    std::vector<SpinSystem<1>*> system_ptrs;
+    for (unsigned int ll=0; ll<n_lanes; ll++)
+    {
+        params.push_back(tracer_parameters(p, ll));
+        emaps.emplace_back(new EnergyMapping<1>(params[ll]));
+        systems.emplace_back(new SpinSystem<1>(params[ll], *emaps[ll]));
+        system_ptrs.push_back(systems[ll].get());
+    }
+    SpinSystemBatch batch(params, system_ptrs);
+
+    const long long n_batch_steps = n / n_lanes;
+    const auto t_start = std::chrono::high_resolution_clock::now();
+    for (long long ii=0; ii<n_batch_steps; ii++){batch.step_with<landscape::EREM>();}
+    const double elapsed = time_utils::get_time_delta(t_start);
+    return 1e9 * elapsed / (n_batch_steps * n_lanes);
+}
+
+int main(int argc, char *argv[])
+{
+    parameters::SimulationParameters p;
+    p.N_spins = argc > 1 ? atoi(argv[1]) : 64;
+    const int log10_steps = argc > 2 ? atoi(argv[2]) : 7;
+    const long long n = ipow(10, log10_steps);
+    p.log10_N_timesteps = 9;
+    p.beta = 1.5;
+    p.seed = 123;
+    p.landscape = "EREM";
+    p.landscape_mode = "hashed";
+    p.dynamics = "standard";
+    parameters::update_parameters_(&p);
+
+    if (p.N_spins > 64)
+    {
+        printf("N_spins must fit in one word (<= 64)\n");
+        return 1;
+    }
+
+    printf("N_spins = %i, %lli tracer steps, ns per tracer step\n", p.N_spins, n);
+    const double t_scalar = ns_per_scalar_step(tracer_parameters(p, 0), n);
+    printf("%-10s %9.2f\n", "scalar", t_scalar);
+    for (const unsigned int n_lanes : {8, 16, 32, 64})
+    {
+        const double t_batch = ns_per_batch_lane_step(p, n_lanes, n);
+        printf("batch/%-4u %9.2f %9.2fx\n", n_lanes, t_batch, t_scalar / t_batch);
+    }
+    return 0;
+}
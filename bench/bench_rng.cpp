@@ -0,0 +1,94 @@
+// Micro-benchmark of the random number engines selectable with --rng: the
+// cost per draw of each sampler used by the simulation, the cost of a new
+// EREM energy on a cache miss sampled one at a time and from a buffer of
+// 256, and the cost per step of standard dynamics on a dense EREM
+// landscape, where the draws are a large share of the step.
+//
+// Usage: bench_rng [N_spins] [log10 number of draws]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "utils.h"
+#include "spin.h"
+#include "rng.h"
+
+
+template<typename F>
+double ns_per_draw(F draw, const long long n)
+{
+    double sum = 0.0;
+    const auto t_start = std::chrono::high_resolution_clock::now();
+    for (long long ii=0; ii<n; ii++){sum += draw();}
+    const double elapsed = time_utils::get_time_delta(t_start);
+
+    // Keep the loop from being optimized away
+    if (sum == -1.0){printf("%f\n", sum);}
+    return 1e9 * elapsed / n;
+}
+
+double ns_per_energy(parameters::SimulationParameters p,
+    const unsigned int buffer_size, const long long n)
+{
+    p.energy_buffer_size = buffer_size;
+    EnergyMapping<1> emap(p);
+    return ns_per_draw([&emap](){
+        return emap.sample_energy<landscape::EREM>();}, n);
+}
+
+double ns_per_step(parameters::SimulationParameters p, const long long n)
+{
+    EnergyMapping<1> emap(p);
+    SpinSystem<1> sys(p, emap);
+
+    // Warm up the energy table
+    for (long long ii=0; ii<n / 10; ii++){sys.step_with<dynamics::Standard, landscape::EREM>();}
+
+    return ns_per_draw([&sys](){
+        return sys.step_with<dynamics::Standard, landscape::EREM>();}, n);
+}
+
+int main(int argc, char *argv[])
+{
+    parameters::SimulationParameters p;
+    p.N_spins = argc > 1 ? atoi(argv[1]) : 16;
+    const int log10_draws = argc > 2 ? atoi(argv[2]) : 7;
+    const long long n = ipow(10, log10_draws);
+    p.log10_N_timesteps = 9;
+    p.beta = 1.5;
+    p.memory = -1;
+    p.seed = 123;
+    p.landscape = "EREM";
+    p.dynamics = "standard";
+    parameters::update_parameters_(&p);
+
+    if (p.N_spins > DENSE_MAX_N_SPINS)
+    {
+        printf("N_spins must fit in a dense table (<= %i)\n", DENSE_MAX_N_SPINS);
+        return 1;
+    }
+
+    printf("N_spins = %i, %lli draws, ns per draw\n", p.N_spins, n);
+    printf("%-13s %9s %9s %9s %9s %9s %9s %9s\n", "rng", "uniform", "int",
+        "exp", "normal", "energy/1", "energy/256", "step");
+    for (const std::string name : {"mt19937", "xoshiro256pp", "pcg64", "philox"})
+    {
+        rng::Generator g;
+        g.seed(rng::kind_from_string(name), 123, 0);
+        const unsigned int N = p.N_spins;
+        const double t_uniform = ns_per_draw([&g](){return g.uniform();}, n);
+        const double t_int = ns_per_draw([&g, N](){return (double) g.uniform_int(N);}, n);
+        const double t_exp = ns_per_draw([&g](){return g.exponential();}, n);
+        const double t_normal = ns_per_draw([&g](){return g.normal();}, n);
+
+        p.rng = name;
+        const double t_energy_1 = ns_per_energy(p, 1, n);
+        const double t_energy_256 = ns_per_energy(p, 256, n);
+        const double t_step = ns_per_step(p, n);
+        printf("%-13s %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name.c_str(),
+            t_uniform, t_int, t_exp, t_normal, t_energy_1, t_energy_256, t_step);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Micro-benchmark of the cost per step of the tracer loop, comparing the
+// runtime-dispatched SpinSystem::step with every step timed (the way every
+// step used to run) against the compile-time policy step_with, with sampled
+// step timing. The landscape is held in a dense table, so that the energy
+// lookups are cheap and the overhead around them dominates.
+//
+// Usage: bench_step [N_spins] [log10 number of calls]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "utils.h"
+#include "spin.h"
+
+
+template<unsigned int Words, typename Dynamics, typename Landscape>
+double ns_per_call(parameters::SimulationParameters p, const bool use_policy,
+    const long long n_calls)
+{
+    p.step_timing = use_policy ? "sampled" : "all";
+    EnergyMapping<Words> emap(p);
+    SpinSystem<Words> sys(p, emap);
+
+    // Warm up the energy table
+    for (long long ii=0; ii<n_calls / 10; ii++){sys.step();}
+
+    double clock = 0.0;
+    const auto t_start = std::chrono::high_resolution_clock::now();
+    if (use_policy)
+    {
+        for (long long ii=0; ii<n_calls; ii++)
+        {
+            clock += sys.template step_with<Dynamics, Landscape>();
+        }
+    }
+    else
+    {
+        for (long long ii=0; ii<n_calls; ii++){clock += sys.step();}
+    }
+    const double elapsed = time_utils::get_time_delta(t_start);
+
+    // Keep the loop from being optimized away
+    if (clock < 0.0){printf("%f\n", clock);}
+    return 1e9 * elapsed / n_calls;
+}
+
+template<typename Dynamics, typename Landscape>
+void run(parameters::SimulationParameters p, const std::string dynamics,
+    const std::string landscape, const long long n_calls)
+{
+    p.dynamics = dynamics;
+    p.landscape = landscape;
+    parameters::update_parameters_(&p);
+    const double t_step = ns_per_call<1, Dynamics, Landscape>(p, false, n_calls);
+    const double t_policy = ns_per_call<1, Dynamics, Landscape>(p, true, n_calls);
+    printf("%-10s %-5s %12.2f %12.2f %9.2fx\n", dynamics.c_str(),
+        landscape.c_str(), t_step, t_policy, t_step / t_policy);
+}
+
+int main(int argc, char *argv[])
+{
+    parameters::SimulationParameters p;
+    p.N_spins = argc > 1 ? atoi(argv[1]) : 16;
+    const int log10_calls = argc > 2 ? atoi(argv[2]) : 7;
+    const long long n_calls = ipow(10, log10_calls);
+    p.log10_N_timesteps = 9;
+    p.beta = 1.5;
+    p.memory = -1;
+    p.seed = 123;
+
+    if (p.N_spins > DENSE_MAX_N_SPINS)
+    {
+        printf("N_spins must fit in a dense table (<= %i)\n", DENSE_MAX_N_SPINS);
+        return 1;
+    }
+
+    printf("N_spins = %i, %lli calls, ns per call\n", p.N_spins, n_calls);
+    printf("%-10s %-5s %12s %12s %10s\n", "dynamics", "land", "step()", "step_with", "speedup");
+    run<dynamics::Standard, landscape::EREM>(p, "standard", "EREM", n_calls);
+    run<dynamics::Standard, landscape::GREM>(p, "standard", "GREM", n_calls);
+    run<dynamics::Gillespie, landscape::EREM>(p, "gillespie", "EREM", n_calls / 10);
+    run<dynamics::Gillespie, landscape::GREM>(p, "gillespie", "GREM", n_calls / 10);
+    return 0;
+}
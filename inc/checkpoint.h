@@ -0,0 +1,204 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+// The tracer loop reads the wall clock, to see whether the next checkpoint
+// of --checkpoint_interval is due, once every this many steps
+#define CHECKPOINT_CLOCK_STRIDE 4096
+
+// Checkpoints of in-flight tracers (--checkpoint_interval, --resume). A
+// checkpoint is a flat byte image, in host byte order, of everything a
+// tracer needs to carry on exactly where it stopped: the spin system, the
+// landscape and its cache, both generators, the simulation clock and the
+// observables, including how far each output file had been written. Every
+// class which owns such state has save(Writer&) and load(Reader&), which
+// must read back exactly what was written, in the same order. State which
+// is expensive to serialize (the dense table, the clock cache) is copied
+// as it is and serialized by Writer::defer when the bytes are released, on
+// the thread of an AsyncWriter, so that the tracer only pays for the copy.
+namespace checkpoint
+{
+
+    constexpr uint32_t MAGIC = 0x4B434448;  // "HDCK"
+
+    // Bumped whenever the layout of any saved object changes
+    constexpr uint32_t VERSION = 3;
+
+    class Writer
+    {
+    protected:
+        std::vector<char> _buffer;
+
+        // Deferred parts, and where in the buffer they go
+        std::vector<std::pair<size_t, std::function<void(Writer&)>>> _deferred;
+
+    public:
+        void write_bytes(const void *data, const size_t n)
+        {
+            const char *bytes = (const char*) data;
+            _buffer.insert(_buffer.end(), bytes, bytes + n);
+        }
+
+        template<typename T>
+        void write(const T &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable values are written as bytes");
+            write_bytes(&value, sizeof(T));
+        }
+
+        template<typename T>
+        void write_vector(const std::vector<T> &values)
+        {
+            write((uint64_t) values.size());
+            if (!values.empty()){write_bytes(values.data(), values.size() * sizeof(T));}
+        }
+
+        void write_string(const std::string &s)
+        {
+            write((uint64_t) s.size());
+            write_bytes(s.data(), s.size());
+        }
+
+        /**
+         * @brief Leaves a part of the checkpoint to be written by serialize
+         * when the bytes are released, in place. serialize must own what it
+         * writes, e.g. a copy of the state taken now.
+         */
+        void defer(std::function<void(Writer&)> serialize)
+        {
+            _deferred.emplace_back(_buffer.size(), std::move(serialize));
+        }
+
+        // The bytes written so far, without the deferred parts
+        size_t size() const {return _buffer.size();}
+
+        // Hands over the bytes written so far, with the deferred parts
+        // serialized into them, leaving the writer empty
+        std::vector<char> release();
+    };
+
+    class Reader
+    {
+    protected:
+        const char *_data;
+        size_t _size;
+        size_t _pos = 0;
+
+    public:
+        Reader(const std::vector<char> &buffer) : _data(buffer.data()), _size(buffer.size()){}
+
+        void read_bytes(void *data, const size_t n)
+        {
+            if (n > _size - _pos){throw std::runtime_error("Truncated checkpoint");}
+            memcpy(data, _data + _pos, n);
+            _pos += n;
+        }
+
+        template<typename T>
+        void read(T &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable values are read as bytes");
+            read_bytes(&value, sizeof(T));
+        }
+
+        template<typename T>
+        T read()
+        {
+            T value;
+            read(value);
+            return value;
+        }
+
+        template<typename T>
+        void read_vector(std::vector<T> &values)
+        {
+            const uint64_t n = read<uint64_t>();
+            if (n > (_size - _pos) / sizeof(T)){throw std::runtime_error("Truncated checkpoint");}
+            values.resize(n);
+            if (n > 0){read_bytes(values.data(), n * sizeof(T));}
+        }
+
+        std::string read_string()
+        {
+            const uint64_t n = read<uint64_t>();
+            if (n > _size - _pos){throw std::runtime_error("Truncated checkpoint");}
+            std::string s(_data + _pos, n);
+            _pos += n;
+            return s;
+        }
+
+        // Throws unless the value read equals expected, for the fields
+        // which identify what a checkpoint belongs to
+        template<typename T>
+        void expect(const T &expected, const char *what)
+        {
+            if (read<T>() != expected)
+            {
+                throw std::runtime_error(std::string("Checkpoint does not match this run: ") + what);
+            }
+        }
+
+        bool at_end() const {return _pos == _size;}
+    };
+
+    /**
+     * @brief Reads a whole file.
+     * @return false if the file could not be opened
+     */
+    bool read_file(const std::string &path, std::vector<char> &buffer);
+
+    /**
+     * @brief Writes buffer to path + ".tmp", syncs it and renames it over
+     * path, so that path always holds either the previous or the new
+     * checkpoint in full, even if the job is killed while writing.
+     */
+    void write_file_atomic(const std::string &path, const std::vector<char> &buffer);
+
+    /**
+     * @brief Serializes and writes checkpoints on a background thread, so
+     * that the tracer only pays for taking the snapshot, not for the
+     * deferred parts of the Writer or the file system.
+     * @details At most one write is in flight: submitting a checkpoint while
+     * the previous one is still being written waits for it first, which
+     * idle lets the tracer avoid. Errors of a write are rethrown by the
+     * next idle, submit or wait.
+     */
+    class AsyncWriter
+    {
+    protected:
+        std::thread _thread;
+        std::atomic<bool> _in_flight{false};
+        std::exception_ptr _error;
+
+    public:
+        AsyncWriter(){}
+        AsyncWriter(const AsyncWriter&) = delete;
+        AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+        void submit(const std::string &path, Writer &&writer);
+
+        // Whether a checkpoint can be submitted without waiting
+        bool idle();
+
+        // Waits for the write in flight, if any
+        void wait();
+
+        ~AsyncWriter();
+    };
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef CLOCK_CACHE_H
+#define CLOCK_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace cache {
+
+/**
+ * @brief Flat open-addressing cache with CLOCK (second chance) eviction.
+ * @details Keys and values are stored contiguously in a single linear-probing
+ * table, with a parallel array of one control byte per slot holding the
+ * occupied and referenced bits. There are no per-entry heap nodes and a hit
+ * only sets the referenced bit, as opposed to splicing a linked list. When
+ * the cache is full, the clock hand sweeps the table clearing referenced
+ * bits until it finds an unreferenced entry to evict, which is removed with
+ * backward-shift deletion so that no tombstones accumulate.
+ *
+ * The table never holds more than the capacity set by set_capacity, and its
+ * number of slots is bounded by capacity / max load factor. It starts small
+ * and grows geometrically up to that bound, so runs which touch few
+ * configurations do not commit the full table.
+ */
+template<typename key_t, typename value_t, typename hash_t = std::hash<key_t>>
+class clock_cache {
+public:
+	clock_cache(){}
+
+	// Looks up the key, calling make_value() to produce and insert the value
+	// on a miss. Evicts using the CLOCK policy if the cache is full.
+	template<typename factory_t>
+	const value_t& get_or_put(const key_t& key, factory_t make_value) {
+		return get_or_put(key, hash_t()(key), make_value);
+	}
+
+	// As above, with the hash of the key already computed, e.g. by prefetch
+	template<typename factory_t>
+	const value_t& get_or_put(const key_t& key, const size_t hash, factory_t make_value) {
+		if (_n_slots == 0) {
+			_resize(_next_n_slots());
+		}
+
+		size_t ii = _home(hash);
+		while (_control[ii] != EMPTY) {
+			if (_slots[ii].key == key) {
+				_control[ii] = REFERENCED;
+				return _slots[ii].value;
+			}
+			ii = _next(ii);
+		}
+
+		// Miss: make room if needed, which may move entries around, in which
+		// case the insertion point has to be found again
+		if (_size >= _max_size) {
+			_evict();
+			ii = _find_empty(hash);
+		}
+		else if (_size + 1 > _max_load && _n_slots < _max_slots) {
+			_resize(_next_n_slots());
+			ii = _find_empty(hash);
+		}
+
+		_slots[ii].key = key;
+		_slots[ii].value = make_value();
+		_control[ii] = REFERENCED;
+		_size++;
+		return _slots[ii].value;
+	}
+
+	// Hashes the key and prefetches its first probe slot, so that a batch of
+	// lookups can have all of its cache misses in flight at once. Returns the
+	// hash, to be passed on to get_or_put.
+	size_t prefetch(const key_t& key) const {
+		const size_t hash = hash_t()(key);
+		if (_n_slots > 0) {
+			const size_t ii = _home(hash);
+			__builtin_prefetch(&_control[ii]);
+			__builtin_prefetch(&_slots[ii]);
+		}
+		return hash;
+	}
+
+	bool key_exists(const key_t& key) const {
+		if (_n_slots == 0) {return false;}
+		size_t ii = _home(hash_t()(key));
+		while (_control[ii] != EMPTY) {
+			if (_slots[ii].key == key) {return true;}
+			ii = _next(ii);
+		}
+		return false;
+	}
+
+	size_t get_size() const {
+		return _size;
+	}
+
+	size_t get_capacity() const {
+		return _max_size;
+	}
+
+	void set_capacity(size_t max_size) {
+		_max_size = max_size;
+
+		// Keep the load factor at or below 0.8, and always leave at least
+		// one empty slot so that probing terminates
+		_max_slots = max_size + max_size / 4 + 1;
+		_slots.clear();
+		_control.clear();
+		_n_slots = 0;
+		_size = 0;
+		_hand = 0;
+	}
+
+	// Writes the table with writer.write, as the occupied slots only, in
+	// slot order. Restoring them into the same slots with load gives back
+	// the exact table, so that the eviction order is unchanged.
+	template<typename writer_t>
+	void save(writer_t& writer) const {
+		writer.write((uint64_t) _max_size);
+		writer.write((uint64_t) _n_slots);
+		writer.write((uint64_t) _size);
+		writer.write((uint64_t) _hand);
+		for (size_t ii=0; ii<_n_slots; ii++) {
+			if (_control[ii] == EMPTY) {continue;}
+			writer.write((uint64_t) ii);
+			writer.write(_control[ii]);
+			writer.write(_slots[ii]);
+		}
+	}
+
+	// Reads back what save wrote with reader.read
+	template<typename reader_t>
+	void load(reader_t& reader) {
+		set_capacity((size_t) reader.template read<uint64_t>());
+		const size_t n_slots = (size_t) reader.template read<uint64_t>();
+		const size_t size = (size_t) reader.template read<uint64_t>();
+		const size_t hand = (size_t) reader.template read<uint64_t>();
+		if (n_slots > _max_slots || size > n_slots) {
+			throw std::runtime_error("Invalid clock cache in checkpoint");
+		}
+		if (n_slots > 0) {_resize(n_slots);}
+		for (size_t jj=0; jj<size; jj++) {
+			const size_t ii = (size_t) reader.template read<uint64_t>();
+			if (ii >= _n_slots) {throw std::runtime_error("Invalid clock cache in checkpoint");}
+			reader.read(_control[ii]);
+			reader.read(_slots[ii]);
+		}
+		_size = size;
+		_hand = hand;
+	}
+
+private:
+	static constexpr uint8_t EMPTY = 0;
+	static constexpr uint8_t OCCUPIED = 1;
+	static constexpr uint8_t REFERENCED = 3;
+
+	// Smallest table that is allocated on first use
+	static constexpr size_t MIN_SLOTS = 64;
+
+	struct slot_t {
+		key_t key;
+		value_t value;
+	};
+
+	std::vector<slot_t> _slots;
+	std::vector<uint8_t> _control;
+	size_t _n_slots = 0;
+	size_t _max_slots = 0;
+	size_t _max_load = 0;
+	size_t _max_size = 0;
+	size_t _size = 0;
+	size_t _hand = 0;
+
+	// Maps the hash onto [0, _n_slots) without a modulo, which also works
+	// for table sizes which are not powers of two
+	inline size_t _home(const uint64_t hash) const {
+		return (size_t) (((unsigned __int128) hash * _n_slots) >> 64);
+	}
+
+	inline size_t _next(const size_t ii) const {
+		return ii + 1 == _n_slots ? 0 : ii + 1;
+	}
+
+	size_t _find_empty(const size_t hash) const {
+		size_t ii = _home(hash);
+		while (_control[ii] != EMPTY) {ii = _next(ii);}
+		return ii;
+	}
+
+	size_t _next_n_slots() const {
+		const size_t n = _n_slots == 0 ? MIN_SLOTS : 2 * _n_slots;
+		return n < _max_slots ? n : _max_slots;
+	}
+
+	void _resize(const size_t n_slots) {
+		// Swap in the new, empty table and rehash the old one into it
+		std::vector<slot_t> old_slots(n_slots);
+		std::vector<uint8_t> old_control(n_slots, EMPTY);
+		old_slots.swap(_slots);
+		old_control.swap(_control);
+		const size_t old_n_slots = _n_slots;
+
+		_n_slots = n_slots;
+		_max_load = _n_slots == _max_slots ? _max_size : (_n_slots * 4) / 5;
+		_hand = 0;
+
+		for (size_t jj=0; jj<old_n_slots; jj++) {
+			if (old_control[jj] == EMPTY) {continue;}
+			const size_t ii = _find_empty(hash_t()(old_slots[jj].key));
+			_slots[ii] = old_slots[jj];
+			_control[ii] = old_control[jj];
+		}
+	}
+
+	// Second chance: referenced entries have their bit cleared and are
+	// skipped, the first unreferenced entry is removed
+	void _evict() {
+		while (true) {
+			if (_control[_hand] == REFERENCED) {
+				_control[_hand] = OCCUPIED;
+			}
+			else if (_control[_hand] == OCCUPIED) {
+				// The hand stays put: backward shifting may have moved an
+				// unvisited entry into this slot
+				_erase(_hand);
+				return;
+			}
+			_hand = _next(_hand);
+		}
+	}
+
+	void _erase(size_t ii) {
+		size_t jj = ii;
+		while (true) {
+			jj = _next(jj);
+			if (_control[jj] == EMPTY) {break;}
+
+			// Entry jj can fill the hole at ii unless its home slot lies
+			// cyclically within (ii, jj]
+			const size_t kk = _home(hash_t()(_slots[jj].key));
+			const bool stays = (ii <= jj) ? (ii < kk && kk <= jj) : (ii < kk || kk <= jj);
+			if (!stays) {
+				_slots[ii] = _slots[jj];
+				_control[ii] = _control[jj];
+				ii = jj;
+			}
+		}
+		_control[ii] = EMPTY;
+		_size--;
+	}
+};
+
+} // namespace cache
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <cstdint>
+#include <cmath>
+
+#include "spin_state.h"
+
+
+// Counter-based random number generation. Unlike a streaming engine such as
+// std::mt19937, the output is a pure function of a (counter, key) pair, so a
+// value can be recomputed at any time from its counter alone. This is used to
+// derive the energy of a configuration from its state bits and the seed,
+// without storing it.
+namespace counter_rng
+{
+
+    struct Philox4x32
+    {
+        uint32_t v[4];
+    };
+
+    inline void _mulhilo32(const uint32_t a, const uint32_t b, uint32_t &hi, uint32_t &lo)
+    {
+        const uint64_t product = (uint64_t) a * (uint64_t) b;
+        hi = (uint32_t) (product >> 32);
+        lo = (uint32_t) product;
+    }
+
+    /**
+     * @brief The Philox4x32-10 block function of Salmon et al. (SC '11)
+     *
+     * @param ctr The 128-bit counter
+     * @param key The 64-bit key
+     *
+     * @return 128 pseudo-random bits
+     */
+    inline Philox4x32 philox4x32_10(Philox4x32 ctr, const uint64_t key)
+    {
+        uint32_t k0 = (uint32_t) key;
+        uint32_t k1 = (uint32_t) (key >> 32);
+        uint32_t hi0, lo0, hi1, lo1;
+        for (unsigned int round=0; round<10; round++)
+        {
+            _mulhilo32(0xD2511F53, ctr.v[0], hi0, lo0);
+            _mulhilo32(0xCD9E8D57, ctr.v[2], hi1, lo1);
+            ctr = {{hi1 ^ ctr.v[1] ^ k0, lo1, hi0 ^ ctr.v[3] ^ k1, lo0}};
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        return ctr;
+    }
+
+    /**
+     * @brief Maps a spin state and key to 128 pseudo-random bits
+     * @details The first two words of the state form the Philox counter.
+     * Wider states are absorbed two words at a time by xoring them into the
+     * previous output and applying the block function again.
+     */
+    template<unsigned int Words>
+    inline Philox4x32 philox_from_state(const SpinState<Words> &state, const uint64_t key)
+    {
+        Philox4x32 out = {{0, 0, 0, 0}};
+        for (unsigned int ii=0; ii<Words; ii+=2)
+        {
+            const uint64_t w0 = state.words[ii];
+            const uint64_t w1 = ii + 1 < Words ? state.words[ii + 1] : 0;
+            out.v[0] ^= (uint32_t) w0;
+            out.v[1] ^= (uint32_t) (w0 >> 32);
+            out.v[2] ^= (uint32_t) w1;
+            out.v[3] ^= (uint32_t) (w1 >> 32);
+            out = philox4x32_10(out, key);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Converts 64 random bits to a double uniform on (0, 1]
+     */
+    inline double uniform_open_closed(const uint64_t bits)
+    {
+        return ((double) ((bits >> 11) + 1)) * 0x1.0p-53;
+    }
+
+    /**
+     * @brief Exponential sample of rate lambda from 128 random bits
+     */
+    inline double exponential(const Philox4x32 &bits, const double lambda)
+    {
+        const uint64_t u = ((uint64_t) bits.v[0] << 32) | bits.v[1];
+        return -log(uniform_open_closed(u)) / lambda;
+    }
+
+    /**
+     * @brief Normal sample of mean 0 and standard deviation sigma from 128
+     * random bits, via the Box-Muller transform
+     */
+    inline double normal(const Philox4x32 &bits, const double sigma)
+    {
+        const uint64_t u1 = ((uint64_t) bits.v[0] << 32) | bits.v[1];
+        const uint64_t u2 = ((uint64_t) bits.v[2] << 32) | bits.v[3];
+        const double r = sqrt(-2.0 * log(uniform_open_closed(u1)));
+        return sigma * r * cos(2.0 * M_PI * uniform_open_closed(u2));
+    }
+
+}
+
+#endif
@@ -45,6 +45,30 @@ public:
 		}
 	}
 	
+	// Looks up the key with a single hash probe. On a hit the entry is moved
+	// to the front and its value returned; on a miss, make_value() is called
+	// to produce the value, which is inserted at the front (evicting the least
+	// recently used entry if the cache is full).
+	template<typename factory_t>
+	const value_t& get_or_put(const key_t& key, factory_t make_value) {
+		auto inserted = _cache_items_map.try_emplace(key);
+		auto it = inserted.first;
+		if (!inserted.second) {
+			_cache_items_list.splice(_cache_items_list.begin(), _cache_items_list, it->second);
+			return it->second->second;
+		}
+		_cache_items_list.push_front(key_value_pair_t(key, make_value()));
+		it->second = _cache_items_list.begin();
+
+		if (_cache_items_map.size() > _max_size) {
+			auto last = _cache_items_list.end();
+			last--;
+			_cache_items_map.erase(last->first);
+			_cache_items_list.pop_back();
+		}
+		return _cache_items_list.front().second;
+	}
+
 	const value_t& get(const key_t& key) {
 		auto it = _cache_items_map.find(key);
 		if (it == _cache_items_map.end()) {
@@ -72,6 +96,34 @@ public:
 		_max_size = max_size;
 	}
 	
+	// Writes the entries with writer.write, least recently used first
+	template<typename writer_t>
+	void save(writer_t& writer) const {
+		writer.write((uint64_t) _max_size);
+		writer.write((uint64_t) _cache_items_list.size());
+		for (auto it = _cache_items_list.rbegin(); it != _cache_items_list.rend(); it++) {
+			writer.write(it->first);
+			writer.write(it->second);
+		}
+	}
+
+	// Reads back what save wrote with reader.read. Each entry is put in
+	// front of the previous ones, which restores the order of use.
+	template<typename reader_t>
+	void load(reader_t& reader) {
+		_cache_items_list.clear();
+		_cache_items_map.clear();
+		_max_size = (size_t) reader.template read<uint64_t>();
+		const size_t n = (size_t) reader.template read<uint64_t>();
+		for (size_t ii=0; ii<n; ii++) {
+			key_t key;
+			value_t value;
+			reader.read(key);
+			reader.read(value);
+			put(key, value);
+		}
+	}
+
 private:
 	std::list<key_value_pair_t> _cache_items_list;
 	std::unordered_map<key_t, list_iterator_t> _cache_items_map;
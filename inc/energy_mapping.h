@@ -1,43 +1,277 @@
 #ifndef ENERGY_MAPPING_H
 #define ENERGY_MAPPING_H
 
+#include <memory>
 #include <random>
 
 #include "utils.h"
+#include "checkpoint.h"
 #include "lru.h"
+#include "clock_cache.h"
+#include "counter_rng.h"
+#include "rng.h"
 
+// Largest number of spins for which the energies of all 2^N_spins
+// configurations may be kept in a flat, directly indexed table (8 GB of
+// doubles at 30 spins). The table is only used if it also fits in --memory.
+#define DENSE_MAX_N_SPINS 30
+
+// With --memory=-1 (no limit) the table is allocated in full up front,
+// where the cache would only grow with the configurations visited, so it
+// is used only up to this many spins (128 MB of doubles at 24 spins)
+#define DENSE_UNLIMITED_MAX_N_SPINS 24
+
+
+// Compile-time landscape policies: how new energies are drawn, either in
+// blocks from the streaming generator or from counter-based random bits.
+// The energy lookups are templated on these so the hot path never compares
+// params.landscape.
+namespace landscape
+{
+    struct EREM
+    {
+        static void sample_block(rng::Generator &generator,
+            const double beta_critical, const double sigma, double *out,
+            uint64_t *bits, const unsigned int n)
+        {
+            generator.fill_exponential(out, bits, n);
+            for (unsigned int ii=0; ii<n; ii++){out[ii] = -out[ii] / beta_critical;}
+        }
+
+        static double from_bits(const counter_rng::Philox4x32 &bits,
+            const double beta_critical, const double sigma)
+        {
+            return -counter_rng::exponential(bits, beta_critical);
+        }
+    };
+
+    struct GREM
+    {
+        static void sample_block(rng::Generator &generator,
+            const double beta_critical, const double sigma, double *out,
+            uint64_t *bits, const unsigned int n)
+        {
+            generator.fill_normal(out, bits, n);
+            for (unsigned int ii=0; ii<n; ii++){out[ii] = out[ii] * sigma;}
+        }
+
+        static double from_bits(const counter_rng::Philox4x32 &bits,
+            const double beta_critical, const double sigma)
+        {
+            return counter_rng::normal(bits, sigma);
+        }
+    };
+}
+
+
+template<unsigned int Words>
 class EnergyMapping
 {
+public:
+    typedef SpinState<Words> state_t;
+
 protected:
     parameters::SimulationParameters params;
 
-    // Initialize the MT random number generator and seed with random_device
-    // This is seeded in the constructor
-    mutable std::mt19937 generator;
+    // The random number generator, of the kind selected by params.rng, on
+    // the landscape stream of the tracer. This is seeded in the constructor
+    mutable rng::Generator generator;
+
+    // New energies are sampled params.energy_buffer_size at a time into
+    // this buffer and handed out in order, one per cache miss. The second
+    // array is scratch space for the block samplers
+    unsigned int _energy_buffer_size;
+    std::unique_ptr<double[]> _energy_buffer;
+    std::unique_ptr<uint64_t[]> _energy_buffer_bits;
+    mutable unsigned int _energy_buffer_pos;
 
-    // Distributions; we'll only use one of these depending on which type
-    // of dynamics we're doing
-    mutable std::exponential_distribution<double> exponential_distribution;
-    mutable std::normal_distribution<double> normal_distribution;
+    template<typename Landscape>
+    void _refill_energy_buffer() const;
 
     // One must set the capacity using `set_capacity(int)`
-    mutable cache::lru_cache<std::string, double> energy_map;
+    // Keyed directly on the packed state words. Only one of these is used,
+    // depending on params.cache_engine
+    mutable cache::lru_cache<state_t, double> energy_map;
+    mutable cache::clock_cache<state_t, double> clock_energy_map;
+    bool _use_clock_cache;
+
+    // Scratch space for the hashes of a batch of neighbors, so that batched
+    // lookups do not allocate
+    mutable std::vector<size_t> _batch_hashes;
+
+    // Dense table only: the energy of configuration s is stored at index s,
+    // and a presence bitmap marks which entries have been sampled. Entries
+    // are filled lazily, in the same order the caches would sample them. The
+    // energies are left uninitialized so that untouched pages are never
+    // committed
+    bool _use_dense_table;
+    long long _dense_n_configs = 0;
+    std::unique_ptr<double[]> _dense_energies;
+    mutable std::vector<uint64_t> _dense_present;
+    mutable long long _dense_size = 0;
+
+    // Hashed landscape only: energies are a pure function of the state and
+    // this key, so nothing is stored and revisits are exact
+    bool _use_hashed_landscape;
+    uint64_t _landscape_key;
+
+    // The landscape, resolved once from params.landscape, and the standard
+    // deviation of the GREM energies
+    bool _landscape_is_erem;
+    double _grem_sigma;
 
 public:
+    // The non-template versions dispatch on params.landscape. The templated
+    // ones are defined below so that they can be inlined into the step.
+    double sample_energy() const;
+    double hashed_energy(const state_t &) const;
+    double get_config_energy(const state_t &) const;
+    void get_config_energies_array_(const state_t *neighbors, double *neighboring_energies, const unsigned int bitLength) const;
+
+    template<typename Landscape>
     double sample_energy() const;
-    double get_config_energy(const ap_uint<PRECISON>) const;
-    void get_config_energies_array_(const ap_uint<PRECISON> *neighbors, double *neighboring_energies, const unsigned int bitLength) const;
-    ap_uint<PRECISON> get_size(){return energy_map.get_size();}
-    ap_uint<PRECISON> get_capacity(){return energy_map.get_capacity();}
+    template<typename Landscape>
+    double hashed_energy(const state_t &) const;
+    template<typename Landscape>
+    double get_config_energy(const state_t &) const;
+    template<typename Landscape>
+    void get_config_energies_array_(const state_t *neighbors, double *neighboring_energies, const unsigned int bitLength) const;
+
+    long long get_size() const
+    {
+        if (_use_hashed_landscape){return 0;}
+        if (_use_dense_table){return _dense_size;}
+        return _use_clock_cache ? clock_energy_map.get_size() : energy_map.get_size();
+    }
+    long long get_capacity() const
+    {
+        if (_use_hashed_landscape){return 0;}
+        if (_use_dense_table){return _dense_n_configs;}
+        return _use_clock_cache ? clock_energy_map.get_capacity() : energy_map.get_capacity();
+    }
     void _initialize_distributions();
+    bool uses_dense_table() const {return _use_dense_table;}
+    bool uses_hashed_landscape() const {return _use_hashed_landscape;}
+    uint64_t get_landscape_key() const {return _landscape_key;}
+    double get_grem_sigma() const {return _grem_sigma;}
     EnergyMapping(const parameters::SimulationParameters);
+
+    /**
+     * @brief Saves the landscape as sampled so far: the generator, the
+     * energies buffered ahead of use and the stored energies, in the order
+     * the cache would evict them.
+     */
+    void save(checkpoint::Writer &writer) const;
+
+    /**
+     * @brief Restores what save wrote, into a mapping constructed with the
+     * same parameters. Throws if the storage does not match.
+     */
+    void load(checkpoint::Reader &reader);
+
     /**
      * @brief Gets the inherent structure only
      * @details [long description]
      * @return [description]
      */
-    ap_uint<PRECISON> get_inherent_structure(const ap_uint<PRECISON> state) const;
+    state_t get_inherent_structure(const state_t &state) const;
 
 };
 
+
+template<unsigned int Words>
+template<typename Landscape>
+void EnergyMapping<Words>::_refill_energy_buffer() const
+{
+    Landscape::sample_block(generator, params.beta_critical, _grem_sigma,
+        _energy_buffer.get(), _energy_buffer_bits.get(), _energy_buffer_size);
+    _energy_buffer_pos = 0;
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+inline double EnergyMapping<Words>::sample_energy() const
+{
+    if (_energy_buffer_pos == _energy_buffer_size)
+    {
+        _refill_energy_buffer<Landscape>();
+    }
+    return _energy_buffer[_energy_buffer_pos++];
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+inline double EnergyMapping<Words>::hashed_energy(const state_t &state) const
+{
+    const counter_rng::Philox4x32 bits = counter_rng::philox_from_state(state, _landscape_key);
+    return Landscape::from_bits(bits, params.beta_critical, _grem_sigma);
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+inline double EnergyMapping<Words>::get_config_energy(const state_t &state) const
+{
+    if (_use_hashed_landscape){return hashed_energy<Landscape>(state);}
+
+    if (_use_dense_table)
+    {
+        const uint64_t index = state.words[0];
+        uint64_t &present = _dense_present[index >> 6];
+        const uint64_t mask = uint64_t(1) << (index & 63);
+        if (!(present & mask))
+        {
+            _dense_energies[index] = sample_energy<Landscape>();
+            present |= mask;
+            _dense_size++;
+        }
+        return _dense_energies[index];
+    }
+
+    // If our key exists in the cache, simply return the value. Otherwise,
+    // we sample a new value and cache it, all in a single lookup.
+    if (_use_clock_cache)
+    {
+        return clock_energy_map.get_or_put(state, [this](){return sample_energy<Landscape>();});
+    }
+    return energy_map.get_or_put(state, [this](){return sample_energy<Landscape>();});
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+inline void EnergyMapping<Words>::get_config_energies_array_(const state_t *neighbors, double *neighboring_energies, const unsigned int bitLength) const
+{
+    // The lookups are independent, so rather than resolving them one
+    // dependent cache miss at a time, the first pass computes every index
+    // and prefetches it, and the second pass resolves hits and samples
+    // misses. The second pass runs in order, so the energies sampled are the
+    // same as for one-at-a-time lookups.
+    if (_use_dense_table)
+    {
+        for (unsigned int ii=0; ii<bitLength; ii++)
+        {
+            const uint64_t index = neighbors[ii].words[0];
+            __builtin_prefetch(&_dense_present[index >> 6]);
+            __builtin_prefetch(&_dense_energies[index]);
+        }
+    }
+    else if (_use_clock_cache)
+    {
+        for (unsigned int ii=0; ii<bitLength; ii++)
+        {
+            _batch_hashes[ii] = clock_energy_map.prefetch(neighbors[ii]);
+        }
+        for (unsigned int ii=0; ii<bitLength; ii++)
+        {
+            neighboring_energies[ii] = clock_energy_map.get_or_put(
+                neighbors[ii], _batch_hashes[ii], [this](){return sample_energy<Landscape>();});
+        }
+        return;
+    }
+
+    for (unsigned int ii=0; ii<bitLength; ii++)
+    {
+        neighboring_energies[ii] = get_config_energy<Landscape>(neighbors[ii]);
+    }
+}
+
 #endif
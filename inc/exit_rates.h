@@ -0,0 +1,102 @@
+#ifndef EXIT_RATES_H
+#define EXIT_RATES_H
+
+#include <cstdint>
+#include <cstring>
+
+
+// Vectorized Metropolis exit rates for Gillespie dynamics. The exponential
+// is evaluated with a Cody-Waite range reduction and a degree 13 polynomial
+// instead of libm, so that it can run across SIMD lanes. The AVX-512, AVX2
+// and scalar paths perform exactly the same IEEE operations in the same
+// order (no fused multiply-adds), so all of them return bit-identical rates
+// and seeded trajectories do not depend on the machine they run on.
+namespace exit_rates
+{
+
+    // Below this argument the result is flushed to zero rather than
+    // returned as a denormal
+    constexpr double EXP_UNDERFLOW = -708.0;
+
+    // Maximum relative error of exp_nonpositive with respect to std::exp on
+    // [EXP_UNDERFLOW, 0], checked in the tests
+    constexpr double EXP_MAX_RELATIVE_ERROR = 1e-15;
+
+    namespace _constants
+    {
+        constexpr double LOG2E = 1.4426950408889634;
+        constexpr double LN2_HI = 6.93147180369123816490e-01;
+        constexpr double LN2_LO = 1.90821492927058770002e-10;
+
+        // Adding then subtracting 1.5 * 2^52 rounds to the nearest integer,
+        // which is left in the low bits of the sum
+        constexpr double ROUND_MAGIC = 6755399441055744.0;
+        constexpr uint64_t ROUND_MAGIC_BITS = 0x4338000000000000ULL;
+
+        // Taylor coefficients 1/k!, highest order first
+        constexpr double POLY[14] = {
+            1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0,
+            1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0,
+            1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0
+        };
+    }
+
+    /**
+     * @brief Scalar exponential of a non-positive argument.
+     * @details Reference for the vector paths. Returns 0 below
+     * EXP_UNDERFLOW, and has a relative error of at most
+     * EXP_MAX_RELATIVE_ERROR otherwise.
+     */
+    inline double exp_nonpositive(const double x)
+    {
+        using namespace _constants;
+        if (x < EXP_UNDERFLOW){return 0.0;}
+
+        const double t = x * LOG2E + ROUND_MAGIC;
+        const double n = t - ROUND_MAGIC;
+        double r = x - n * LN2_HI;
+        r = r - n * LN2_LO;
+
+        double p = POLY[0];
+        for (unsigned int kk=1; kk<14; kk++){p = p * r + POLY[kk];}
+
+        uint64_t t_bits;
+        std::memcpy(&t_bits, &t, sizeof(double));
+        const uint64_t scale_bits = (t_bits - ROUND_MAGIC_BITS + 1023) << 52;
+        double scale;
+        std::memcpy(&scale, &scale_bits, sizeof(double));
+        return p * scale;
+    }
+
+    /**
+     * @brief Scalar reference kernel, see metropolis_rates.
+     */
+    void metropolis_rates_scalar(const double* neighboring_energies,
+        const double current_energy, const double beta, const unsigned int n,
+        double* rates);
+
+    /**
+     * @brief Fills the Metropolis exit rates of all n neighbors.
+     * @details rates[ii] = min(exp(-beta * (E_ii - E)), 1) / n, using the
+     * widest instruction set supported by the CPU, detected once at first
+     * call.
+     *
+     * @param neighboring_energies The energies E_ii of the n neighbors
+     * @param current_energy The energy E of the current state
+     * @param beta The inverse temperature
+     * @param n The number of neighbors (N_spins)
+     * @param rates Output array of length n
+     */
+    void metropolis_rates(const double* neighboring_energies,
+        const double current_energy, const double beta, const unsigned int n,
+        double* rates);
+
+    /**
+     * @brief Name of the instruction set used by metropolis_rates, i.e.
+     * "avx512", "avx2" or "scalar".
+     */
+    const char* selected_isa();
+
+}
+
+#endif
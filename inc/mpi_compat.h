@@ -0,0 +1,98 @@
+#ifndef MPI_COMPAT_H
+#define MPI_COMPAT_H
+
+// hdspin is built against MPI unless configured with -DUSE_MPI=OFF, in
+// which case HDSPIN_USE_MPI is 0 and the MPI calls hdspin makes are
+// replaced by the single-process stand-ins below: one rank, with the
+// tracers spread over --threads. Seeds and output files are keyed on the
+// global tracer index, so the results are the same as with MPI.
+#ifndef HDSPIN_USE_MPI
+#define HDSPIN_USE_MPI 1
+#endif
+
+#if HDSPIN_USE_MPI
+
+#include <mpi.h>
+
+#else
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+typedef int MPI_Comm;
+typedef int MPI_Datatype;
+typedef int MPI_Op;
+struct MPI_Status {int MPI_SOURCE;};
+
+#define MPI_COMM_WORLD 0
+#define MPI_COMM_NULL (-1)
+#define MPI_ANY_SOURCE (-1)
+#define MPI_STATUS_IGNORE nullptr
+#define MPI_MAX_PROCESSOR_NAME 256
+#define MPI_THREAD_SINGLE 0
+#define MPI_THREAD_FUNNELED 1
+#define MPI_THREAD_SERIALIZED 2
+#define MPI_THREAD_MULTIPLE 3
+#define MPI_INT 1
+#define MPI_LONG_LONG 2
+#define MPI_DOUBLE 3
+#define MPI_SUM 1
+
+inline int MPI_Init_thread(int *, char ***, int, int *provided)
+{
+    *provided = MPI_THREAD_MULTIPLE;
+    return 0;
+}
+inline int MPI_Finalize(){return 0;}
+inline int MPI_Abort(MPI_Comm, int code){exit(code);}
+inline int MPI_Comm_size(MPI_Comm, int *size){*size = 1; return 0;}
+inline int MPI_Comm_rank(MPI_Comm, int *rank){*rank = 0; return 0;}
+inline int MPI_Barrier(MPI_Comm){return 0;}
+inline int MPI_Comm_dup(MPI_Comm comm, MPI_Comm *copy){*copy = comm; return 0;}
+inline int MPI_Comm_free(MPI_Comm *comm){*comm = MPI_COMM_NULL; return 0;}
+
+inline int MPI_Get_processor_name(char *name, int *length)
+{
+    if (gethostname(name, MPI_MAX_PROCESSOR_NAME) != 0){strcpy(name, "localhost");}
+    name[MPI_MAX_PROCESSOR_NAME - 1] = '\0';
+    *length = strlen(name);
+    return 0;
+}
+
+// With a single rank there is never anyone to talk to, and a broadcast
+// from rank 0 leaves the buffer as it is
+inline int MPI_Bcast(void *, int, MPI_Datatype, int, MPI_Comm){return 0;}
+
+// And a reduction over one rank copies the buffer, only doubles are reduced
+inline int MPI_Reduce(const void *send, void *recv, int count, MPI_Datatype datatype,
+    MPI_Op, int, MPI_Comm)
+{
+    if (datatype != MPI_DOUBLE)
+    {
+        fprintf(stderr, "MPI_Reduce of other than MPI_DOUBLE in a build without MPI\n");
+        abort();
+    }
+    if (recv != send){memmove(recv, send, count * sizeof(double));}
+    return 0;
+}
+inline int MPI_Send(const void *, int, MPI_Datatype, int, int, MPI_Comm)
+{
+    fprintf(stderr, "MPI_Send called in a build without MPI\n");
+    abort();
+}
+inline int MPI_Recv(void *, int, MPI_Datatype, int, int, MPI_Comm, MPI_Status *)
+{
+    fprintf(stderr, "MPI_Recv called in a build without MPI\n");
+    abort();
+}
+inline int MPI_Iprobe(int, int, MPI_Comm, int *flag, MPI_Status *)
+{
+    *flag = 0;
+    return 0;
+}
+
+#endif
+
+#endif
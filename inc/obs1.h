@@ -1,12 +1,15 @@
 #ifndef OBS1_H
 #define OBS1_H
 
+#include <memory>
 #include <queue>
 #include <vector>
 #include <unordered_set>
 
 #include "spin.h"
 #include "utils.h"
+#include "checkpoint.h"
+#include "output.h"
 
 
 class StreamingMedian
@@ -23,6 +26,8 @@ public:
     StreamingMedian();
     double median() const;
     void update(const double v);
+    void save(checkpoint::Writer &writer) const;
+    void load(checkpoint::Reader &reader);
 };
 
 class StreamingMean
@@ -49,30 +54,55 @@ public:
         value += v;
         counts += 1.0;
     }
+    void save(checkpoint::Writer &writer) const
+    {
+        writer.write(value);
+        writer.write(counts);
+    }
+    void load(checkpoint::Reader &reader)
+    {
+        reader.read(value);
+        reader.read(counts);
+    }
 };
 
 
+template<unsigned int Words>
 class ObsBase
 {
 protected:
     const parameters::FileNames fnames;
     const parameters::SimulationParameters params;
-    std::vector<long long> grid;
+    const output::format_t output_format;
+
+    // Formats the text output off the simulation thread, if not null
+    output::TextWriter* text_writer;
+
+    // The grids of the run, shared by every observable of the process
+    std::shared_ptr<const grids::GridSet> grid_set;
+    const std::vector<long long> &grid;
     int grid_length;
-    const SpinSystem* spin_system_ptr;
+    const SpinSystem<Words>* spin_system_ptr;
 
     // The pointer to the last-updated point on the grid
     unsigned int pointer = 0;
 
 public:
-    ObsBase(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system);
+    ObsBase(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer = nullptr);
 };
 
-class RidgeBase : public ObsBase
+template<unsigned int Words>
+class RidgeBase : public ObsBase<Words>
 {
 protected:
+    using ObsBase<Words>::params;
+    using ObsBase<Words>::grid;
+    using ObsBase<Words>::grid_length;
+    using ObsBase<Words>::spin_system_ptr;
+    using ObsBase<Words>::pointer;
 
-    FILE* outfile;
+    // Not opened if the threshold is not valid
+    std::unique_ptr<output::Stream> outfile;
 
     // long double _ridge_energy_accumulator = 0.0;
     long long _total_steps = 0;
@@ -93,51 +123,74 @@ protected:
 public:
 
     // Constructor: reads in the grid from the specified grid directory
-    RidgeBase(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system);
+    RidgeBase(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer = nullptr);
 
     // Step the grid by performing the following steps:
     // 1) Stepping the pointer
     // 2) Saving the configuration/energy information to disk
     void step(const double waiting_time, const double simulation_clock);
 
-    ~RidgeBase();
+    // Saves the accumulators, the grid pointer and the output, see
+    // checkpoint.h
+    void save(checkpoint::Writer &writer) const;
+    void load(checkpoint::Reader &reader);
+
+    // Adds the output streams, to be appended to a container
+    void collect_streams(std::vector<const output::Stream*> &streams) const;
 };
 
 
 
-class RidgeE : public RidgeBase
+template<unsigned int Words>
+class RidgeE : public RidgeBase<Words>
 {
 public:
-    RidgeE(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system);
+    RidgeE(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer = nullptr);
 };
 
-class RidgeS : public RidgeBase
+template<unsigned int Words>
+class RidgeS : public RidgeBase<Words>
 {
 public:
-    RidgeS(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system);
+    RidgeS(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer = nullptr);
 };
 
 
 
-class OnePointObservables : public ObsBase
+template<unsigned int Words>
+class OnePointObservables : public ObsBase<Words>
 {
 protected:
-
-    // Output files and pointers
-    FILE* outfile_energy;
-    FILE* outfile_energy_IS;
-    FILE* outfile_capacity;
-    FILE* outfile_acceptance_rate;
-    FILE* outfile_inherent_structure_timings;
-    FILE* outfile_walltime_per_waitingtime;
+    using ObsBase<Words>::grid;
+    using ObsBase<Words>::grid_length;
+    using ObsBase<Words>::spin_system_ptr;
+    using ObsBase<Words>::pointer;
+
+    // Output streams
+    output::Stream outfile_energy;
+    output::Stream outfile_energy_IS;
+    output::Stream outfile_capacity;
+    output::Stream outfile_acceptance_rate;
+    output::Stream outfile_walltime_per_waitingtime;
+
+    // True if a single step of the spin system can stand for a run of
+    // rejected standard steps, as with standard-accelerated and
+    // standard-adaptive dynamics
+    bool _rejection_runs = false;
 
 public:
 
     // Constructor: reads in the grid from the specified grid directory
-    OnePointObservables(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system);
+    OnePointObservables(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer = nullptr);
 
     void step(const double waiting_time, const double simulation_clock);
-    ~OnePointObservables();
+
+    // Saves the grid pointer and the outputs, see checkpoint.h
+    void save(checkpoint::Writer &writer) const;
+    void load(checkpoint::Reader &reader);
+
+    // Adds the output streams, to be appended to a container
+    void collect_streams(std::vector<const output::Stream*> &streams) const;
 };
 
 
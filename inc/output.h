@@ -0,0 +1,373 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+#include "checkpoint.h"
+
+
+// The rows one tracer (or batch) may get ahead of its output::TextWriter
+#define TEXT_WRITER_CAPACITY 4096
+
+// Where the observables of a tracer go (--output_format). As text, every
+// tracer writes one file per observable, data/<ii>_<observable>.txt. As
+// binary, the observables of a tracer are kept in memory while it runs and
+// appended, once it has finished, to a container shared by all tracers of
+// the rank:
+//
+//     data/rank_<r>.dat    header, then the rows of every observable of
+//                          every tracer, as float64 in host byte order
+//     data/rank_<r>.idx    header, then one IndexEntry per observable of
+//                          every tracer, locating its rows in the .dat
+//
+// Both files are only ever appended to, the rows of a tracer before its
+// index entries, so that a job killed while writing leaves at worst rows
+// which nothing points to, or a partial index entry, which is ignored. The
+// header holds a random id, new whenever a container is created. A
+// tracer run again (see --resume) appends new entries, and the last entry
+// of a tracer and observable is the one read. As reduced, the observables
+// of a tracer are also kept in memory, and only added to the running sums
+// of the rank, see reduction.h.
+namespace output
+{
+
+    enum format_t {TEXT, BINARY, REDUCED};
+
+    // Throws for anything but the names accepted by --output_format
+    format_t from_string(const std::string &name);
+
+    enum observable_t : uint32_t
+    {
+        ENERGY,
+        ENERGY_IS,
+        RIDGE_E,
+        RIDGE_S,
+        CACHE_SIZE,
+        ACCEPTANCE_RATE,
+        WALLTIME_PER_WAITINGTIME,
+        N_OBSERVABLES
+    };
+
+    // The number of values per row: mean, median and count for the
+    // ridges, otherwise one
+    unsigned int n_columns(const observable_t observable);
+
+    // The name of the observable in file names, e.g. "energy_IS"
+    const char* name(const observable_t observable);
+
+    // The text file of the observable among fnames
+    const std::string& text_path(const parameters::FileNames &fnames,
+        const observable_t observable);
+
+    // Writes one row of n_columns(observable) values in the text format
+    void write_text_row(FILE* file, const observable_t observable, const double *row);
+
+    constexpr uint32_t MAGIC = 0x424F4448;  // "HDOB"
+
+    // Bumped whenever the layout of either file changes
+    constexpr uint32_t VERSION = 2;
+
+    struct IndexEntry
+    {
+        uint32_t tracer;
+        uint32_t observable;
+        uint32_t n_columns;
+        uint32_t reserved = 0;
+
+        // In bytes from the start of the .dat, and in rows
+        uint64_t offset;
+        uint64_t n_rows;
+    };
+
+    // The container of rank r, without extension
+    std::string container_path(const std::string &directory, const int rank);
+
+    class TextWriter;
+
+    /**
+     * @brief The thread which writes out the rows of every TextWriter of
+     * the process, whichever tracer (and pool thread) they belong to.
+     * @details Started with the first TextWriter. It sleeps on a condition
+     * variable while all rings are empty, and is woken by the first row
+     * pushed to any of them.
+     */
+    class TextWriterThread
+    {
+    protected:
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::vector<TextWriter*> _writers;
+        std::atomic<bool> _sleeping{false};
+        bool _stop = false;
+        std::thread _thread;
+
+        void _run();
+
+    public:
+        TextWriterThread();
+        TextWriterThread(const TextWriterThread&) = delete;
+        TextWriterThread& operator=(const TextWriterThread&) = delete;
+
+        // The thread of the process
+        static TextWriterThread& shared();
+
+        void add(TextWriter* writer);
+        void remove(TextWriter* writer);
+
+        // Called after a row is pushed, wakes the thread if it sleeps
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed))
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _wake.notify_one();
+            }
+        }
+
+        ~TextWriterThread();
+    };
+
+    /**
+     * @brief Queues the text output of one tracer (or batch) for the
+     * TextWriterThread, so that the simulation thread only copies rows
+     * into a ring buffer.
+     * @details The ring has a single producer, the simulation thread, and
+     * a single consumer, the writer thread, and takes no locks. A full ring
+     * holds the simulation thread back until the writer catches up.
+     */
+    class TextWriter
+    {
+    protected:
+        friend class TextWriterThread;
+
+        struct Record
+        {
+            FILE* file;
+            observable_t observable;
+            double row[3];
+        };
+
+        std::vector<Record> _ring;
+
+        // Rows pushed and rows written, on separate cache lines
+        alignas(64) std::atomic<size_t> _head{0};
+        alignas(64) std::atomic<size_t> _tail{0};
+
+        TextWriterThread &_thread;
+
+        // Writer thread only: writes every row pushed so far, and returns
+        // whether there were any
+        bool _drain();
+
+        bool _pending() const
+        {
+            return _head.load(std::memory_order_acquire) != _tail.load(std::memory_order_relaxed);
+        }
+
+    public:
+        TextWriter();
+        TextWriter(const TextWriter&) = delete;
+        TextWriter& operator=(const TextWriter&) = delete;
+
+        // Queues one row of n_columns(observable) values for file
+        void push(FILE* file, const observable_t observable, const double *row)
+        {
+            const size_t head = _head.load(std::memory_order_relaxed);
+            while (head - _tail.load(std::memory_order_acquire) >= TEXT_WRITER_CAPACITY)
+            {
+                std::this_thread::yield();
+            }
+            Record &record = _ring[head % TEXT_WRITER_CAPACITY];
+            record.file = file;
+            record.observable = observable;
+            for (unsigned int ii=0; ii<n_columns(observable); ii++){record.row[ii] = row[ii];}
+            _head.store(head + 1, std::memory_order_release);
+            _thread.notify();
+        }
+
+        // The rows pushed so far. Called by the simulation thread only
+        size_t pushed() const {return _head.load(std::memory_order_relaxed);}
+
+        // Waits until the first n_rows rows pushed have been written (not
+        // necessarily flushed), from any thread
+        void wait_for(const size_t n_rows) const
+        {
+            while (_tail.load(std::memory_order_acquire) < n_rows){std::this_thread::yield();}
+        }
+
+        // Waits until every row pushed so far has been written. Called by
+        // the simulation thread only
+        void wait(){wait_for(pushed());}
+
+        // Writes the remaining rows
+        ~TextWriter();
+    };
+
+    /**
+     * @brief One observable of one tracer, written either to its text file
+     * or to memory, to be appended to a container when the tracer is done.
+     */
+    class Stream
+    {
+    protected:
+        observable_t _observable;
+
+        // Text only, the writer formatting the rows, if any, and the rows
+        // (lines) of the file so far
+        FILE* _file = nullptr;
+        TextWriter* _writer = nullptr;
+        uint64_t _n_rows = 0;
+
+        // Otherwise, the rows one after another
+        std::vector<double> _values;
+
+    public:
+
+        /**
+         * @brief Opens the text file of the observable if format is TEXT,
+         * or nothing otherwise. When resuming from a checkpoint, the file is
+         * opened as it is, to be cut back to the checkpoint by load. Text
+         * rows are handed to writer if not null, and written directly
+         * otherwise.
+         */
+        Stream(const observable_t observable, const format_t format,
+            const parameters::FileNames &fnames, const bool resume,
+            TextWriter* writer = nullptr);
+        Stream(const Stream&) = delete;
+        Stream& operator=(const Stream&) = delete;
+
+        // Writes one row of n_columns(observable) values
+        void write(const double *row)
+        {
+            if (_file == nullptr){_values.insert(_values.end(), row, row + n_columns(_observable));}
+            else
+            {
+                if (_writer != nullptr){_writer->push(_file, _observable, row);}
+                else{write_text_row(_file, _observable, row);}
+                _n_rows++;
+            }
+        }
+        void write(const double value){write(&value);}
+
+        observable_t get_observable() const {return _observable;}
+        const std::vector<double>& get_values() const {return _values;}
+
+        // Saves the number of rows of the text file, which are flushed to
+        // it before the deferred parts of writer are serialized, or the rows
+        // so far
+        void save(checkpoint::Writer &writer) const;
+
+        // Cuts the text file back to the saved number of rows and continues
+        // from there, or restores the rows
+        void load(checkpoint::Reader &reader);
+
+        ~Stream();
+    };
+
+    /**
+     * @brief Where the rows of finished tracers go, if not to text files.
+     */
+    class Sink
+    {
+    public:
+        /**
+         * @brief Takes the rows of the streams of a finished tracer. Thread
+         * safe.
+         */
+        virtual void append(const unsigned int tracer, const std::vector<const Stream*> &streams) = 0;
+
+        virtual ~Sink(){}
+    };
+
+    /**
+     * @brief The container of one rank, see above. Thread safe.
+     */
+    class ContainerWriter : public Sink
+    {
+    protected:
+        FILE* _data;
+        FILE* _index;
+        std::mutex _mutex;
+
+    public:
+
+        /**
+         * @brief Creates path.dat and path.idx, or when resuming, appends
+         * to them if they exist.
+         */
+        ContainerWriter(const std::string &path, const bool resume);
+        ContainerWriter(const ContainerWriter&) = delete;
+        ContainerWriter& operator=(const ContainerWriter&) = delete;
+
+        /**
+         * @brief Appends the rows of the streams of a finished tracer and
+         * then their index entries, and flushes both files.
+         */
+        void append(const unsigned int tracer, const std::vector<const Stream*> &streams) override;
+
+        ~ContainerWriter();
+    };
+
+    /**
+     * @brief Reads the containers of every rank of a run directory.
+     */
+    class ContainerReader
+    {
+    protected:
+        std::vector<std::string> _data_paths;
+        std::vector<uint64_t> _ids;
+
+        // (tracer, observable) to the .dat it is in and its entry
+        std::map<std::pair<uint32_t, uint32_t>, std::pair<unsigned int, IndexEntry>> _entries;
+
+    public:
+
+        /**
+         * @brief Reads the index of every container under directory +
+         * "data/".
+         * @param directory The run directory, empty for the working
+         * directory, otherwise ending in "/"
+         */
+        ContainerReader(const std::string &directory);
+
+        // The tracers with at least one observable, in increasing order
+        std::vector<unsigned int> tracers() const;
+
+        bool contains(const unsigned int tracer, const observable_t observable) const;
+
+        /**
+         * @brief The index entry of an observable of a tracer, and the id
+         * of its container, which together change whenever the rows are
+         * written again. Throws if there are none.
+         */
+        IndexEntry entry(const unsigned int tracer, const observable_t observable,
+            uint64_t &container_id) const;
+
+        /**
+         * @brief The rows of an observable of a tracer, one after another,
+         * n_columns(observable) values each. Throws if there are none.
+         */
+        std::vector<double> read(const unsigned int tracer, const observable_t observable) const;
+    };
+
+    /**
+     * @brief Writes the text files of every tracer in the containers of a
+     * run directory, exactly as --output_format=text would have.
+     * @return The number of tracers written
+     */
+    unsigned int export_text(const std::string &directory);
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "output.h"
+#include "checkpoint.h"
+
+
+// The sums kept per observable and grid point: the number of tracers, the
+// total weight w and the weighted sums of x, x^2, y and y^2. A tracer adds
+// weight 1 and its value x for most observables, its cache size over the
+// capacity for the cache size (nothing without a cache), and its number of ridges, ridge mean x and
+// ridge median y for the ridges
+#define REDUCTION_N_SUMS 6
+
+// The tracers in final/aggregate.bin are summed in blocks of this many
+// consecutive indices, see reduction::update_directory
+#define AGGREGATE_BLOCK_SIZE 256
+
+// In-run reduction of the observables over tracers (--output_format=
+// reduced). Every rank adds the rows of its finished tracers to running
+// sums, which are added up over the ranks once all tracers are done, and
+// rank 0 writes the statistics postprocess.py would have computed from the
+// per-tracer files to final/, with one exception: the spread of the ridge
+// medians (the last two columns of final/ridge_*.txt) is taken about their
+// own weighted mean, where postprocess.py takes it about the mean of the
+// ridge means. Sums of different tracers, ranks or jobs add
+// up in any order, so that partial results can be merged. The same sums,
+// saved per block of tracers to final/aggregate.bin, let hdspin_postprocess
+// add the tracers of a follow-up job to those it has already averaged,
+// without reading them again.
+namespace reduction
+{
+
+    class Accumulator : public output::Sink
+    {
+    protected:
+        unsigned int _grid_length;
+
+        // [observable][grid point][sum], see REDUCTION_N_SUMS
+        std::vector<double> _sums;
+        std::mutex _mutex;
+
+        double* _at(const output::observable_t observable, const unsigned int point)
+        {
+            return &_sums[(observable * _grid_length + point) * REDUCTION_N_SUMS];
+        }
+
+        const double* _at(const output::observable_t observable, const unsigned int point) const
+        {
+            return &_sums[(observable * _grid_length + point) * REDUCTION_N_SUMS];
+        }
+
+    public:
+
+        /**
+         * @brief All sums zero.
+         * @param grid_length The number of points of the energy grid
+         */
+        Accumulator(const unsigned int grid_length);
+
+        // Whether values holds a row for every grid point, laid out as by
+        // output::Stream
+        bool complete(const output::observable_t observable, const std::vector<double> &values) const;
+
+        /**
+         * @brief Adds the rows of one observable of a tracer. Throws unless
+         * they are complete. Thread safe.
+         */
+        void add(const unsigned int tracer, const output::observable_t observable,
+            const std::vector<double> &values);
+
+        /**
+         * @brief Adds the rows of a finished tracer, see add.
+         */
+        void append(const unsigned int tracer, const std::vector<const output::Stream*> &streams) override;
+
+        /**
+         * @brief The flat sums, e.g. to be added up over MPI ranks. Not
+         * thread safe.
+         */
+        std::vector<double>& get_sums() {return _sums;}
+        const std::vector<double>& get_sums() const {return _sums;}
+
+        // Saves the grid length and the sums, see checkpoint.h. Throws on
+        // load if the grid length differs
+        void save(checkpoint::Writer &writer) const;
+        void load(checkpoint::Reader &reader);
+
+        /**
+         * @brief Writes final/<observable>.txt under directory for every
+         * observable with at least one tracer, in the layout of
+         * postprocess.py, see above for the spread of the ridge medians.
+         * Points without weight, and standard errors of a
+         * single tracer, are written as nan.
+         * @param directory The run directory, empty for the working
+         * directory, otherwise ending in "/"
+         * @param grid The energy grid
+         */
+        void write_final(const std::string &directory, const std::vector<long long> &grid) const;
+    };
+
+    constexpr uint32_t MAGIC = 0x47414448;  // "HDAG"
+
+    // Bumped whenever the layout of the aggregate file changes
+    constexpr uint32_t VERSION = 3;
+
+    // The sums of the finished tracers with indices from
+    // index * AGGREGATE_BLOCK_SIZE on, below the next block
+    struct AggregateBlock
+    {
+        uint32_t index;
+
+        // Increasing, with the fingerprints of their output when added
+        std::vector<uint32_t> tracers;
+        std::vector<uint64_t> fingerprints;
+
+        // As Accumulator::get_sums
+        std::vector<double> sums;
+    };
+
+    // The partial aggregate of a run directory, final/aggregate.bin
+    std::string aggregate_path(const std::string &directory);
+
+    /**
+     * @brief Saves the blocks of a grid of grid_length points, see
+     * aggregate_path, replacing the file atomically.
+     */
+    void save_aggregate(const std::string &path, const unsigned int grid_length,
+        const std::vector<AggregateBlock> &blocks);
+
+    /**
+     * @brief Loads what save_aggregate saved. Throws if the file is not an
+     * aggregate of this version or of this grid.
+     * @return false if there is no such file
+     */
+    bool load_aggregate(const std::string &path, const unsigned int grid_length,
+        std::vector<AggregateBlock> &blocks);
+
+    struct Update
+    {
+        // The tracers in the aggregate, and the finished tracers whose
+        // rows this update read
+        unsigned int n_tracers = 0;
+        unsigned int n_read = 0;
+
+        // The blocks of the saved aggregate summed again from scratch, and
+        // the blocks of the aggregate now
+        unsigned int n_rebuilt = 0;
+        unsigned int n_blocks = 0;
+    };
+
+    /**
+     * @brief Postprocessing of a run directory (hdspin_postprocess): adds
+     * the finished tracers not yet in its partial aggregate to it, and
+     * writes final/ and the aggregate again.
+     * @details Finished tracers are those whose text files in data/, or
+     * whose rows in the containers of --output_format=binary, have a row
+     * for every grid point. The aggregate keeps the sums of each block of
+     * AGGREGATE_BLOCK_SIZE consecutive tracers, to which tracers are always
+     * added in increasing order starting from zero, and final/ holds the
+     * sums of the blocks added in increasing order. This makes final/
+     * identical to a recompute over all tracers at once (full), while a
+     * new tracer below the last one of its block, or a tracer whose output
+     * is gone or has changed since it was added (e.g. rewritten by a job
+     * run again without --resume), only makes its own block be summed
+     * again. Changes are told by the size and modification time of text
+     * files, and by the container and index entry of rows in containers,
+     * without reading either again.
+     * @param directory The run directory, empty for the working directory,
+     * otherwise ending in "/"
+     * @param full Whether to ignore the saved aggregate
+     */
+    Update update_directory(const std::string &directory, const bool full);
+
+}
+
+#endif
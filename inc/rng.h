@@ -0,0 +1,607 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "checkpoint.h"
+#include "counter_rng.h"
+
+
+// Streaming random number engines, selected at runtime with --rng. mt19937
+// is the default and reproduces the draws of older versions exactly, through
+// the std distributions. The other engines have a few words of state, are
+// seeded per tracer from (seed, stream) so that every tracer and every
+// purpose within a tracer gets its own stream, and draw exponentials and
+// normals with ziggurat samplers instead of logarithms and Box-Muller.
+namespace rng
+{
+
+    enum kind_t {MT19937, XOSHIRO256PP, PCG64, PHILOX};
+
+    // Throws for anything but the names accepted by --rng
+    kind_t kind_from_string(const std::string &name);
+
+    // What a stream is used for. Each tracer owns one stream per purpose:
+    // the dynamics and the landscape of SpinSystem and EnergyMapping, and
+    // the dynamics of the tracer when it is stepped by SpinSystemBatch.
+    enum purpose_t {DYNAMICS_STREAM = 0, LANDSCAPE_STREAM = 1, BATCH_DYNAMICS_STREAM = 2};
+    constexpr uint64_t N_PURPOSES = 4;
+
+    /**
+     * @brief The stream of a tracer, keyed on its global index (over all MPI
+     * ranks) and the purpose of the stream.
+     */
+    inline uint64_t stream_id(const uint64_t tracer_index, const purpose_t purpose)
+    {
+        return N_PURPOSES * tracer_index + (uint64_t) purpose;
+    }
+
+    /**
+     * @brief 64 bits of seed from std::random_device, for unseeded runs.
+     */
+    uint64_t random_seed();
+
+    inline uint64_t _rotl(const uint64_t x, const int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    inline uint64_t _rotr(const uint64_t x, const unsigned int k)
+    {
+        return (x >> k) | (x << ((64 - k) & 63));
+    }
+
+    inline uint64_t _splitmix64(uint64_t x)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    // 128 bits derived from the seed and stream, used to fill the state of
+    // the streaming engines. Philox is a bijection of the counter for a
+    // given key, so distinct streams never share their initial state.
+    inline counter_rng::Philox4x32 _seed_block(const uint64_t seed,
+        const uint64_t stream, const uint32_t block)
+    {
+        const counter_rng::Philox4x32 ctr = {{(uint32_t) stream,
+            (uint32_t) (stream >> 32), block, 0x5EED5EED}};
+        return counter_rng::philox4x32_10(ctr, _splitmix64(seed));
+    }
+
+    inline uint64_t _lo64(const counter_rng::Philox4x32 &b)
+    {
+        return ((uint64_t) b.v[1] << 32) | b.v[0];
+    }
+
+    inline uint64_t _hi64(const counter_rng::Philox4x32 &b)
+    {
+        return ((uint64_t) b.v[3] << 32) | b.v[2];
+    }
+
+    /**
+     * @brief xoshiro256++ of Blackman and Vigna, 256 bits of state.
+     */
+    class Xoshiro256pp
+    {
+    public:
+        typedef uint64_t result_type;
+        static constexpr result_type min(){return 0;}
+        static constexpr result_type max(){return ~uint64_t(0);}
+
+        uint64_t s[4] = {1, 0, 0, 0};
+
+        void seed(const uint64_t seed, const uint64_t stream)
+        {
+            const counter_rng::Philox4x32 b0 = _seed_block(seed, stream, 0);
+            const counter_rng::Philox4x32 b1 = _seed_block(seed, stream, 1);
+            s[0] = _lo64(b0); s[1] = _hi64(b0); s[2] = _lo64(b1); s[3] = _hi64(b1);
+
+            // The all-zero state is the one fixed point of the engine
+            if ((s[0] | s[1] | s[2] | s[3]) == 0){s[0] = 1;}
+        }
+
+        inline result_type operator()()
+        {
+            const uint64_t result = _rotl(s[0] + s[3], 23) + s[0];
+            const uint64_t t = s[1] << 17;
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = _rotl(s[3], 45);
+            return result;
+        }
+    };
+
+    /**
+     * @brief PCG64 (XSL-RR 128/64) of O'Neill. The stream selects the
+     * increment of the underlying LCG, so every stream is a distinct
+     * sequence rather than an offset into a shared one.
+     */
+    class Pcg64
+    {
+    public:
+        typedef uint64_t result_type;
+        static constexpr result_type min(){return 0;}
+        static constexpr result_type max(){return ~uint64_t(0);}
+
+        unsigned __int128 state = 0;
+        unsigned __int128 increment = 1;
+
+        // pcg64_srandom_r
+        void seed_state(const unsigned __int128 initstate, const unsigned __int128 initseq)
+        {
+            state = 0;
+            increment = (initseq << 1) | 1;
+            _bump();
+            state += initstate;
+            _bump();
+        }
+
+        void seed(const uint64_t seed, const uint64_t stream)
+        {
+            const counter_rng::Philox4x32 b = _seed_block(seed, stream, 0);
+            const unsigned __int128 initstate = ((unsigned __int128) _hi64(b) << 64) | _lo64(b);
+            seed_state(initstate, (unsigned __int128) stream);
+        }
+
+        inline result_type operator()()
+        {
+            _bump();
+            return _rotr((uint64_t) (state >> 64) ^ (uint64_t) state,
+                (unsigned int) (state >> 122));
+        }
+
+    private:
+        inline void _bump()
+        {
+            const unsigned __int128 multiplier =
+                ((unsigned __int128) 2549297995355413924ULL << 64) | 4865540595714422341ULL;
+            state = state * multiplier + increment;
+        }
+    };
+
+    /**
+     * @brief Philox4x32-10 used as a streaming engine: the key is derived
+     * from the seed, the high half of the counter is the stream and the low
+     * half counts blocks of 128 bits.
+     */
+    class Philox
+    {
+    public:
+        typedef uint64_t result_type;
+        static constexpr result_type min(){return 0;}
+        static constexpr result_type max(){return ~uint64_t(0);}
+
+        void seed(const uint64_t seed, const uint64_t stream)
+        {
+            _key = _splitmix64(seed);
+            _stream = stream;
+            _block = 0;
+            _n_buffered = 0;
+        }
+
+        inline result_type operator()()
+        {
+            if (_n_buffered == 0)
+            {
+                const counter_rng::Philox4x32 ctr = {{(uint32_t) _block,
+                    (uint32_t) (_block >> 32), (uint32_t) _stream,
+                    (uint32_t) (_stream >> 32)}};
+                const counter_rng::Philox4x32 out = counter_rng::philox4x32_10(ctr, _key);
+                _buffer[0] = _lo64(out);
+                _buffer[1] = _hi64(out);
+                _block++;
+                _n_buffered = 2;
+            }
+            return _buffer[--_n_buffered];
+        }
+
+    private:
+        uint64_t _key = 0;
+        uint64_t _stream = 0;
+        uint64_t _block = 0;
+        uint64_t _buffer[2];
+        unsigned int _n_buffered = 0;
+    };
+
+
+    // Ziggurat samplers (Marsaglia and Tsang, 2000) with 256 layers, driven
+    // by one 64-bit draw per attempt: the low 8 bits select the layer and
+    // the high 53 bits the position within it. About 99% of the draws are
+    // accepted by a single comparison; the rest fall through to the wedge
+    // and tail tests. The tables are built at startup in rng.cpp.
+    namespace ziggurat
+    {
+        constexpr unsigned int LAYERS = 256;
+
+        // Edges x_i of the layers, decreasing from x_0 (the width of the
+        // base strip) to x_256 = 0, the density f(x_i) at the edges, and the
+        // ratios x_{i+1} / x_i below which a point lies under the density
+        extern double normal_x[LAYERS + 1];
+        extern double normal_f[LAYERS + 1];
+        extern double normal_ratio[LAYERS];
+        extern double exponential_x[LAYERS + 1];
+        extern double exponential_f[LAYERS + 1];
+        extern double exponential_ratio[LAYERS];
+
+        // Start of the normal tail, and of the exponential tail
+        constexpr double NORMAL_R = 3.6541528853610088;
+        constexpr double EXPONENTIAL_R = 7.69711747013104972;
+
+        template<typename Engine>
+        inline double _uniform_open_closed(Engine &engine)
+        {
+            return counter_rng::uniform_open_closed(engine());
+        }
+
+        // The wedge and tail tests of the normal sampler. Returns false if
+        // the attempt is rejected.
+        template<typename Engine>
+        bool _normal_slow(Engine &engine, const unsigned int ii, const double u, double &x)
+        {
+            if (ii == 0)
+            {
+                // Tail beyond R, by Marsaglia's method
+                double t, y;
+                do
+                {
+                    t = -log(_uniform_open_closed(engine)) / NORMAL_R;
+                    y = -log(_uniform_open_closed(engine));
+                } while (y + y < t * t);
+                x = u < 0.0 ? -(NORMAL_R + t) : NORMAL_R + t;
+                return true;
+            }
+            x = u * normal_x[ii];
+            const double y = normal_f[ii] + (1.0 - _uniform_open_closed(engine))
+                * (normal_f[ii + 1] - normal_f[ii]);
+            return y < exp(-0.5 * x * x);
+        }
+
+        // The normal sampler, starting from an attempt with the given
+        // bits and drawing further attempts from the engine if needed
+        template<typename Engine>
+        inline double _normal_from(Engine &engine, uint64_t bits)
+        {
+            while (true)
+            {
+                const unsigned int ii = bits & 0xFF;
+                const double u = (double) (bits >> 11) * 0x1.0p-52 - 1.0;
+                if (fabs(u) < normal_ratio[ii]){return u * normal_x[ii];}
+                double x;
+                if (_normal_slow(engine, ii, u, x)){return x;}
+                bits = engine();
+            }
+        }
+
+        // As above, for the exponential sampler
+        template<typename Engine>
+        inline double _exponential_from(Engine &engine, uint64_t bits)
+        {
+            // The tail beyond R is R plus another exponential sample
+            double offset = 0.0;
+            while (true)
+            {
+                const unsigned int ii = bits & 0xFF;
+                const double u = (double) (bits >> 11) * 0x1.0p-53;
+                if (u < exponential_ratio[ii]){return offset + u * exponential_x[ii];}
+                if (ii == 0){offset += EXPONENTIAL_R;}
+                else
+                {
+                    const double x = u * exponential_x[ii];
+                    const double y = exponential_f[ii] + (1.0 - _uniform_open_closed(engine))
+                        * (exponential_f[ii + 1] - exponential_f[ii]);
+                    if (y < exp(-x)){return offset + x;}
+                }
+                bits = engine();
+            }
+        }
+
+        /**
+         * @brief Standard normal sample.
+         */
+        template<typename Engine>
+        inline double normal(Engine &engine)
+        {
+            return _normal_from(engine, engine());
+        }
+
+        /**
+         * @brief Exponential sample of rate 1.
+         */
+        template<typename Engine>
+        inline double exponential(Engine &engine)
+        {
+            return _exponential_from(engine, engine());
+        }
+
+        // Block versions. The first attempt of every sample is drawn up
+        // front, in one tight loop over the engine, and the fast path then
+        // runs over the whole block; only the rare rejected attempts draw
+        // more. The output therefore depends on the block size, and with
+        // n = 1 matches the single sample versions.
+
+        /**
+         * @brief Fills out with n standard normal samples, using bits as n
+         * words of scratch space.
+         */
+        template<typename Engine>
+        inline void normal_block(Engine &engine, double *out, uint64_t *bits,
+            const unsigned int n)
+        {
+            for (unsigned int ii=0; ii<n; ii++){bits[ii] = engine();}
+            for (unsigned int ii=0; ii<n; ii++){out[ii] = _normal_from(engine, bits[ii]);}
+        }
+
+        /**
+         * @brief Fills out with n exponential samples of rate 1, using bits
+         * as n words of scratch space.
+         */
+        template<typename Engine>
+        inline void exponential_block(Engine &engine, double *out, uint64_t *bits,
+            const unsigned int n)
+        {
+            for (unsigned int ii=0; ii<n; ii++){bits[ii] = engine();}
+            for (unsigned int ii=0; ii<n; ii++){out[ii] = _exponential_from(engine, bits[ii]);}
+        }
+    }
+
+
+    /**
+     * @brief Uniform integer on [0, n) by Lemire's multiply-and-reject
+     * method, which needs a division only on the rare rejections.
+     */
+    template<typename Engine>
+    inline uint64_t uniform_below(Engine &engine, const uint64_t n)
+    {
+        unsigned __int128 m = (unsigned __int128) engine() * n;
+        uint64_t low = (uint64_t) m;
+        if (low < n)
+        {
+            const uint64_t threshold = (0 - n) % n;
+            while (low < threshold)
+            {
+                m = (unsigned __int128) engine() * n;
+                low = (uint64_t) m;
+            }
+        }
+        return (uint64_t) (m >> 64);
+    }
+
+
+    /**
+     * @brief The generator owned by SpinSystem and EnergyMapping.
+     * @details Holds one engine of the kind selected at seed time and
+     * exposes the draws the simulation needs. Every draw is a switch on the
+     * kind, which is always predicted, followed by inlined engine code. With
+     * mt19937 every draw goes through the same std distribution as before,
+     * so seeded runs reproduce older outputs exactly.
+     */
+    class Generator
+    {
+    public:
+        /**
+         * @brief Seeds the generator.
+         *
+         * @param kind The engine
+         * @param seed The seed of the run, or of the tracer
+         * @param stream The stream, see stream_id. Ignored by mt19937, which
+         * is seeded from the seed alone as in older versions.
+         */
+        void seed(const kind_t kind, const uint64_t seed, const uint64_t stream)
+        {
+            _kind = kind;
+            switch (_kind)
+            {
+                case MT19937:
+                    if (!_mt){_mt.reset(new std::mt19937);}
+                    _mt->seed((std::mt19937::result_type) seed);
+                    _mt_normal.reset();
+                    break;
+                case XOSHIRO256PP: _xoshiro.seed(seed, stream); break;
+                case PCG64: _pcg.seed(seed, stream); break;
+                case PHILOX: _philox.seed(seed, stream); break;
+            }
+        }
+
+        kind_t kind() const {return _kind;}
+
+        /**
+         * @brief Uniform double on [0, 1).
+         */
+        inline double uniform()
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: return (double) (_xoshiro() >> 11) * 0x1.0p-53;
+                case PCG64: return (double) (_pcg() >> 11) * 0x1.0p-53;
+                case PHILOX: return (double) (_philox() >> 11) * 0x1.0p-53;
+                default: return std::generate_canonical<double,
+                    std::numeric_limits<double>::digits>(*_mt);
+            }
+        }
+
+        /**
+         * @brief Uniform integer on [0, n).
+         */
+        inline unsigned int uniform_int(const unsigned int n)
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: return (unsigned int) uniform_below(_xoshiro, n);
+                case PCG64: return (unsigned int) uniform_below(_pcg, n);
+                case PHILOX: return (unsigned int) uniform_below(_philox, n);
+                default: return std::uniform_int_distribution<>(0, n - 1)(*_mt);
+            }
+        }
+
+        /**
+         * @brief Exponential sample of rate 1. Divide by lambda for rate
+         * lambda, which is what std::exponential_distribution does.
+         */
+        inline double exponential()
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: return ziggurat::exponential(_xoshiro);
+                case PCG64: return ziggurat::exponential(_pcg);
+                case PHILOX: return ziggurat::exponential(_philox);
+                default: return std::exponential_distribution<double>()(*_mt);
+            }
+        }
+
+        /**
+         * @brief Normal sample of mean 0 and standard deviation 1.
+         */
+        inline double normal()
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: return ziggurat::normal(_xoshiro);
+                case PCG64: return ziggurat::normal(_pcg);
+                case PHILOX: return ziggurat::normal(_philox);
+                default: return _mt_normal(*_mt);
+            }
+        }
+
+        /**
+         * @brief Fills out with n exponential samples of rate 1.
+         * @details With mt19937 these are the values n successive calls of
+         * exponential() would return. The other engines sample the block
+         * at once, see ziggurat::exponential_block.
+         *
+         * @param out Output array of length n
+         * @param bits Scratch array of length n
+         * @param n The number of samples
+         */
+        void fill_exponential(double *out, uint64_t *bits, const unsigned int n)
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: ziggurat::exponential_block(_xoshiro, out, bits, n); break;
+                case PCG64: ziggurat::exponential_block(_pcg, out, bits, n); break;
+                case PHILOX: ziggurat::exponential_block(_philox, out, bits, n); break;
+                default:
+                    std::exponential_distribution<double> dist;
+                    for (unsigned int ii=0; ii<n; ii++){out[ii] = dist(*_mt);}
+            }
+        }
+
+        /**
+         * @brief Fills out with n standard normal samples, see
+         * fill_exponential.
+         */
+        void fill_normal(double *out, uint64_t *bits, const unsigned int n)
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: ziggurat::normal_block(_xoshiro, out, bits, n); break;
+                case PCG64: ziggurat::normal_block(_pcg, out, bits, n); break;
+                case PHILOX: ziggurat::normal_block(_philox, out, bits, n); break;
+                default:
+                    for (unsigned int ii=0; ii<n; ii++){out[ii] = _mt_normal(*_mt);}
+            }
+        }
+
+        /**
+         * @brief A fair coin flip.
+         */
+        inline bool bit()
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: return _xoshiro() >> 63;
+                case PCG64: return _pcg() >> 63;
+                case PHILOX: return _philox() >> 63;
+                default: return std::bernoulli_distribution()(*_mt);
+            }
+        }
+
+        /**
+         * @brief Calls f with the underlying engine, for use with the std
+         * distributions.
+         */
+        template<typename F>
+        auto visit(F f)
+        {
+            switch (_kind)
+            {
+                case XOSHIRO256PP: return f(_xoshiro);
+                case PCG64: return f(_pcg);
+                case PHILOX: return f(_philox);
+                default: return f(*_mt);
+            }
+        }
+
+        /**
+         * @brief Saves the engine and its position in its stream. With
+         * mt19937, the state of the normal distribution is saved too, as it
+         * may hold the second of a pair of samples.
+         */
+        void save(checkpoint::Writer &writer) const
+        {
+            writer.write(_kind);
+            switch (_kind)
+            {
+                case MT19937:
+                {
+                    // The std text format, which is exact for both
+                    std::ostringstream s;
+                    s << *_mt << " " << _mt_normal;
+                    writer.write_string(s.str());
+                    break;
+                }
+                case XOSHIRO256PP: writer.write(_xoshiro); break;
+                case PCG64: writer.write(_pcg); break;
+                case PHILOX: writer.write(_philox); break;
+            }
+        }
+
+        /**
+         * @brief Restores what save wrote, continuing the same stream.
+         */
+        void load(checkpoint::Reader &reader)
+        {
+            reader.read(_kind);
+            switch (_kind)
+            {
+                case MT19937:
+                {
+                    if (!_mt){_mt.reset(new std::mt19937);}
+                    std::istringstream s(reader.read_string());
+                    s >> *_mt >> _mt_normal;
+                    if (!s){throw std::runtime_error("Invalid mt19937 state in checkpoint");}
+                    break;
+                }
+                case XOSHIRO256PP: reader.read(_xoshiro); break;
+                case PCG64: reader.read(_pcg); break;
+                case PHILOX: reader.read(_philox); break;
+                default: throw std::runtime_error("Invalid generator in checkpoint");
+            }
+        }
+
+    private:
+        kind_t _kind = MT19937;
+
+        // mt19937 keeps 5 KB of state, so it is only allocated when used
+        std::unique_ptr<std::mt19937> _mt;
+        std::normal_distribution<double> _mt_normal;
+
+        Xoshiro256pp _xoshiro;
+        Pcg64 _pcg;
+        Philox _philox;
+    };
+
+}
+
+#endif
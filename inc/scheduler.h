@@ -0,0 +1,107 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpi_compat.h"
+
+
+// Hands out the tracers of a job to the MPI ranks, one item at a time. An
+// item is a run of consecutive global tracer indices, one tracer or one
+// batch (see --batch_lanes). Output file names and seeds are keyed on the
+// global index, so the results do not depend on which rank ran a tracer.
+namespace scheduler
+{
+
+    enum mode_t {STATIC, DYNAMIC};
+
+    // Throws for anything but the names accepted by --scheduler
+    mode_t from_string(const std::string &name);
+
+    /**
+     * @brief The items static mode gives to rank out of world_size, in
+     * order: rank, rank + world_size, rank + 2 * world_size and so on.
+     * @details Dealt round-robin rather than in contiguous shares, so that
+     * when the items are sorted by cost (see --sweep), every rank gets its
+     * share of the expensive ones, and the totals of any two ranks differ
+     * by at most the cost of one item.
+     */
+    std::vector<unsigned int> static_items(const unsigned int n_items,
+        const int rank, const int world_size);
+
+    class TracerScheduler
+    {
+    protected:
+        mode_t _mode;
+        unsigned int _n_tracers;
+        unsigned int _tracers_per_item;
+        unsigned int _n_items;
+
+        // Static only: the items of this rank, and how many are taken
+        std::vector<unsigned int> _items;
+        size_t _next_item = 0;
+
+        // Dynamic only: the count of items handed out, which lives on rank
+        // 0. Rank 0 claims from it directly, and serves the claims of the
+        // other ranks on a thread of its own, so that they are answered
+        // while its workers compute, whether or not the MPI library makes
+        // progress in the background
+        MPI_Comm _comm = MPI_COMM_NULL;
+        int _rank = 0;
+        int _world_size = 1;
+        long long _counter = 0;
+        std::thread _dispatcher;
+
+        // Dynamic only, other than rank 0: whether rank 0 has answered that
+        // there are no items left, after which it is not asked again
+        bool _exhausted = false;
+
+        std::mutex _mutex;
+
+        long long _claim_local();
+        void _dispatch();
+
+    public:
+
+        /**
+         * @brief Collective over comm.
+         * @details Static mode deals the items to the ranks in turn, see
+         * static_items. Dynamic mode keeps a single count of the items
+         * handed out, so that ranks which finish early take more. With
+         * several ranks, it then requires MPI_THREAD_SERIALIZED, and rank 0
+         * must make no other MPI calls until the scheduler is destroyed.
+         *
+         * @param mode STATIC or DYNAMIC
+         * @param n_tracers The number of tracers of the whole job
+         * @param tracers_per_item The tracers run together, at least 1
+         * @param comm The communicator of the job
+         */
+        TracerScheduler(const mode_t mode, const unsigned int n_tracers,
+            const unsigned int tracers_per_item, MPI_Comm comm);
+
+        /**
+         * @brief Claims the next item of this rank.
+         * @details Thread safe. In dynamic mode, ranks other than 0 ask
+         * rank 0 with a message, holding the lock.
+         *
+         * @param first Set to the first tracer index of the item
+         * @param last Set to one past the last tracer index of the item
+         * @return false once there are no items left
+         */
+        bool next(unsigned int &first, unsigned int &last);
+
+        unsigned int get_n_tracers() const {return _n_tracers;}
+
+        /**
+         * @brief On rank 0 in dynamic mode, waits until every other rank
+         * has been told that there are no items left.
+         */
+        ~TracerScheduler();
+    };
+
+}
+
+#endif
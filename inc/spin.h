@@ -1,53 +1,137 @@
 #ifndef SPIN_H
 #define SPIN_H
 
+#include <chrono>
 #include <random>
 
 #include "utils.h"
+#include "checkpoint.h"
 #include "energy_mapping.h"
+#include "rng.h"
 
 
+// Standard adaptive dynamics reconsiders its choice of step every this many
+// calls, and switches when the other step is predicted to cost less than
+// this fraction of the current one per unit of simulated time
+#define ADAPTIVE_WINDOW_CALLS 1024
+#define ADAPTIVE_SWITCH_RATIO 0.8
+
+// With --step_timing=sampled, one step in this many is timed. The stride is
+// odd so that it does not alias with the alternating calls of the
+// rejection-free steps.
+#define STEP_TIMING_SAMPLE_STRIDE 63
+
+
+// Compile-time dynamics policies. The tracer loop resolves params.dynamics
+// to one of these once and then calls SpinSystem::step_with, so that the
+// step itself carries no dispatch.
+namespace dynamics
+{
+    struct Standard {};
+    struct Gillespie {};
+    struct StandardAccelerated {};
+    struct StandardAdaptive {};
+
+    enum id_t {STANDARD, GILLESPIE, STANDARD_ACCELERATED, STANDARD_ADAPTIVE};
+
+    // Throws for anything but the names accepted by --dynamics, other
+    // than auto
+    id_t from_string(const std::string &dynamics);
+}
+
+
+template<unsigned int Words>
 class SpinSystem
 {
 
+public:
+    typedef SpinState<Words> state_t;
+
 // Accessible only from within the class or it children
 protected:
     parameters::SimulationParameters params;
-    EnergyMapping* emap_ptr;
-    ap_uint<PRECISON> current_state;
+    EnergyMapping<Words>* emap_ptr;
+    state_t current_state;
     mutable parameters::SimulationStatistics sim_stats;
 
+    // params.dynamics and params.landscape, resolved once for step()
+    dynamics::id_t _dynamics;
+    bool _landscape_is_erem;
+
+    // Every _step_timing_stride'th step is timed, or none if 0
+    unsigned int _step_timing_stride = 1;
+    unsigned int _step_timing_countdown = 1;
+
+    inline bool _sample_step_timing()
+    {
+        if (_step_timing_stride == 0){return false;}
+        if (--_step_timing_countdown > 0){return false;}
+        _step_timing_countdown = _step_timing_stride;
+        return true;
+    }
+
     // Gillespie only //////////////////////////////////////////////////////
-    // Pointer to the delta E and exit rates
+    // Pointer to the delta E and exit rates. All arrays are allocated once,
+    // 64-byte aligned, in _init_gillespie.
     double* _exit_rates = 0;
-    ap_uint<PRECISON>* _neighbors = 0;
+    double* _cumulative_exit_rates = 0;
+    state_t* _neighbors = 0;
     double* _neighboring_energies = 0;
     std::vector<double> _normalized_exit_rates;
-    std::exponential_distribution<double> total_exit_rate_dist;
+    bool _use_reference_gillespie = false;
+    bool _use_vectorized_exit_rates = false;
 
     // Fills the exit_rates and delta_E arrays and returns the total exit
     // rate.
     double _calculate_exit_rates(const double current_energy) const;
+
+    // Single pass version of the above, which fills the running sum of the
+    // exit rates instead and returns the total exit rate.
+    double _calculate_cumulative_exit_rates(const double current_energy) const;
+
+    // Selects the neighbor to move to given a uniform draw on [0, 1), by a
+    // linear search over the cumulative exit rates.
+    unsigned int _select_spin_to_flip(const double u, const double total_exit_rate) const;
     ////////////////////////////////////////////////////////////////////////
 
-    // Standard only
-    std::uniform_real_distribution<> uniform_0_1_distribution;
-    std::uniform_int_distribution<> spin_distribution;
+    // Standard accelerated only. The acceptance probability of a single
+    // standard step from the current state, and whether the rejections
+    // preceding the next accepted move have already been returned.
+    double _acceptance_probability = 0.0;
+    bool _accepted_move_pending = false;
+
+    // Standard adaptive only. Whether the rejection-free step is in use,
+    // the measurements over the current window of calls, and the last
+    // measured costs of a standard step and of a rejection-free visit (0
+    // until measured).
+    bool _adaptive_rejection_free = false;
+    unsigned int _adaptive_window_calls = 0;
+    std::chrono::time_point<std::chrono::high_resolution_clock> _adaptive_window_start;
+    unsigned long long _adaptive_window_start_steps = 0;
+    unsigned long long _adaptive_window_start_acceptances = 0;
+    double _cost_per_standard_step = 0.0;
+    double _cost_per_rejection_free_visit = 0.0;
+    unsigned long long _n_dynamics_switches = 0;
+
+    // Called after every step: accumulates the window and, at its end,
+    // switches to whichever step is predicted to be cheaper per unit of
+    // simulated time
+    void _adapt_dynamics();
     ////////////////////////////////////////////////////////////////////////
 
-    // Initialize the MT random number generator and seed with random_device
-    // This is seeded in the constructor
-    mutable std::mt19937 generator;
+    // The random number generator, of the kind selected by params.rng, on
+    // the dynamics stream of the tracer. This is seeded in the constructor
+    mutable rng::Generator generator;
 
     // Pointer to the neighbors and neighboring energies, used in the inherent
     // structure computation
-    // ap_uint<PRECISON>* neighbors = 0;
+    // state_t* neighbors = 0;
     // double* neighboring_energies = 0;
 
 
     // Initialize some objects for storing the previous and current values of
     // things. This is required for some of the 2-point observables.
-    parameters::StateProperties _prev, _curr;
+    parameters::StateProperties<Words> _prev, _curr;
 
     /**
      * @brief [brief description]
@@ -66,8 +150,17 @@ protected:
 
     // // Updater for the previous values; this should be done at the end of
     // // every recording phase
-    void _init_previous_state_();
-    void _init_current_state_();
+    template<typename Landscape> void _init_previous_state_();
+    template<typename Landscape> void _init_current_state_();
+
+    template<typename Landscape> double _step_standard();
+    template<typename Landscape> double _step_standard_accelerated();
+    template<typename Landscape> double _step_standard_adaptive();
+    template<typename Landscape> double _step_gillespie();
+    template<typename Landscape> double _step_gillespie_reference();
+
+    // Runtime dispatch on _dynamics, for step()
+    template<typename Landscape> double _step_with_dynamics();
 
 // Accessible outside of the class instance
 public:
@@ -79,7 +172,7 @@ public:
      * @param s [description]
      * @param g [description]
      */
-    SpinSystem(const parameters::SimulationParameters params, EnergyMapping& emap);
+    SpinSystem(const parameters::SimulationParameters params, EnergyMapping<Words>& emap);
 
     /**
      * @brief [brief description]
@@ -94,7 +187,7 @@ public:
      * 
      * @param state [description]
      */
-    void set_state(ap_uint<PRECISON> state);
+    void set_state(const state_t &state);
 
     /**
      * @brief [brief description]
@@ -103,15 +196,59 @@ public:
      */
     std::string binary_state() const;
 
-    parameters::StateProperties get_previous_state() const {return _prev;}
-    parameters::StateProperties get_current_state() const {return _curr;}
-    EnergyMapping* get_emap_ptr() const {return emap_ptr;}
+    state_t get_state() const {return current_state;}
+    parameters::StateProperties<Words> get_previous_state() const {return _prev;}
+    parameters::StateProperties<Words> get_current_state() const {return _curr;}
+    EnergyMapping<Words>* get_emap_ptr() const {return emap_ptr;}
     parameters::SimulationStatistics get_sim_stats() const {return sim_stats;}
     // double get_average_neighboring_energy() const;
     
-    double _step_standard();
-    double _step_gillespie();
+    unsigned long long get_n_dynamics_switches() const {return _n_dynamics_switches;}
+
+    /**
+     * @brief Steps the system with the given dynamics and landscape policies.
+     * @details Must match params.dynamics and params.landscape. This is the
+     * entry point for the tracer loop, which picks the policies once.
+     * @return The waiting time
+     */
+    template<typename Dynamics, typename Landscape>
+    double step_with();
+
+    /**
+     * @brief Steps the system, dispatching on params.dynamics and
+     * params.landscape at runtime.
+     * @return The waiting time
+     */
     double step();
+
+    /**
+     * @brief Records a standard step (waiting time 1) which was taken on
+     * behalf of this system, by SpinSystemBatch, so that the observables
+     * see it as any other step.
+     *
+     * @param prev The state and energy before the step
+     * @param curr The state and energy after the step
+     * @param accepted Whether the proposed flip was accepted
+     * @param wall_time The wall time to attribute to the step
+     */
+    void record_step(const parameters::StateProperties<Words> &prev,
+        const parameters::StateProperties<Words> &curr, const bool accepted,
+        const double wall_time);
+
+    /**
+     * @brief Saves the state of the tracer and of its generator, and of
+     * the dynamics in use, so that load continues the same trajectory.
+     * @details The landscape is saved separately, see EnergyMapping::save.
+     * The timing window of standard-adaptive dynamics restarts on load.
+     */
+    void save(checkpoint::Writer &writer) const;
+
+    /**
+     * @brief Restores what save wrote, into a system constructed with the
+     * same parameters. Throws if the dynamics or N_spins do not match.
+     */
+    void load(checkpoint::Reader &reader);
+
     void summarize();
 
     ~SpinSystem();
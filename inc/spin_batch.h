@@ -0,0 +1,100 @@
+#ifndef SPIN_BATCH_H
+#define SPIN_BATCH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+#include "energy_mapping.h"
+#include "spin.h"
+
+// Most tracers one batch advances in lockstep
+#define BATCH_MAX_LANES 64
+
+// The lane loops run over a multiple of this many lanes, one AVX-512
+// register of 64-bit words, so that they need no remainder loop
+#define BATCH_LANE_MULTIPLE 8
+
+
+/**
+ * @brief Standard dynamics for up to BATCH_MAX_LANES independent tracers of
+ * at most 64 spins, advanced one step at a time in lockstep.
+ * @details Each lane is a tracer with its own SpinSystem<1> and
+ * EnergyMapping<1>, which keep the statistics and the previous and current
+ * states the observables read. The batch holds the states, energies and
+ * keys of all lanes as arrays, so that proposing the flips (a Philox block
+ * per lane, keyed on the tracer seed, on the BATCH_DYNAMICS_STREAM of the
+ * tracer), hashing the proposed states and the Metropolis test run across
+ * SIMD lanes. Only the energy lookups of cached or dense landscapes, and
+ * the transform of hashed bits into an energy, are done lane by lane.
+ */
+class SpinSystemBatch
+{
+protected:
+    std::vector<SpinSystem<1>*> _systems;
+    std::vector<EnergyMapping<1>*> _emaps;
+    unsigned int _n_lanes;
+    unsigned int _n_padded_lanes;
+    unsigned int _N_spins;
+    double _beta;
+    double _beta_critical;
+    double _grem_sigma;
+    bool _use_hashed_landscape;
+
+    // Steps taken so far, which is the low half of the Philox counter of
+    // every lane
+    uint64_t _n_steps = 0;
+
+    // Every _step_timing_stride'th step is timed, or none if 0
+    unsigned int _step_timing_stride = 1;
+    unsigned int _step_timing_countdown = 1;
+
+    // Per lane state, padded lanes are left at zero other than the masks
+    alignas(64) uint64_t _states[BATCH_MAX_LANES];
+    alignas(64) double _energies[BATCH_MAX_LANES];
+    alignas(64) uint32_t _dynamics_key_lo[BATCH_MAX_LANES];
+    alignas(64) uint32_t _dynamics_key_hi[BATCH_MAX_LANES];
+    alignas(64) uint32_t _stream_lo[BATCH_MAX_LANES];
+    alignas(64) uint32_t _stream_hi[BATCH_MAX_LANES];
+    alignas(64) uint32_t _landscape_key_lo[BATCH_MAX_LANES];
+    alignas(64) uint32_t _landscape_key_hi[BATCH_MAX_LANES];
+    alignas(64) uint64_t _first_spin_masks[BATCH_MAX_LANES];
+
+    // Scratch space for one step
+    alignas(64) uint32_t _bits[4][BATCH_MAX_LANES];
+    alignas(64) uint64_t _proposed_states[BATCH_MAX_LANES];
+    alignas(64) double _proposed_energies[BATCH_MAX_LANES];
+    alignas(64) double _uniforms[BATCH_MAX_LANES];
+    alignas(64) uint64_t _previous_states[BATCH_MAX_LANES];
+    alignas(64) double _previous_energies[BATCH_MAX_LANES];
+    alignas(64) uint64_t _accepted[BATCH_MAX_LANES];
+
+public:
+
+    /**
+     * @brief Takes over the stepping of the given systems.
+     * @details All systems must share N_spins (at most 64), beta, the
+     * landscape and its mode, and run standard dynamics. Their initial
+     * states are kept, and params[ii] must be the parameters systems[ii]
+     * was constructed with.
+     *
+     * @param params The parameters of each lane
+     * @param systems The systems of each lane, which must outlive the batch
+     */
+    SpinSystemBatch(const std::vector<parameters::SimulationParameters> &params,
+        const std::vector<SpinSystem<1>*> &systems);
+
+    unsigned int get_n_lanes() const {return _n_lanes;}
+    uint64_t get_lane_state(const unsigned int lane) const {return _states[lane];}
+    double get_lane_energy(const unsigned int lane) const {return _energies[lane];}
+
+    /**
+     * @brief Takes one standard step (waiting time 1) in every lane, and
+     * records it in the SpinSystem of the lane.
+     * @details Landscape must match the landscape of the lanes.
+     */
+    template<typename Landscape>
+    void step_with();
+};
+
+#endif
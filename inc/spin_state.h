@@ -0,0 +1,186 @@
+#ifndef SPIN_STATE_H
+#define SPIN_STATE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+
+/**
+ * @brief Fixed-width bitset representation of a spin configuration.
+ * @details The state is stored as an array of 64-bit words in little-endian
+ * word order, i.e. bit k lives in words[k / 64] at position k % 64, so that
+ * bit k of the state is the coefficient of 2^k in its binary integer
+ * representation. All operations on the hot path (flipping, xor, comparison
+ * and hashing) are a handful of word operations which the compiler can fully
+ * unroll.
+ *
+ * @tparam Words The number of 64-bit words, so that the state can hold up
+ * to 64 * Words spins.
+ */
+template<unsigned int Words>
+struct SpinState
+{
+    static_assert(Words > 0, "SpinState requires at least one word");
+
+    static constexpr unsigned int n_words = Words;
+    static constexpr unsigned int n_bits = 64 * Words;
+
+    uint64_t words[Words];
+
+    constexpr SpinState() : words{} {}
+
+    // Implicit on purpose so that small integer states can be written
+    // directly, e.g. emap.get_config_energy(13)
+    constexpr SpinState(const uint64_t value) : words{value} {}
+
+    /**
+     * @brief Flips the k'th bit (the coefficient of 2^k) in place.
+     */
+    inline void flip(const unsigned int k)
+    {
+        words[k >> 6] ^= uint64_t(1) << (k & 63);
+    }
+
+    /**
+     * @brief Returns the value of the k'th bit.
+     */
+    inline bool get(const unsigned int k) const
+    {
+        return (words[k >> 6] >> (k & 63)) & uint64_t(1);
+    }
+
+    inline SpinState& operator^=(const SpinState& other)
+    {
+        for (unsigned int ii=0; ii<Words; ii++){words[ii] ^= other.words[ii];}
+        return *this;
+    }
+
+    inline SpinState operator^(const SpinState& other) const
+    {
+        SpinState res = *this;
+        res ^= other;
+        return res;
+    }
+
+    inline bool operator==(const SpinState& other) const
+    {
+        uint64_t diff = 0;
+        for (unsigned int ii=0; ii<Words; ii++)
+        {
+            diff |= words[ii] ^ other.words[ii];
+        }
+        return diff == 0;
+    }
+
+    inline bool operator!=(const SpinState& other) const
+    {
+        return !(*this == other);
+    }
+
+    /**
+     * @brief The number of set bits (up spins) in the state.
+     */
+    inline unsigned int popcount() const
+    {
+        unsigned int count = 0;
+        for (unsigned int ii=0; ii<Words; ii++)
+        {
+            count += __builtin_popcountll(words[ii]);
+        }
+        return count;
+    }
+
+    /**
+     * @brief Fast non-cryptographic hash of the packed words.
+     * @details Each word is folded in with a multiply-xorshift step and the
+     * result is passed through the murmur3/splitmix64 finalizer, so that
+     * states differing by a single flipped spin land far apart.
+     */
+    inline size_t hash() const
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ULL;
+        for (unsigned int ii=0; ii<Words; ii++)
+        {
+            h ^= words[ii];
+            h *= 0xbf58476d1ce4e5b9ULL;
+            h ^= h >> 31;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    /**
+     * @brief Hexadecimal rendering of the full word array, most significant
+     * word first.
+     */
+    std::string to_string() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string s(16 * Words, '0');
+        for (unsigned int ii=0; ii<Words; ii++)
+        {
+            const uint64_t w = words[Words - 1 - ii];
+            for (unsigned int jj=0; jj<16; jj++)
+            {
+                s[16 * ii + jj] = digits[(w >> (60 - 4 * jj)) & 0xf];
+            }
+        }
+        return s;
+    }
+};
+
+static_assert(std::is_trivially_copyable<SpinState<4>>::value,
+    "SpinState must be trivially copyable");
+
+// Allows SpinState to key the standard hashed containers directly on its
+// packed words
+namespace std
+{
+    template<unsigned int Words>
+    struct hash<SpinState<Words>>
+    {
+        size_t operator()(const SpinState<Words>& state) const noexcept
+        {
+            return state.hash();
+        }
+    };
+}
+
+
+// The simulation core (SpinSystem, EnergyMapping and the observables) is
+// compiled for each of the following state widths, in 64-bit words, i.e.
+// 64, 128, 256 and 1024 spins. At runtime, the smallest width which fits
+// N_spins is selected. To add a width, extend
+// HDSPIN_INSTANTIATE_STATE_WIDTHS, state_words_for_n_spins and the
+// instantiations of the policy steps at the end of spin.cpp.
+#define HDSPIN_MAX_STATE_WORDS 16
+
+#define HDSPIN_INSTANTIATE_STATE_WIDTHS(cls) \
+    template class cls<1>;                   \
+    template class cls<2>;                   \
+    template class cls<4>;                   \
+    template class cls<16>;
+
+/**
+ * @brief Selects the smallest compiled state width that fits N spins.
+ * 
+ * @param N_spins The number of spins in the simulation
+ * @return The number of 64-bit words, or 0 if N_spins is too large.
+ */
+constexpr unsigned int state_words_for_n_spins(const unsigned int N_spins)
+{
+    return N_spins <= 64 ? 1
+        : N_spins <= 128 ? 2
+        : N_spins <= 256 ? 4
+        : N_spins <= 64 * HDSPIN_MAX_STATE_WORDS ? HDSPIN_MAX_STATE_WORDS
+        : 0;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+
+// Parameter sweeps run as a single job (--sweep). The spec is a JSON object
+// of parameters, as in config.json, where N_spins and beta may be lists:
+// every (N_spins, beta) pair is a point of the sweep, with its own run
+// directory, and the tracers of all points are scheduled together.
+//
+//     {"log10_N_timesteps": 7, "landscape": "EREM", "n_tracers": 100,
+//      "N_spins": [16, 20, 24], "beta": [1.0, 1.5, 2.0],
+//      "dynamics_or_threshold": 2.0}
+//
+// As in scripts/construct_inputs.py, "dynamics_or_threshold" is either a
+// dynamics, or a value of beta below which a point runs standard dynamics
+// and at or above which it runs Gillespie dynamics.
+namespace sweep
+{
+
+    struct Point
+    {
+        parameters::SimulationParameters params;
+
+        // The run directory of the point, see parameters::get_filenames
+        std::string directory;
+    };
+
+    /**
+     * @brief The points of a sweep spec, N_spins outermost, in the order
+     * given.
+     * @details Parameters not in the spec keep their value in defaults,
+     * i.e. the command line. Throws for unknown keys, for keys which apply
+     * to the whole job (such as threads or scheduler), and for values which
+     * the command line would reject.
+     *
+     * @param spec The parsed spec
+     * @param defaults The parameters of every point before the spec
+     * @return The points, with update_parameters_ applied
+     */
+    std::vector<Point> points_from_json(const json &spec,
+        const parameters::SimulationParameters &defaults);
+
+    /**
+     * @brief The run directory of a point, e.g. "16_1.5000/".
+     */
+    std::string point_directory(const unsigned int N_spins, const double beta);
+
+    /**
+     * @brief A rough estimate of the cost of one tracer, in energy lookups,
+     * to order the tracers of a sweep longest first.
+     * @details Standard dynamics makes about one lookup per unit of time.
+     * A Gillespie step looks up all N_spins neighbors and advances the
+     * clock by at least one unit of time on average (the total exit rate
+     * is at most 1), so N_spins lookups per unit of time bound its cost.
+     * Only the order of the estimates matters.
+     */
+    double estimated_cost(const parameters::SimulationParameters &params);
+
+}
+
+#endif
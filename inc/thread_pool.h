@@ -0,0 +1,90 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Runs the tracers of one MPI rank on a pool of local threads. Tracers are
+// independent and of uneven length, so the workers pull the next tracer
+// as they finish rather than taking fixed shares.
+namespace thread_pool
+{
+
+    /**
+     * @brief Calls work(item) for every item returned by claim, on
+     * n_threads threads, until claim runs out of items.
+     * @details With a single thread the items run in order on the calling
+     * thread. If work throws, no further items are claimed, and the first
+     * exception is rethrown on the calling thread once all workers have
+     * stopped.
+     *
+     * @param n_threads The number of threads, at least 1
+     * @param claim Callable taking an unsigned int reference, which it sets
+     * to the next item and returns true, or returns false if there are no
+     * items left. Called by one thread at a time
+     * @param work Callable taking the item, safe to call concurrently
+     */
+    template<typename Claim, typename Work>
+    void run_claimed(const unsigned int n_threads, Claim claim, Work work)
+    {
+        unsigned int item;
+        if (n_threads <= 1)
+        {
+            while (claim(item)){work(item);}
+            return;
+        }
+
+        std::mutex claim_mutex;
+        std::atomic<bool> failed(false);
+        std::exception_ptr first_exception;
+        std::mutex exception_mutex;
+
+        auto worker = [&]()
+        {
+            while (!failed.load())
+            {
+                unsigned int my_item;
+                {
+                    std::lock_guard<std::mutex> lock(claim_mutex);
+                    if (!claim(my_item)){return;}
+                }
+                try{work(my_item);}
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(exception_mutex);
+                    if (!first_exception){first_exception = std::current_exception();}
+                    failed.store(true);
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int tt=0; tt<n_threads; tt++){workers.emplace_back(worker);}
+        for (std::thread &t : workers){t.join();}
+        if (first_exception){std::rethrow_exception(first_exception);}
+    }
+
+    /**
+     * @brief Calls work(item) once for every item in [0, n_items), on
+     * n_threads threads, each worker taking the lowest item not yet taken.
+     * See run_claimed.
+     */
+    template<typename Work>
+    void run(const unsigned int n_items, const unsigned int n_threads, Work work)
+    {
+        unsigned int next_item = 0;
+        run_claimed(n_threads, [&next_item, n_items](unsigned int &item)
+        {
+            if (next_item >= n_items){return false;}
+            item = next_item++;
+            return true;
+        }, work);
+    }
+
+}
+
+#endif
@@ -4,21 +4,22 @@
  */
 
 #include <fstream>      // std::ofstream
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include "ArbitraryPrecision/ap/ap.hpp"
+#include "spin_state.h"
 #include "Json/json.hpp"
 using json = nlohmann::json;
 
 #ifndef UTILS_H
 #define UTILS_H
 
-// Default value for the arbitrary precision is 128
-// Meaning we can have up to 128 spins
-// This must be defined at compile time using e.g. -DPRECISON=12345
-// As per the Arbitrary Precision docs, this should probably be a power of 2!
-#ifndef PRECISON
-#define PRECISON 128
-#endif
+// The maximum number of spins, set by the widest compiled state width (see
+// spin_state.h). Narrower widths are dispatched to at runtime.
+#define PRECISON (64 * HDSPIN_MAX_STATE_WORDS)
 
 // The smoke test is a faster version of the tests
 // this modifies a few of the tests that otherwise might take a while
@@ -39,19 +40,6 @@ double mean_vector(const std::vector<double> v);
  */
 double variance_vector(const std::vector<double> v);
 
-/**
- * @brief Defines arbitrary precision integer powers
- * @details Using the Arbitrary Precision library, defines custom code for
- * performing arbitrary precision power operations using only multiplication
- * in for loops
- * 
- * @param const int The base
- * @param const int The exponent
- * 
- * @return The integral result of the power operation.
- */
-ap_uint<PRECISON> arbitrary_precision_integer_pow(const int, const int);
-
 /**
  * @brief [brief description]
  * @details [long description]
@@ -70,59 +58,95 @@ namespace state
 
     /**
      * @brief Gets the neighboring states given a representation
-     * @details Using binary operations (bit shifts) and arbitrary precision
-     * integers, finds all neighbors in the binary bit-shift space.
+     * @details Using word-level bit operations on the SpinState, finds all
+     * neighbors in the binary bit-flip space. The k'th neighbor corresponds
+     * to flipping spin k, i.e. bit bitLength - 1 - k.
      * 
-     * @param neighbors ap_uint<PRECISON>* Pointer to an array of neighbors to be populated
-     * @param n ap_uint<PRECISON> The binary representation of the state of which we
+     * @param neighbors SpinState* Pointer to an array of neighbors to be populated
+     * @param n SpinState The binary representation of the state of which we
      * want to find the neighbors of
      * @param bitLength int
      */
-    void get_neighbors_(ap_uint<PRECISON>* neighbors, ap_uint<PRECISON> n, const unsigned int bitLength);
+    template<unsigned int Words>
+    inline void get_neighbors_(SpinState<Words>* neighbors, const SpinState<Words> &n, const unsigned int bitLength)
+    {
+        for (unsigned int k=0; k<bitLength; k++)
+        {
+            neighbors[k] = n;
+            neighbors[k].flip(bitLength - 1 - k);
+        }
+    }
 
     /**
      * @brief Flips a specific spin in the bit representation
      * 
-     * @param state ap_uint<PRECISON> The current state
-     * @param k int The bit to flip
+     * @param state SpinState The current state
+     * @param k int The spin to flip
      * 
-     * @return ap_uint<PRECISON>
+     * @return SpinState
      */
-    ap_uint<PRECISON> flip_bit(const ap_uint<PRECISON> state, const unsigned int k, const unsigned int bitLength);
+    template<unsigned int Words>
+    inline SpinState<Words> flip_bit(const SpinState<Words> &state, const unsigned int k, const unsigned int bitLength)
+    {
+        SpinState<Words> res = state;
+        res.flip(bitLength - 1 - k);
+        return res;
+    }
 
     /**
-     * @brief Converts an integer array to an arbitrary precision integer
-     * @details Using the Arbitrary Precision library, converts a binary integer
-     * array to an arbitrary precision integer
+     * @brief Converts an integer array to a spin state
+     * @details The first element of the array is the most significant bit,
+     * so spin ii is stored at bit N - 1 - ii.
      * 
      * @param const int * Pointer to the binary array
      * @param const int The total number of spins
-     * @param ap_uint<PRECISON> & Memory address of the integer to fill
+     * @param SpinState & Memory address of the state to fill
      */
-    void arbitrary_precision_integer_from_int_array_(const unsigned int *, const unsigned int, ap_uint<PRECISON> &);
+    template<unsigned int Words>
+    inline void spin_state_from_int_array_(const unsigned int *config, const unsigned int N, SpinState<Words> &res)
+    {
+        res = SpinState<Words>();
+        for (unsigned int ii=0; ii<N; ii++)
+        {
+            if (config[ii]){res.flip(N - 1 - ii);}
+        }
+    }
 
     /**
-     * @brief Reverses that of arbitrary_precision_integer_from_int_array_
-     * @details Using the Arbitrary Precision library, converts an an arbitrary
-     * precision integer to a binary integer array
+     * @brief Reverses that of spin_state_from_int_array_
      * 
      * @param int * Pointer to the binary array to fill
      * @param const int The number of spins
-     * @param const ap_uint<PRECISON> The integer to compute
+     * @param const SpinState The state to convert
      */
-    void int_array_from_arbitrary_precision_integer_(unsigned int *, const unsigned int, const ap_uint<PRECISON> &);
+    template<unsigned int Words>
+    inline void int_array_from_spin_state_(unsigned int *config, const unsigned int N, const SpinState<Words> &state)
+    {
+        for (unsigned int ii=0; ii<N; ii++)
+        {
+            config[ii] = state.get(N - 1 - ii);
+        }
+    }
 
 
     /**
-     * @brief [brief description]
-     * @details [long description]
+     * @brief Binary string representation of the first N spins
      * 
-     * @param current_state [description]
-     * @param int [description]
+     * @param current_state The state
+     * @param int The number of spins
      * 
-     * @return [description]
+     * @return A string of N 0's and 1's, spin 0 first
      */
-    std::string string_rep_from_arbitrary_precision_integer(const ap_uint<PRECISON> current_state, const unsigned int N);
+    template<unsigned int Words>
+    std::string string_rep_from_spin_state(const SpinState<Words> &current_state, const unsigned int N)
+    {
+        std::string s(N, '0');
+        for (unsigned int ii=0; ii<N; ii++)
+        {
+            if (current_state.get(N - 1 - ii)){s[ii] = '1';}
+        }
+        return s;
+    }
 
 }
 
@@ -131,16 +155,17 @@ namespace parameters
 
     // The properties of a state. Returned as a function of the states's
     // integer representation
+    template<unsigned int Words>
     struct StateProperties
     {
-        ap_uint<PRECISON> state;
+        SpinState<Words> state;
         double energy;
     };
 
     struct FileNames
     {
         // utilities
-        std::string ii_str, grids_directory;
+        std::string ii_str;
 
         // observables
 
@@ -152,6 +177,9 @@ namespace parameters
 
         // Misc
         std::string cache_size, acceptance_rate, walltime_per_waitingtime;
+
+        // Checkpoints, and the marker of a finished tracer
+        std::string checkpoint, checkpoint_done;
     };
 
     struct SimulationParameters
@@ -164,8 +192,21 @@ namespace parameters
 
         // Some come along with defaults
         long long memory = pow(2, 25);
+        std::string landscape_mode = "cached";
+        std::string cache_engine = "clock";
         std::string dynamics = "auto";
+        std::string gillespie_kernel = "linear";
+        std::string step_timing = "sampled";
+        std::string rng = "mt19937";
+        unsigned int energy_buffer_size = 256;
+        unsigned int batch_lanes = 0;  // 0 runs the tracers one at a time
         unsigned int n_tracers_per_MPI_rank = 10;
+        unsigned int n_tracers = 0;  // Over all MPI ranks, 0 for n_tracers_per_MPI_rank each
+        std::string scheduler = "static";
+        unsigned int threads = 1;
+        double checkpoint_interval = 0.0;  // Seconds of wall time, 0 for no checkpoints
+        bool resume = false;
+        std::string output_format = "text";
         unsigned int seed = 0;  // 0 is special, meaning no seed
 
         // Some defaults which are not required to be explicitly set by the user
@@ -174,6 +215,7 @@ namespace parameters
         double energetic_threshold;
         double entropic_attractor;
         bool use_manual_seed = false;
+        unsigned long long tracer_index = 0;  // Over all MPI ranks, keys the rng streams
         bool valid_entropic_attractor = true;
         int grid_size = 100;
         double dw = 0.5;
@@ -215,43 +257,72 @@ namespace parameters
     json parameters_to_json(const SimulationParameters p);
 
     /**
-     * @brief [brief description]
-     * @details [long description]
+     * @brief The files of tracer ii.
+     * @details All paths are under directory, which is empty for the
+     * working directory and otherwise ends in '/', e.g. one point of a
+     * sweep (see sweep.h).
      * 
-     * @param ii [description]
-     * @return [description]
+     * @param ii The tracer index
+     * @param directory The run directory
+     * @return The file names
      */
-    FileNames get_filenames(const unsigned int ii);
+    FileNames get_filenames(const unsigned int ii, const std::string &directory);
 
 }
 
 /**
- * @brief [brief description]
- * @details [long description]
+ * @brief Makes the data and grids directories under directory, see
+ * parameters::get_filenames.
  */
-void make_directories();
+void make_directories(const std::string &directory);
 
 namespace grids
 {
 
     /**
-     * @brief [brief description]
-     * @details [long description]
+     * @brief The times at which the one-point observables are recorded,
+     * log-spaced up to 10^log10_timesteps.
      * 
      * @param log10_timesteps [description]
      * @param n_gridpoints [description]
      */
-    void make_energy_grid_logspace(const int log10_timesteps, const int n_gridpoints);
+    std::vector<long long> energy_grid_logspace(const int log10_timesteps, const int n_gridpoints);
 
     /**
-     * @brief [brief description]
-     * @details [long description]
+     * @brief The waiting times tw (v1) and tw (1 + dw) (v2) of the
+     * two-point observables.
      * 
      * @param log10_timesteps [description]
      * @param dw [description]
      * @param n_gridpoints [description]
+     * @param v1 Filled with the first grid
+     * @param v2 Filled with the second grid
+     */
+    void pi_grids(const int log10_timesteps, const double dw, const int n_gridpoints,
+        std::vector<long long> &v1, std::vector<long long> &v2);
+
+    // All grids of a run. They depend on the parameters alone, so every
+    // process computes them rather than reading them back from the files
+    // rank 0 writes, and all observables share one read-only copy
+    struct GridSet
+    {
+        std::vector<long long> energy, pi1, pi2;
+
+        GridSet(const int log10_timesteps, const double dw, const int n_gridpoints);
+    };
+
+    /**
+     * @brief The grids for the given parameters, computed on first use and
+     * shared by all callers in the process. Thread safe.
+     */
+    std::shared_ptr<const GridSet> shared_grid_set(const int log10_timesteps,
+        const double dw, const int n_gridpoints);
+
+    /**
+     * @brief Writes grids/energy.txt, pi1.txt and pi2.txt under directory,
+     * see parameters::get_filenames. These are for postprocessing only.
      */
-    void make_pi_grids(const int log10_timesteps, const double dw, const int n_gridpoints);
+    void write_grid_set(const GridSet &grid_set, const std::string &directory);
 
     /**
      * @brief [brief description]
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+
+namespace checkpoint
+{
+
+    bool read_file(const std::string &path, std::vector<char> &buffer)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr){return false;}
+        fseek(file, 0, SEEK_END);
+        const long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        buffer.resize(size > 0 ? size : 0);
+        const size_t n_read = fread(buffer.data(), 1, buffer.size(), file);
+        fclose(file);
+        if (n_read != buffer.size()){throw std::runtime_error("Could not read " + path);}
+        return true;
+    }
+
+    void write_file_atomic(const std::string &path, const std::vector<char> &buffer)
+    {
+        const std::string tmp_path = path + ".tmp";
+        FILE *file = fopen(tmp_path.c_str(), "wb");
+        if (file == nullptr){throw std::runtime_error("Could not open " + tmp_path);}
+        const size_t n_written = fwrite(buffer.data(), 1, buffer.size(), file);
+        const bool ok = n_written == buffer.size() && fflush(file) == 0
+            && fsync(fileno(file)) == 0;
+        fclose(file);
+        if (!ok){throw std::runtime_error("Could not write " + tmp_path);}
+        if (rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            throw std::runtime_error("Could not rename " + tmp_path);
+        }
+    }
+
+    std::vector<char> Writer::release()
+    {
+        if (_deferred.empty()){return std::move(_buffer);}
+
+        std::vector<char> bytes;
+        size_t pos = 0;
+        for (auto &deferred : _deferred)
+        {
+            bytes.insert(bytes.end(), _buffer.begin() + pos, _buffer.begin() + deferred.first);
+            pos = deferred.first;
+            Writer part;
+            deferred.second(part);
+            const std::vector<char> part_bytes = part.release();
+            bytes.insert(bytes.end(), part_bytes.begin(), part_bytes.end());
+        }
+        bytes.insert(bytes.end(), _buffer.begin() + pos, _buffer.end());
+        _buffer.clear();
+        _deferred.clear();
+        return bytes;
+    }
+
+    void AsyncWriter::submit(const std::string &path, Writer &&writer)
+    {
+        wait();
+        _in_flight = true;
+        _thread = std::thread([this, path](Writer snapshot)
+        {
+            try{write_file_atomic(path, snapshot.release());}
+            catch (...){_error = std::current_exception();}
+            _in_flight = false;
+        }, std::move(writer));
+    }
+
+    bool AsyncWriter::idle()
+    {
+        if (_in_flight){return false;}
+        wait();
+        return true;
+    }
+
+    void AsyncWriter::wait()
+    {
+        if (_thread.joinable()){_thread.join();}
+        if (_error)
+        {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    AsyncWriter::~AsyncWriter()
+    {
+        // Errors cannot be thrown from here; the next resume starts from
+        // the last checkpoint written in full
+        if (_thread.joinable()){_thread.join();}
+    }
+
+}
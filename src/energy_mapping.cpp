@@ -1,105 +1,135 @@
+#include <algorithm>
 #include <cstring>
 #include <random>
 
 #include "energy_mapping.h"
 #include "utils.h"
 #include "lru.h"
-#include "utils.h"
-#include "ArbitraryPrecision/ap/ap.hpp"
 
 
-double EnergyMapping::sample_energy() const
+template<unsigned int Words>
+double EnergyMapping<Words>::sample_energy() const
+{
+    if (_landscape_is_erem){return sample_energy<landscape::EREM>();}
+    return sample_energy<landscape::GREM>();
+}
+
+template<unsigned int Words>
+double EnergyMapping<Words>::hashed_energy(const state_t &state) const
+{
+    if (_landscape_is_erem){return hashed_energy<landscape::EREM>(state);}
+    return hashed_energy<landscape::GREM>(state);
+}
+
+template<unsigned int Words>
+double EnergyMapping<Words>::get_config_energy(const state_t &state) const
+{
+    if (_landscape_is_erem){return get_config_energy<landscape::EREM>(state);}
+    return get_config_energy<landscape::GREM>(state);
+}
+
+template<unsigned int Words>
+void EnergyMapping<Words>::get_config_energies_array_(const state_t *neighbors, double *neighboring_energies, const unsigned int bitLength) const
 {
-    if (params.landscape == "EREM")
+    if (_landscape_is_erem)
     {
-        return -exponential_distribution(generator);
+        get_config_energies_array_<landscape::EREM>(neighbors, neighboring_energies, bitLength);
     }
     else
     {
-        return normal_distribution(generator);
+        get_config_energies_array_<landscape::GREM>(neighbors, neighboring_energies, bitLength);
     }
 }
 
-
-
-double EnergyMapping::get_config_energy(const ap_uint<PRECISON> state) const
+template<unsigned int Words>
+void EnergyMapping<Words>::_initialize_distributions()
 {
+    const uint64_t seed = params.use_manual_seed ? params.seed : rng::random_seed();
+    generator.seed(rng::kind_from_string(params.rng), seed,
+        rng::stream_id(params.tracer_index, rng::LANDSCAPE_STREAM));
+    _landscape_key = seed;
 
-    const std::string state_string = std::string(state);
-
-    // If our key exists in the LRU cache, simply return the value
-    if (energy_map.key_exists(state_string))
+    // The buffer starts out empty, so the first miss fills it
+    if (params.energy_buffer_size == 0)
     {
-        return energy_map.get(state_string);
+        throw std::runtime_error("energy_buffer_size must be positive");
     }
+    _energy_buffer_size = params.energy_buffer_size;
+    _energy_buffer.reset(new double[_energy_buffer_size]);
+    _energy_buffer_bits.reset(new uint64_t[_energy_buffer_size]);
+    _energy_buffer_pos = _energy_buffer_size;
 
-    // Otherwise, we sample a new value
+    // Resolve the landscape once
+    // If the distribution type is not found throws a runtime_error
+    _grem_sigma = sqrt(params.N_spins);
+    if (params.landscape == "EREM"){_landscape_is_erem = true;}
+    else if (params.landscape == "GREM"){_landscape_is_erem = false;}
     else
     {
-        const double sampled = sample_energy();
-        energy_map.put(state_string, sampled);
-        return sampled;
+        const std::string err = "Invalid landscape " + params.landscape;
+        throw std::runtime_error(err);
     }
 }
 
-void EnergyMapping::get_config_energies_array_(const ap_uint<PRECISON> *neighbors, double *neighboring_energies, const unsigned int bitLength) const
-{
-    for (int ii=0; ii<bitLength; ii++)
-    {
-        neighboring_energies[ii] = get_config_energy(neighbors[ii]);
-    }
-}
 
-void EnergyMapping::_initialize_distributions()
+template<unsigned int Words>
+EnergyMapping<Words>::EnergyMapping(const parameters::SimulationParameters params) : params(params)
 {
-    if (params.use_manual_seed == true)
+    _initialize_distributions();
+
+    if (params.landscape_mode == "hashed")
     {
-        generator.seed(params.seed);
+        // Nothing to allocate, the energies are recomputed on every lookup
+        _use_hashed_landscape = true;
+        _use_dense_table = false;
+        _use_clock_cache = false;
+        return;
     }
+    else if (params.landscape_mode == "cached"){_use_hashed_landscape = false;}
     else
     {
-        const unsigned int seed = std::random_device{}();  
-        generator.seed(seed);
+        const std::string err = "Invalid landscape mode " + params.landscape_mode;
+        throw std::runtime_error(err);
     }
-    
-    // Initialize the distributions themselves
-    // If the distribution type is not found throws a runtime_error
-    if (params.landscape == "EREM")
+
+    if (params.cache_engine == "clock"){_use_clock_cache = true;}
+    else if (params.cache_engine == "lru"){_use_clock_cache = false;}
+    else
     {
-        const double p = params.beta_critical;
-        exponential_distribution.param(
-            std::exponential_distribution<double>::param_type(p)
-        );
+        const std::string err = "Invalid cache engine " + params.cache_engine;
+        throw std::runtime_error(err);
     }
-    else if (params.landscape == "GREM")
+
+    // Allocate the energy storage mediums
+    long long capacity;
+    if (params.memory == -1){capacity = pow(2, params.N_spins);}
+    else if (params.memory > 0){capacity = params.memory;}
+    else
     {
-        const double p = sqrt(params.N_spins);
-        normal_distribution.param(
-            std::normal_distribution<double>::param_type(0.0, p)
-        );
+        throw std::runtime_error("Invalid choice for memory; must be either -1 or >0");
     }
+
+    // If every configuration fits in the budget anyway, nothing is ever
+    // evicted and a directly indexed table replaces the cache entirely
+    if (params.memory == -1){_use_dense_table = params.N_spins <= DENSE_UNLIMITED_MAX_N_SPINS;}
     else
     {
-        const std::string err = "Invalid landscape " + params.landscape;
-        throw std::runtime_error(err);
+        _use_dense_table = (params.N_spins <= DENSE_MAX_N_SPINS)
+            && capacity >= (1LL << params.N_spins);
     }
-}
 
-
-EnergyMapping::EnergyMapping(const parameters::SimulationParameters params) : params(params)
-{
-    _initialize_distributions();
-
-    // Allocate the energy storage mediums
-    if (params.memory == -1){
-        const long long n_configs = pow(2, params.N_spins);
-        energy_map.set_capacity(n_configs);
+    if (_use_dense_table)
+    {
+        _dense_n_configs = 1LL << params.N_spins;
+        _dense_energies.reset(new double[_dense_n_configs]);
+        _dense_present.assign((_dense_n_configs + 63) / 64, 0);
     }
-    else if (params.memory > 0){energy_map.set_capacity(params.memory);}
-    else
+    else if (_use_clock_cache)
     {
-        throw std::runtime_error("Invalid choice for memory; must be either -1 or >0");
+        clock_energy_map.set_capacity(capacity);
+        _batch_hashes.resize(params.N_spins);
     }
+    else{energy_map.set_capacity(capacity);}
 };
 
 
@@ -113,14 +143,15 @@ unsigned int _min_element(const double *arr, const unsigned int N)
     return min_el;
 }
 
-ap_uint<PRECISON> EnergyMapping::get_inherent_structure(const ap_uint<PRECISON> state) const
+template<unsigned int Words>
+typename EnergyMapping<Words>::state_t EnergyMapping<Words>::get_inherent_structure(const state_t &state) const
 {
     unsigned int min_el;
     double tmp_energy;
-    ap_uint<PRECISON> tmp_state = state;
+    state_t tmp_state = state;
 
-    ap_uint<PRECISON>* tmp_neighbors = 0;
-    tmp_neighbors = new ap_uint<PRECISON> [params.N_spins];
+    state_t* tmp_neighbors = 0;
+    tmp_neighbors = new state_t [params.N_spins];
 
     double* tmp_neighbor_energies = 0;
     tmp_neighbor_energies = new double [params.N_spins];
@@ -145,3 +176,94 @@ ap_uint<PRECISON> EnergyMapping::get_inherent_structure(const ap_uint<PRECISON>
 
     return tmp_state;
 }
+
+template<unsigned int Words>
+void EnergyMapping<Words>::save(checkpoint::Writer &writer) const
+{
+    writer.write(_use_hashed_landscape);
+    writer.write(_use_dense_table);
+    writer.write(_use_clock_cache);
+    writer.write(_landscape_key);
+    generator.save(writer);
+
+    writer.write(_energy_buffer_size);
+    writer.write(_energy_buffer_pos);
+    writer.write_bytes(_energy_buffer.get(), _energy_buffer_size * sizeof(double));
+
+    if (_use_hashed_landscape){return;}
+
+    if (_use_dense_table)
+    {
+        // Only the sampled entries, in order of their configuration. The
+        // blocks of 64 entries with any sampled are copied as they are, and
+        // picked apart when the checkpoint is serialized
+        writer.write(_dense_size);
+        writer.write_vector(_dense_present);
+        std::vector<uint64_t> present;
+        std::vector<double> blocks;
+        for (size_t ww=0; ww<_dense_present.size(); ww++)
+        {
+            if (_dense_present[ww] == 0){continue;}
+            const long long first = (long long) ww * 64;
+            const long long n = std::min<long long>(64, _dense_n_configs - first);
+            present.push_back(_dense_present[ww]);
+            blocks.insert(blocks.end(), &_dense_energies[first], &_dense_energies[first] + n);
+        }
+        writer.defer([present, blocks](checkpoint::Writer &deferred)
+        {
+            size_t pos = 0;
+            for (const uint64_t word : present)
+            {
+                for (unsigned int bb=0; bb<64; bb++)
+                {
+                    if (word & (uint64_t(1) << bb)){deferred.write(blocks[pos + bb]);}
+                }
+                pos += 64;
+            }
+        });
+    }
+    else if (_use_clock_cache)
+    {
+        // The slots are copied as they are
+        writer.defer([cache = clock_energy_map](checkpoint::Writer &deferred){cache.save(deferred);});
+    }
+    else{energy_map.save(writer);}
+}
+
+template<unsigned int Words>
+void EnergyMapping<Words>::load(checkpoint::Reader &reader)
+{
+    reader.expect(_use_hashed_landscape, "landscape_mode");
+    reader.expect(_use_dense_table, "memory");
+    reader.expect(_use_clock_cache, "cache_engine");
+    reader.read(_landscape_key);
+    generator.load(reader);
+
+    reader.expect(_energy_buffer_size, "energy_buffer_size");
+    reader.read(_energy_buffer_pos);
+    reader.read_bytes(_energy_buffer.get(), _energy_buffer_size * sizeof(double));
+
+    if (_use_hashed_landscape){return;}
+
+    if (_use_dense_table)
+    {
+        reader.read(_dense_size);
+        reader.read_vector(_dense_present);
+        if ((long long) _dense_present.size() != (_dense_n_configs + 63) / 64)
+        {
+            throw std::runtime_error("Checkpoint does not match this run: N_spins");
+        }
+        for (long long ii=0; ii<_dense_n_configs; ii++)
+        {
+            if (_dense_present[ii >> 6] & (uint64_t(1) << (ii & 63)))
+            {
+                reader.read(_dense_energies[ii]);
+            }
+        }
+    }
+    else if (_use_clock_cache){clock_energy_map.load(reader);}
+    else{energy_map.load(reader);}
+}
+
+
+HDSPIN_INSTANTIATE_STATE_WIDTHS(EnergyMapping)
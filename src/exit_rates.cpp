@@ -0,0 +1,185 @@
+#include "exit_rates.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EXIT_RATES_X86 1
+#include <immintrin.h>
+#else
+#define EXIT_RATES_X86 0
+#endif
+
+
+// This file must be compiled without floating point contraction (see
+// CMakeLists.txt), otherwise the compiler may fuse the multiplies and adds
+// of one path but not another and the paths would no longer agree.
+namespace exit_rates
+{
+
+    static inline double _scalar_rate(const double energy,
+        const double current_energy, const double beta, const double n)
+    {
+        double x = -beta * (energy - current_energy);
+        if (x > 0.0){x = 0.0;}
+        double rate = exp_nonpositive(x);
+        if (rate > 1.0){rate = 1.0;}
+        return rate / n;
+    }
+
+    void metropolis_rates_scalar(const double* neighboring_energies,
+        const double current_energy, const double beta, const unsigned int n,
+        double* rates)
+    {
+        const double nd = (double) n;
+        for (unsigned int ii=0; ii<n; ii++)
+        {
+            rates[ii] = _scalar_rate(neighboring_energies[ii], current_energy, beta, nd);
+        }
+    }
+
+#if EXIT_RATES_X86
+
+    __attribute__((target("avx2")))
+    static void _metropolis_rates_avx2(const double* neighboring_energies,
+        const double current_energy, const double beta, const unsigned int n,
+        double* rates)
+    {
+        using namespace _constants;
+        const __m256d e0 = _mm256_set1_pd(current_energy);
+        const __m256d minus_beta = _mm256_set1_pd(-beta);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d underflow = _mm256_set1_pd(EXP_UNDERFLOW);
+        const __m256d log2e = _mm256_set1_pd(LOG2E);
+        const __m256d magic = _mm256_set1_pd(ROUND_MAGIC);
+        const __m256d ln2_hi = _mm256_set1_pd(LN2_HI);
+        const __m256d ln2_lo = _mm256_set1_pd(LN2_LO);
+        const __m256d nd = _mm256_set1_pd((double) n);
+        const __m256i magic_bits = _mm256_set1_epi64x(ROUND_MAGIC_BITS - 1023);
+
+        unsigned int ii = 0;
+        for (; ii + 4 <= n; ii += 4)
+        {
+            const __m256d dE = _mm256_sub_pd(_mm256_loadu_pd(neighboring_energies + ii), e0);
+            const __m256d x = _mm256_min_pd(_mm256_mul_pd(minus_beta, dE), zero);
+            const __m256d flushed = _mm256_cmp_pd(x, underflow, _CMP_LT_OQ);
+
+            const __m256d t = _mm256_add_pd(_mm256_mul_pd(x, log2e), magic);
+            const __m256d nn = _mm256_sub_pd(t, magic);
+            __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(nn, ln2_hi));
+            r = _mm256_sub_pd(r, _mm256_mul_pd(nn, ln2_lo));
+
+            __m256d p = _mm256_set1_pd(POLY[0]);
+            for (unsigned int kk=1; kk<14; kk++)
+            {
+                p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(POLY[kk]));
+            }
+
+            const __m256i scale = _mm256_slli_epi64(
+                _mm256_sub_epi64(_mm256_castpd_si256(t), magic_bits), 52);
+            __m256d rate = _mm256_min_pd(_mm256_mul_pd(p, _mm256_castsi256_pd(scale)), one);
+            rate = _mm256_andnot_pd(flushed, rate);
+            _mm256_storeu_pd(rates + ii, _mm256_div_pd(rate, nd));
+        }
+
+        const double ndd = (double) n;
+        for (; ii<n; ii++)
+        {
+            rates[ii] = _scalar_rate(neighboring_energies[ii], current_energy, beta, ndd);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    static void _metropolis_rates_avx512(const double* neighboring_energies,
+        const double current_energy, const double beta, const unsigned int n,
+        double* rates)
+    {
+        using namespace _constants;
+        const __m512d e0 = _mm512_set1_pd(current_energy);
+        const __m512d minus_beta = _mm512_set1_pd(-beta);
+        const __m512d zero = _mm512_setzero_pd();
+        const __m512d one = _mm512_set1_pd(1.0);
+        const __m512d underflow = _mm512_set1_pd(EXP_UNDERFLOW);
+        const __m512d log2e = _mm512_set1_pd(LOG2E);
+        const __m512d magic = _mm512_set1_pd(ROUND_MAGIC);
+        const __m512d ln2_hi = _mm512_set1_pd(LN2_HI);
+        const __m512d ln2_lo = _mm512_set1_pd(LN2_LO);
+        const __m512d nd = _mm512_set1_pd((double) n);
+        const __m512i magic_bits = _mm512_set1_epi64(ROUND_MAGIC_BITS - 1023);
+
+        unsigned int ii = 0;
+        for (; ii + 8 <= n; ii += 8)
+        {
+            const __m512d dE = _mm512_sub_pd(_mm512_loadu_pd(neighboring_energies + ii), e0);
+            const __m512d x = _mm512_min_pd(_mm512_mul_pd(minus_beta, dE), zero);
+            const __mmask8 kept = _mm512_cmp_pd_mask(x, underflow, _CMP_GE_OQ);
+
+            const __m512d t = _mm512_add_pd(_mm512_mul_pd(x, log2e), magic);
+            const __m512d nn = _mm512_sub_pd(t, magic);
+            __m512d r = _mm512_sub_pd(x, _mm512_mul_pd(nn, ln2_hi));
+            r = _mm512_sub_pd(r, _mm512_mul_pd(nn, ln2_lo));
+
+            __m512d p = _mm512_set1_pd(POLY[0]);
+            for (unsigned int kk=1; kk<14; kk++)
+            {
+                p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(POLY[kk]));
+            }
+
+            const __m512i scale = _mm512_slli_epi64(
+                _mm512_sub_epi64(_mm512_castpd_si512(t), magic_bits), 52);
+            __m512d rate = _mm512_min_pd(_mm512_mul_pd(p, _mm512_castsi512_pd(scale)), one);
+            rate = _mm512_maskz_mov_pd(kept, rate);
+            _mm512_storeu_pd(rates + ii, _mm512_div_pd(rate, nd));
+        }
+
+        const double ndd = (double) n;
+        for (; ii<n; ii++)
+        {
+            rates[ii] = _scalar_rate(neighboring_energies[ii], current_energy, beta, ndd);
+        }
+    }
+
+#endif
+
+    typedef void (*kernel_t)(const double*, const double, const double,
+        const unsigned int, double*);
+
+    struct _dispatch_t
+    {
+        kernel_t kernel;
+        const char* isa;
+    };
+
+    static _dispatch_t _select_kernel()
+    {
+#if EXIT_RATES_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return {_metropolis_rates_avx512, "avx512"};
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return {_metropolis_rates_avx2, "avx2"};
+        }
+#endif
+        return {metropolis_rates_scalar, "scalar"};
+    }
+
+    static const _dispatch_t& _dispatch()
+    {
+        static const _dispatch_t dispatch = _select_kernel();
+        return dispatch;
+    }
+
+    void metropolis_rates(const double* neighboring_energies,
+        const double current_energy, const double beta, const unsigned int n,
+        double* rates)
+    {
+        _dispatch().kernel(neighboring_energies, current_energy, beta, n, rates);
+    }
+
+    const char* selected_isa()
+    {
+        return _dispatch().isa;
+    }
+
+}
@@ -0,0 +1,35 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "output.h"
+#include "CLI11/CLI11.hpp"
+
+
+// Converts the containers written with --output_format=binary back to the
+// text files of --output_format=text, e.g. for postprocess.py
+int main(int argc, char *argv[])
+{
+    CLI::App app{
+        "hdspin_export writes the text files of the binary output of hdspin"
+    };
+
+    std::vector<std::string> directories;
+    app.add_option(
+        "directories", directories,
+        "The run directories to convert, i.e. those holding data/rank_*.idx, "
+        "such as the point directories of a sweep. Defaults to the working "
+        "directory."
+    );
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (directories.empty()){directories.push_back("");}
+    for (std::string directory : directories)
+    {
+        if (!directory.empty() && directory.back() != '/'){directory += "/";}
+        const unsigned int n_tracers = output::export_text(directory);
+        printf("%s: wrote the text files of %u tracers\n",
+            directory.empty() ? "." : directory.c_str(), n_tracers);
+    }
+}
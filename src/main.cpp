@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>      // std::ofstream
 #include <chrono>
 #include <unistd.h>
@@ -6,28 +7,129 @@
 #include <cstring>
 #include <sstream>
 #include <assert.h>
+#include <memory>
 #include <vector>
 #include <set>
-#include <mpi.h>
+#include <mutex>
+#include "mpi_compat.h"
 
 #include "utils.h"
 #include "spin.h"
+#include "spin_batch.h"
 #include "obs1.h"
+#include "thread_pool.h"
+#include "scheduler.h"
+#include "checkpoint.h"
+#include "sweep.h"
+#include "output.h"
+#include "reduction.h"
 #include "CLI11/CLI11.hpp"
 
 
-void step_all_observables_(const double waiting_time, const double simulation_clock, OnePointObservables& obs1, RidgeE& ridgeE, RidgeS& ridgeS)
+template<unsigned int Words>
+void step_all_observables_(const double waiting_time, const double simulation_clock, OnePointObservables<Words>& obs1, RidgeE<Words>& ridgeE, RidgeS<Words>& ridgeS)
 {
     obs1.step(waiting_time, simulation_clock);
     ridgeE.step(waiting_time, simulation_clock);
     ridgeS.step(waiting_time, simulation_clock);
 }
 
+/**
+ * @brief Takes a checkpoint of a tracer between two steps, see checkpoint.h.
+ * The header identifies the run, so that a checkpoint is never resumed
+ * with other parameters. Its deferred parts are left to the AsyncWriter.
+ */
+template<unsigned int Words>
+checkpoint::Writer save_tracer_(const parameters::SimulationParameters &params,
+    const double simulation_clock, const EnergyMapping<Words>& emap,
+    const SpinSystem<Words>& sys, const OnePointObservables<Words>& obs1,
+    const RidgeE<Words>& ridgeE, const RidgeS<Words>& ridgeS)
+{
+    checkpoint::Writer writer;
+    writer.write(checkpoint::MAGIC);
+    writer.write(checkpoint::VERSION);
+    writer.write(Words);
+    writer.write(params.tracer_index);
+    writer.write(params.seed);
+    writer.write(params.N_timesteps);
+    writer.write(params.beta);
+    writer.write_string(params.landscape);
+    writer.write_string(params.rng);
+    writer.write_string(params.output_format);
+
+    writer.write(simulation_clock);
+    emap.save(writer);
+    sys.save(writer);
+    obs1.save(writer);
+    ridgeE.save(writer);
+    ridgeS.save(writer);
+    return writer;
+}
+
+/**
+ * @brief Restores a tracer from the checkpoint saved by save_tracer_.
+ */
+template<unsigned int Words>
+void load_tracer_(const std::vector<char> &buffer,
+    const parameters::SimulationParameters &params, double &simulation_clock,
+    EnergyMapping<Words>& emap, SpinSystem<Words>& sys,
+    OnePointObservables<Words>& obs1, RidgeE<Words>& ridgeE,
+    RidgeS<Words>& ridgeS)
+{
+    checkpoint::Reader reader(buffer);
+    reader.expect(checkpoint::MAGIC, "not a checkpoint");
+    reader.expect(checkpoint::VERSION, "version");
+    reader.expect(Words, "N_spins");
+    reader.expect(params.tracer_index, "tracer index");
+    reader.expect(params.seed, "seed");
+    reader.expect(params.N_timesteps, "log10_N_timesteps");
+    reader.expect(params.beta, "beta");
+    if (reader.read_string() != params.landscape)
+    {
+        throw std::runtime_error("Checkpoint does not match this run: landscape");
+    }
+    if (reader.read_string() != params.rng)
+    {
+        throw std::runtime_error("Checkpoint does not match this run: rng");
+    }
+    if (reader.read_string() != params.output_format)
+    {
+        throw std::runtime_error("Checkpoint does not match this run: output_format");
+    }
+
+    reader.read(simulation_clock);
+    emap.load(reader);
+    sys.load(reader);
+    obs1.load(reader);
+    ridgeE.load(reader);
+    ridgeS.load(reader);
+    if (!reader.at_end()){throw std::runtime_error("Checkpoint has trailing data");}
+}
+
+/**
+ * @brief Hands the output of a finished tracer to the container or the
+ * running sums of its rank, with --output_format=binary or reduced.
+ */
+template<unsigned int Words>
+void append_tracer_(output::Sink& sink,
+    const parameters::SimulationParameters &params,
+    const OnePointObservables<Words>& obs1, const RidgeE<Words>& ridgeE,
+    const RidgeS<Words>& ridgeS)
+{
+    std::vector<const output::Stream*> streams;
+    obs1.collect_streams(streams);
+    ridgeE.collect_streams(streams);
+    ridgeS.collect_streams(streams);
+    sink.append(params.tracer_index, streams);
+}
+
+template<unsigned int Words, typename Dynamics, typename Landscape>
 void execute(const parameters::FileNames fnames,
-    const parameters::SimulationParameters params)
+    const parameters::SimulationParameters params,
+    output::Sink* sink)
 {
-    EnergyMapping emap(params);
-    SpinSystem sys(params, emap);
+    EnergyMapping<Words> emap(params);
+    SpinSystem<Words> sys(params, emap);
 
     // Special case of the standard spin dynamics: if rtp.loop_dynamics == 2,
     // then the timestep is divided by rtp.N_spins.
@@ -36,9 +138,36 @@ void execute(const parameters::FileNames fnames,
     // Simulation parameters
     double simulation_clock = 0.0;
 
-    RidgeE ridgeE(fnames, params, sys);
-    RidgeS ridgeS(fnames, params, sys);
-    OnePointObservables obs1(fnames, params, sys);
+    // Text output is queued for the writer thread of the process, see
+    // output::TextWriterThread, by a queue which outlives the observables
+    std::unique_ptr<output::TextWriter> text_writer;
+    if (output::from_string(params.output_format) == output::TEXT)
+    {
+        text_writer.reset(new output::TextWriter());
+    }
+
+    RidgeE<Words> ridgeE(fnames, params, sys, text_writer.get());
+    RidgeS<Words> ridgeS(fnames, params, sys, text_writer.get());
+    OnePointObservables<Words> obs1(fnames, params, sys, text_writer.get());
+
+    // Set only for tracers which have a checkpoint to continue from
+    if (params.resume)
+    {
+        std::vector<char> buffer;
+        if (!checkpoint::read_file(fnames.checkpoint, buffer))
+        {
+            throw std::runtime_error("Could not read " + fnames.checkpoint);
+        }
+        load_tracer_(buffer, params, simulation_clock, emap, sys, obs1, ridgeE, ridgeS);
+    }
+
+    // Checkpoints are taken here, between two steps, and serialized and
+    // written out on another thread while the tracer carries on. One due
+    // while the previous one is still being written is put off to the next
+    // look at the clock, rather than holding the tracer back
+    checkpoint::AsyncWriter checkpoint_writer;
+    auto last_checkpoint = std::chrono::high_resolution_clock::now();
+    unsigned int checkpoint_countdown = CHECKPOINT_CLOCK_STRIDE;
 
     // Simulation clock is 0 before entering the while loop
     while (true)
@@ -46,7 +175,7 @@ void execute(const parameters::FileNames fnames,
         
         // Standard step returns a boolean flag which is true if the new
         // proposed configuration was accepted or not.
-        waiting_time = sys.step();
+        waiting_time = sys.template step_with<Dynamics, Landscape>();
 
         // The waiting time is always 1.0 for a standard simulation. We take
         // the convention that the "prev" structure indexes the state of the
@@ -65,15 +194,167 @@ void execute(const parameters::FileNames fnames,
         );
 
         if (simulation_clock > params.N_timesteps){break;}
+
+        if (params.checkpoint_interval > 0.0 && --checkpoint_countdown == 0)
+        {
+            checkpoint_countdown = CHECKPOINT_CLOCK_STRIDE;
+            if (time_utils::get_time_delta(last_checkpoint) >= params.checkpoint_interval
+                && checkpoint_writer.idle())
+            {
+                checkpoint_writer.submit(fnames.checkpoint, save_tracer_(
+                    params, simulation_clock, emap, sys, obs1, ridgeE, ridgeS));
+                last_checkpoint = std::chrono::high_resolution_clock::now();
+            }
+        }
     }
+    checkpoint_writer.wait();
+    if (sink != nullptr){append_tracer_(*sink, params, obs1, ridgeE, ridgeS);}
 }
 
+/**
+ * @brief Runs the tracers of the given file names and parameters together,
+ * as the lanes of a SpinSystemBatch, which requires standard dynamics and
+ * at most 64 spins. Every lane keeps its own landscape and observables.
+ */
+template<typename Landscape>
+void execute_batch(const std::vector<parameters::FileNames> &fnames,
+    const std::vector<parameters::SimulationParameters> &params,
+    output::Sink* sink)
+{
+    const unsigned int n_lanes = params.size();
+    std::vector<std::unique_ptr<EnergyMapping<1>>> emaps;
+    std::vector<std::unique_ptr<SpinSystem<1>>> systems;
+    std::vector<SpinSystem<1>*> system_ptrs;
+    for (unsigned int ll=0; ll<n_lanes; ll++)
+    {
+        emaps.emplace_back(new EnergyMapping<1>(params[ll]));
+        systems.emplace_back(new SpinSystem<1>(params[ll], *emaps[ll]));
+        system_ptrs.push_back(systems[ll].get());
+    }
+
+    // One queue to the writer thread for the text output of all lanes
+    std::unique_ptr<output::TextWriter> text_writer;
+    if (output::from_string(params[0].output_format) == output::TEXT)
+    {
+        text_writer.reset(new output::TextWriter());
+    }
+
+    std::vector<std::unique_ptr<RidgeE<1>>> ridgeE;
+    std::vector<std::unique_ptr<RidgeS<1>>> ridgeS;
+    std::vector<std::unique_ptr<OnePointObservables<1>>> obs1;
+    for (unsigned int ll=0; ll<n_lanes; ll++)
+    {
+        ridgeE.emplace_back(new RidgeE<1>(fnames[ll], params[ll], *systems[ll], text_writer.get()));
+        ridgeS.emplace_back(new RidgeS<1>(fnames[ll], params[ll], *systems[ll], text_writer.get()));
+        obs1.emplace_back(new OnePointObservables<1>(fnames[ll], params[ll], *systems[ll], text_writer.get()));
+    }
+
+    SpinSystemBatch batch(params, system_ptrs);
+
+    // Every lane takes standard steps of waiting time 1, so all of them
+    // share the simulation clock
+    double simulation_clock = 0.0;
+    while (true)
+    {
+        batch.template step_with<Landscape>();
+        simulation_clock += 1.0;
+        for (unsigned int ll=0; ll<n_lanes; ll++)
+        {
+            step_all_observables_(1.0, simulation_clock, *obs1[ll], *ridgeE[ll], *ridgeS[ll]);
+        }
+        if (simulation_clock > params[0].N_timesteps){break;}
+    }
+
+    if (sink == nullptr){return;}
+    for (unsigned int ll=0; ll<n_lanes; ll++)
+    {
+        append_tracer_(*sink, params[ll], *obs1[ll], *ridgeE[ll], *ridgeS[ll]);
+    }
+}
+
+void execute_batch_dispatch(const std::vector<parameters::FileNames> &fnames,
+    const std::vector<parameters::SimulationParameters> &params,
+    output::Sink* sink)
+{
+    if (params[0].landscape == "EREM")
+    {
+        execute_batch<landscape::EREM>(fnames, params, sink);
+    }
+    else if (params[0].landscape == "GREM")
+    {
+        execute_batch<landscape::GREM>(fnames, params, sink);
+    }
+    else
+    {
+        throw std::runtime_error("Invalid landscape " + params[0].landscape);
+    }
+}
+
+template<unsigned int Words, typename Dynamics>
+void execute_landscape_dispatch(const parameters::FileNames fnames,
+    const parameters::SimulationParameters params,
+    output::Sink* sink)
+{
+    if (params.landscape == "EREM")
+    {
+        execute<Words, Dynamics, landscape::EREM>(fnames, params, sink);
+    }
+    else if (params.landscape == "GREM")
+    {
+        execute<Words, Dynamics, landscape::GREM>(fnames, params, sink);
+    }
+    else
+    {
+        throw std::runtime_error("Invalid landscape " + params.landscape);
+    }
+}
+
+template<unsigned int Words>
+void execute_dynamics_dispatch(const parameters::FileNames fnames,
+    const parameters::SimulationParameters params,
+    output::Sink* sink)
+{
+    switch (dynamics::from_string(params.dynamics))
+    {
+        case dynamics::STANDARD:
+            execute_landscape_dispatch<Words, dynamics::Standard>(fnames, params, sink); break;
+        case dynamics::GILLESPIE:
+            execute_landscape_dispatch<Words, dynamics::Gillespie>(fnames, params, sink); break;
+        case dynamics::STANDARD_ACCELERATED:
+            execute_landscape_dispatch<Words, dynamics::StandardAccelerated>(fnames, params, sink); break;
+        case dynamics::STANDARD_ADAPTIVE:
+            execute_landscape_dispatch<Words, dynamics::StandardAdaptive>(fnames, params, sink); break;
+    }
+}
+
+/**
+ * @brief Runs a single tracer using the narrowest compiled state width which
+ * holds params.N_spins, and the dynamics and landscape policies matching
+ * params, all resolved once here rather than on every step. Unless the
+ * output is text, the tracer is appended to sink once it has finished, and
+ * sink is null otherwise.
+ */
+void execute_dispatch(const parameters::FileNames fnames,
+    const parameters::SimulationParameters params,
+    output::Sink* sink)
+{
+    switch (state_words_for_n_spins(params.N_spins))
+    {
+        case 1: execute_dynamics_dispatch<1>(fnames, params, sink); break;
+        case 2: execute_dynamics_dispatch<2>(fnames, params, sink); break;
+        case 4: execute_dynamics_dispatch<4>(fnames, params, sink); break;
+        case HDSPIN_MAX_STATE_WORDS: execute_dynamics_dispatch<HDSPIN_MAX_STATE_WORDS>(fnames, params, sink); break;
+        default: throw std::runtime_error("N_spins exceeds the maximum compiled state width");
+    }
+}
+
+template<unsigned int Words>
 double get_sim_time(parameters::SimulationParameters p, const std::string dynamics)
 {
     double simulation_clock = 0.0;
     p.dynamics = dynamics;
-    EnergyMapping emap(p);
-    SpinSystem sys(p, emap);
+    EnergyMapping<Words> emap(p);
+    SpinSystem<Words> sys(p, emap);
     auto t_start = std::chrono::high_resolution_clock::now();
     for (unsigned int step=0; step<int(1e7); step++)
     {
@@ -83,6 +364,18 @@ double get_sim_time(parameters::SimulationParameters p, const std::string dynami
     return time_utils::get_time_delta(t_start) / simulation_clock;
 }
 
+double get_sim_time_dispatch(const parameters::SimulationParameters p, const std::string dynamics)
+{
+    switch (state_words_for_n_spins(p.N_spins))
+    {
+        case 1: return get_sim_time<1>(p, dynamics);
+        case 2: return get_sim_time<2>(p, dynamics);
+        case 4: return get_sim_time<4>(p, dynamics);
+        case HDSPIN_MAX_STATE_WORDS: return get_sim_time<HDSPIN_MAX_STATE_WORDS>(p, dynamics);
+        default: throw std::runtime_error("N_spins exceeds the maximum compiled state width");
+    }
+}
+
 std::string determine_dynamics_automatically(const parameters::SimulationParameters params, const unsigned int mpi_world_size, const unsigned int mpi_rank, MPI_Comm mpi_comm)
 {
     double standard_time = 0.0;
@@ -95,8 +388,8 @@ std::string determine_dynamics_automatically(const parameters::SimulationParamet
     // Run both on rank 1 if we only have a single process
     if (mpi_world_size == 1)
     {
-        standard_time = get_sim_time(p, "standard");
-        gillespie_time = get_sim_time(p, "gillespie");
+        standard_time = get_sim_time_dispatch(p, "standard");
+        gillespie_time = get_sim_time_dispatch(p, "gillespie");
     }
 
     // Otherwise, we actually want to divide up the work a bit
@@ -108,12 +401,12 @@ std::string determine_dynamics_automatically(const parameters::SimulationParamet
         double times[mpi_world_size];
         if (mpi_rank % 2 == 0)
         {
-            times[mpi_rank] = get_sim_time(p, "standard");
+            times[mpi_rank] = get_sim_time_dispatch(p, "standard");
             // MPI_Recv(&gillespie_time, 1, MPI_DOUBLE, 1, 0, mpi_comm, MPI_STATUS_IGNORE);
         }
         else if (mpi_rank % 2 != 0)
         {
-            times[mpi_rank] = get_sim_time(p, "gillespie");
+            times[mpi_rank] = get_sim_time_dispatch(p, "gillespie");
             // MPI_Send(&gillespie_time, 1, MPI_DOUBLE, 0, 0, mpi_comm);
         }
         MPI_Barrier(mpi_comm);
@@ -176,8 +469,11 @@ std::string determine_dynamics_automatically(const parameters::SimulationParamet
 
 int main(int argc, char *argv[])
 {
-    // Initialize the MPI environment
-    MPI_Init(NULL, NULL);
+    // Initialize the MPI environment. With --threads, the tracers run on
+    // worker threads, which make MPI calls one at a time to claim tracers
+    // from the dynamic scheduler, which rank 0 serves on a thread of its own
+    int mpi_thread_support;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_SERIALIZED, &mpi_thread_support);
 
     // Get the number of processes
     int MPI_WORLD_SIZE;
@@ -193,64 +489,251 @@ int main(int argc, char *argv[])
         "hdspin is an application for simulating binary spin systems"
     };
 
-    app.add_option(
+    CLI::Option* N_spins_option = app.add_option(
         "-N, --N_spins", p.N_spins,
         "Number of binary spins to use in the simulation. Must be bounded "
-        "between 1 and the PRECISON option set at compile time."
-    )->check(CLI::Range(1, PRECISON))->required();
+        "between 1 and PRECISON, the widest compiled state width. The "
+        "narrowest compiled width which fits N_spins is used."
+    )->check(CLI::Range(1, PRECISON));
 
-    app.add_option(
+    CLI::Option* landscape_option = app.add_option(
         "-l, --landscape", p.landscape,
         "Choice of landscape, either the exponential random energy model "
         "(EREM) or the Gaussian random energy model (GREM)."
-    )->check(CLI::IsMember({"EREM", "GREM"}))->required();
+    )->check(CLI::IsMember({"EREM", "GREM"}));
 
-    app.add_option(
+    CLI::Option* beta_option = app.add_option(
         "-b, --beta", p.beta,
         "Inverse temperature."
-    )->check(CLI::PositiveNumber)->required();
+    )->check(CLI::PositiveNumber);
 
-    app.add_option(
+    CLI::Option* log10_N_timesteps_option = app.add_option(
         "-t, --log10_N_timesteps", p.log10_N_timesteps,
         "The number of timesteps to run on a log10 scale. For example, if "
         "'t=7', then a simulation of length 10^7 will be run."
-    )->check(CLI::PositiveNumber)->required();
+    )->check(CLI::PositiveNumber);
 
     app.add_option(
         "-m, --memory", p.memory,
         "The size of the memory cache. If -1, will attempt to use a cache "
         "size equal to 2^N_spins, which might cause memory issues. The "
-        "default is 2^25."
+        "default is 2^25. If all 2^N_spins configurations fit (and "
+        "N_spins <= 30), a directly indexed table is used instead of a "
+        "cache. With -1, the table is only used for N_spins <= 24, as it "
+        "is allocated in full up front."
     )->check(CLI::PositiveNumber|CLI::IsMember({-1}));
 
+    app.add_option(
+        "--landscape_mode", p.landscape_mode,
+        "How configuration energies are stored. Defaults to 'cached', where "
+        "energies are sampled on first visit and kept in a cache of size "
+        "--memory; evicted configurations get a new energy if revisited. "
+        "'hashed' derives each energy from a counter-based generator "
+        "(Philox4x32-10) applied to the state bits and the tracer seed, so "
+        "the landscape is exactly quenched with O(1) memory per tracer. "
+        "--memory and --cache_engine are ignored in this mode."
+    )->check(CLI::IsMember({"cached", "hashed"}));
+
+    app.add_option(
+        "--cache_engine", p.cache_engine,
+        "The energy cache used once --memory configurations are stored. "
+        "Defaults to 'clock', a flat open-addressing table with CLOCK "
+        "(second chance) eviction, which stores several times more "
+        "configurations per GB. 'lru' is an exact least-recently-used "
+        "cache built on a linked list and hash map."
+    )->check(CLI::IsMember({"clock", "lru"}));
+
     app.add_option(
         "-d, --dynamics", p.dynamics,
         "The type of dynamics to run. Defaults to 'auto'. Standard dynamics "
         "attempts to flip one spin every timestep, with the Metropolis "
         "acceptance/rejection criterion. Gillespie dynamics calculates all "
         "exit rates at once and flips a spin every iteration of the "
-        "algorithm, but with a waiting time not necessarily equal to 1. The "
-        "auto selection runs quick simulations of both types to see which "
-        "is faster, and selects that one."
-    )->check(CLI::IsMember({"standard", "gillespie", "auto"}));
+        "algorithm, but with a waiting time not necessarily equal to 1. "
+        "Standard-accelerated is statistically identical to standard, but "
+        "draws the number of rejected proposals before the next accepted "
+        "one from its geometric distribution instead of simulating them, "
+        "which pays off at low temperature where most proposals are "
+        "rejected. Standard-adaptive is also statistically identical to "
+        "standard, and switches between plain standard steps and the "
+        "rejection-free steps of standard-accelerated during the run, "
+        "based on the rolling acceptance rate and the measured cost per "
+        "unit of simulated time. As the switches depend on timing, seeded "
+        "runs are not reproducible step for step with this option. The "
+        "auto selection runs quick simulations of standard and Gillespie "
+        "dynamics to see which is faster, and selects that one."
+    )->check(CLI::IsMember({"standard", "gillespie", "standard-accelerated", "standard-adaptive", "auto"}));
+
+    app.add_option(
+        "--gillespie_kernel", p.gillespie_kernel,
+        "How Gillespie dynamics selects the spin to flip. Defaults to "
+        "'linear', a single pass over preallocated buffers which builds the "
+        "cumulative exit rates and searches them with one uniform draw. "
+        "'vectorized' is the same search, with the exit rates computed by "
+        "an AVX-512/AVX2 exponential kernel (relative error below 1e-15, "
+        "identical results on every CPU) instead of std::exp. 'reference' "
+        "builds a std::discrete_distribution every step, as older versions "
+        "did, and is kept for regression checks."
+    )->check(CLI::IsMember({"linear", "vectorized", "reference"}));
+
+    app.add_option(
+        "--step_timing", p.step_timing,
+        "How the wall time spent stepping, reported as "
+        "walltime_per_waitingtime, is measured. Defaults to 'sampled', "
+        "which times one step in 63 and scales it up. 'all' times every "
+        "step, at the cost of two clock reads per step, and 'off' does not "
+        "time steps at all."
+    )->check(CLI::IsMember({"sampled", "all", "off"}));
+
+    app.add_option(
+        "--rng", p.rng,
+        "The random number engine. Defaults to 'mt19937', which reproduces "
+        "the seeded runs of older versions exactly. 'xoshiro256pp', 'pcg64' "
+        "and 'philox' keep a few words of state instead of 5 KB, give every "
+        "tracer its own streams for the dynamics and the landscape, keyed "
+        "on its index over all MPI ranks, and sample exponential and "
+        "normal variates with ziggurat methods."
+    )->check(CLI::IsMember({"mt19937", "xoshiro256pp", "pcg64", "philox"}));
+
+    app.add_option(
+        "--energy_buffer_size", p.energy_buffer_size,
+        "The number of landscape energies sampled at once, ahead of the "
+        "cache misses which consume them. Defaults to 256. Seeded runs are "
+        "reproducible for a given buffer size, and with --rng=mt19937 do "
+        "not depend on it."
+    )->check(CLI::PositiveNumber);
+
+    app.add_option(
+        "--batch_lanes", p.batch_lanes,
+        "Run this many tracers of one MPI rank at a time in lockstep, as the "
+        "SIMD lanes of a batch, instead of one after another. Defaults to 0, "
+        "which is off. Requires standard dynamics and at most 64 spins. The "
+        "spin flips and Metropolis tests of a batch are drawn from "
+        "counter-based (Philox) streams of each tracer, so seeded runs are "
+        "reproducible but differ from runs without batching."
+    )->check(CLI::Range(0, BATCH_MAX_LANES));
 
     app.add_option(
         "-n, --n_tracers_per_MPI_rank", p.n_tracers_per_MPI_rank,
         "The number of simulations per MPI rank to run. Defaults to 10."
     )->check(CLI::PositiveNumber);
 
+    app.add_option(
+        "--n_tracers", p.n_tracers,
+        "The number of tracers of the whole job, over all MPI ranks. "
+        "Defaults to n_tracers_per_MPI_rank times the number of ranks. "
+        "Tracer ii writes the files data/<ii>_* and is seeded from its "
+        "index alone, whichever rank runs it."
+    )->check(CLI::NonNegativeNumber);
+
+    app.add_option(
+        "--scheduler", p.scheduler,
+        "How tracers are assigned to MPI ranks. Defaults to 'static', "
+        "tracers dealt to the ranks in turn. 'dynamic' keeps one counter on rank 0, "
+        "served by a thread of its own, from which ranks take the next "
+        "tracer as they finish, so that long tracers, e.g. Gillespie runs "
+        "stuck in deep traps, do not hold up the job. Results are the same "
+        "with either."
+    )->check(CLI::IsMember({"static", "dynamic"}));
+
+    app.add_option(
+        "--threads", p.threads,
+        "The number of threads each MPI rank runs its tracers on. Defaults "
+        "to 1. Every tracer (or batch, see --batch_lanes) runs on one "
+        "thread with its own landscape and observables, so one rank per "
+        "node or socket can replace one rank per core. The landscape "
+        "memory of --memory is per tracer, so a rank needs up to --threads "
+        "times as much. Results do not depend on the number of threads."
+    )->check(CLI::PositiveNumber);
+
+    app.add_option(
+        "--checkpoint_interval", p.checkpoint_interval,
+        "Save a checkpoint of every running tracer this often, in seconds "
+        "of wall time, to checkpoints/<ii>.ckpt, so that a job which is "
+        "killed can be continued with --resume. Defaults to 0, which is "
+        "off. Checkpoints are written on a background thread. Not "
+        "available with --batch_lanes."
+    )->check(CLI::NonNegativeNumber);
+
+    app.add_flag(
+        "--resume", p.resume,
+        "Continue a job which was stopped, run in the same directory with "
+        "the same options. Finished tracers are skipped, tracers with a "
+        "checkpoint continue from it, and output files are cut back to the "
+        "checkpoint. Seeded runs give the same results as if the job had "
+        "not been stopped, except for the wall time observables."
+    );
+
+    app.add_option(
+        "--output_format", p.output_format,
+        "How the observables of the tracers are written. Defaults to "
+        "'text', one file per tracer and observable, data/<ii>_*.txt. "
+        "'binary' appends the observables of every finished tracer, as "
+        "float64, to one container per MPI rank, data/rank_<r>.dat, "
+        "indexed by data/rank_<r>.idx, which avoids creating seven files "
+        "per tracer. hdspin_export converts the containers of a run to the "
+        "text files. 'reduced' writes no output per tracer: every rank adds "
+        "the observables of its tracers to running sums per grid point, "
+        "which are added up over the ranks at the end of the job, and the "
+        "means, spreads and standard errors of postprocess.py are written "
+        "to final/ directly. Not available with --checkpoint_interval or "
+        "--resume."
+    )->check(CLI::IsMember({"text", "binary", "reduced"}));
+
     app.add_option(
         "--seed", p.seed,
         "Seeds for the random number generators for reproducible runs. Leave "
         "unset for un-reproducible, random seeds."
     )->check(CLI::PositiveNumber);
 
+    std::string sweep_spec_path;
+    app.add_option(
+        "--sweep", sweep_spec_path,
+        "Run a parameter sweep as one job, from a JSON spec of parameters "
+        "as in config.json, where N_spins and beta may be lists. Every "
+        "(N_spins, beta) pair gets its own directory, e.g. 16_1.5000/, "
+        "with its own config.json, grids and data, and the tracers of all "
+        "pairs are scheduled together, the most expensive first. As in "
+        "scripts/construct_inputs.py, 'dynamics_or_threshold' may set the "
+        "dynamics, or a beta below which standard dynamics is run and "
+        "above which Gillespie dynamics is. The command line gives the "
+        "defaults for anything not in the spec. Not available with "
+        "--batch_lanes."
+    );
+
     CLI11_PARSE(app, argc, argv);
+
+    // These are required, either on the command line or in the sweep spec
+    json sweep_spec = json::object();
+    if (!sweep_spec_path.empty())
+    {
+        std::ifstream sweep_spec_file(sweep_spec_path);
+        if (!sweep_spec_file){throw std::runtime_error("Could not open " + sweep_spec_path);}
+        sweep_spec_file >> sweep_spec;
+    }
+    for (const auto &required : {
+        std::make_pair(N_spins_option, std::string("N_spins")),
+        std::make_pair(landscape_option, std::string("landscape")),
+        std::make_pair(beta_option, std::string("beta")),
+        std::make_pair(log10_N_timesteps_option, std::string("log10_N_timesteps"))})
+    {
+        if (required.first->count() == 0 && !sweep_spec.contains(required.second))
+        {
+            return app.exit(CLI::RequiredError(required.first->get_name()));
+        }
+    }
     // -----------------------------------------------------------------------
     // -----------------------------------------------------------------------
     // PARSER ----------------------------------------------------------------
 
-    update_parameters_(&p);
+    // A single run is a sweep of one point, in the working directory
+    std::vector<sweep::Point> points;
+    if (sweep_spec_path.empty())
+    {
+        update_parameters_(&p);
+        points.push_back({p, ""});
+    }
+    else{points = sweep::points_from_json(sweep_spec, p);}
 
     MPI_Barrier(MPI_COMM_WORLD);
 
@@ -270,77 +753,248 @@ int main(int argc, char *argv[])
     fflush(stdout);
     MPI_Barrier(MPI_COMM_WORLD);
 
-    // Get the information for this MPI rank
-    const unsigned int n_tracers_per_MPI_rank = p.n_tracers_per_MPI_rank;
-    const unsigned int resume_at = 0;
-    const unsigned int start = resume_at + MPI_RANK * n_tracers_per_MPI_rank;
-    const unsigned int end = resume_at + (MPI_RANK + 1) * n_tracers_per_MPI_rank;
+    // The tracers of every point, by default n_tracers_per_MPI_rank on
+    // every rank
+    for (sweep::Point &point : points)
+    {
+        if (point.params.n_tracers == 0)
+        {
+            point.params.n_tracers = point.params.n_tracers_per_MPI_rank * MPI_WORLD_SIZE;
+        }
+    }
 
     fflush(stdout);
     MPI_Barrier(MPI_COMM_WORLD);
 
+    const bool checkpointing = p.checkpoint_interval > 0.0 || p.resume;
     if (MPI_RANK == 0)
     {
-        // parameters::log_json(inp);
-        parameters::log_parameters(p);
-        make_directories();
-        grids::make_energy_grid_logspace(p.log10_N_timesteps, p.grid_size);
-        grids::make_pi_grids(p.log10_N_timesteps, p.dw, p.grid_size);
-        json j = parameters::parameters_to_json(p);
-        std::ofstream o("config.json");
-        o << std::setw(4) << j << std::endl;
+        for (const sweep::Point &point : points)
+        {
+            // parameters::log_json(inp);
+            if (points.size() == 1){parameters::log_parameters(point.params);}
+            else
+            {
+                printf("Sweep point %s: N_spins = %i, beta = %.04f, dynamics = %s, %i tracers\n",
+                    point.directory.c_str(), point.params.N_spins, point.params.beta,
+                    point.params.dynamics.c_str(), point.params.n_tracers);
+            }
+            make_directories(point.directory);
+            if (checkpointing){system(("mkdir -p " + point.directory + "checkpoints").c_str());}
+            grids::write_grid_set(*grids::shared_grid_set(point.params.log10_N_timesteps,
+                point.params.dw, point.params.grid_size), point.directory);
+            json j = parameters::parameters_to_json(point.params);
+            std::ofstream o(point.directory + "config.json");
+            o << std::setw(4) << j << std::endl;
+        }
     }
     fflush(stdout);
     MPI_Barrier(MPI_COMM_WORLD);
 
-    // Define some helpers to be used to track progress.
-    const unsigned int total_steps = end - start;
-    unsigned int step_size = total_steps / 10; // Print at 10 percent steps
-    if (step_size == 0){step_size = 1;}
-    unsigned int loop_count = 0;
-
     auto global_start = std::chrono::high_resolution_clock::now();
 
-    const unsigned int starting_seed = p.seed;
-
-    // If p.dynamics == "auto", we run a quick check to see which
+    // If the dynamics is "auto", we run a quick check to see which
     // simulation is faster
-    if (p.dynamics == "auto")
+    for (sweep::Point &point : points)
+    {
+        if (point.params.dynamics == "auto")
+        {
+            point.params.dynamics = determine_dynamics_automatically(point.params, MPI_WORLD_SIZE, MPI_RANK, MPI_COMM_WORLD);
+        }
+    }
+
+    if (p.batch_lanes > 0)
     {
-        p.dynamics = determine_dynamics_automatically(p, MPI_WORLD_SIZE, MPI_RANK, MPI_COMM_WORLD);
+        if (points.size() > 1)
+        {
+            throw std::runtime_error("--batch_lanes cannot be combined with --sweep");
+        }
+        if (points[0].params.dynamics != "standard")
+        {
+            throw std::runtime_error("--batch_lanes requires standard dynamics");
+        }
+        if (points[0].params.N_spins > 64)
+        {
+            throw std::runtime_error("--batch_lanes requires at most 64 spins");
+        }
+        if (checkpointing)
+        {
+            throw std::runtime_error("--batch_lanes cannot be checkpointed");
+        }
     }
 
-    for(int ii=start; ii<end; ii++)
+    // With binary output, every rank appends to a container of its own in
+    // the data directory of every point, and with reduced output, to
+    // running sums of its own for every point
+    const output::format_t output_format = output::from_string(p.output_format);
+    if (output_format == output::REDUCED && checkpointing)
+    {
+        throw std::runtime_error("--output_format=reduced cannot be checkpointed");
+    }
+    std::vector<std::unique_ptr<output::Sink>> sinks(points.size());
+    for (unsigned int pp=0; pp<points.size(); pp++)
     {
+        if (output_format == output::BINARY)
+        {
+            sinks[pp].reset(new output::ContainerWriter(
+                output::container_path(points[pp].directory, MPI_RANK), p.resume));
+        }
+        else if (output_format == output::REDUCED)
+        {
+            sinks[pp].reset(new reduction::Accumulator(grids::shared_grid_set(
+                points[pp].params.log10_N_timesteps, points[pp].params.dw,
+                points[pp].params.grid_size)->energy.size()));
+        }
+    }
 
-        auto t_start = std::chrono::high_resolution_clock::now();
+    // The tracers of the job, as indices into points and tracer indices
+    // within their point. The tracers of a sweep run the most expensive
+    // first, so that the job does not end waiting on one long tracer
+    std::vector<std::pair<unsigned int, unsigned int>> tasks;
+    for (unsigned int pp=0; pp<points.size(); pp++)
+    {
+        for (unsigned int jj=0; jj<points[pp].params.n_tracers; jj++){tasks.push_back({pp, jj});}
+    }
+    if (points.size() > 1)
+    {
+        std::vector<double> costs;
+        for (const sweep::Point &point : points){costs.push_back(sweep::estimated_cost(point.params));}
+        std::stable_sort(tasks.begin(), tasks.end(),
+            [&costs](const std::pair<unsigned int, unsigned int> &a, const std::pair<unsigned int, unsigned int> &b)
+        {
+            return costs[a.first] > costs[b.first];
+        });
+    }
+    const unsigned int n_tasks = tasks.size();
 
-        const parameters::FileNames fnames = parameters::get_filenames(ii);
+    // With batching, the tracers [ii, ii + batch_lanes) run together
+    const unsigned int tracers_per_iteration = p.batch_lanes > 0 ? p.batch_lanes : 1;
 
-        // Change the seed based on the MPI rank, very important for seeded runs!
-        // This will be ignored later if p.use_manual_seed is false
-        p.seed = starting_seed + ii + MPI_RANK * n_tracers_per_MPI_rank;
+    const scheduler::mode_t scheduler_mode = scheduler::from_string(p.scheduler);
+    if (scheduler_mode == scheduler::DYNAMIC && (p.threads > 1 || MPI_WORLD_SIZE > 1)
+        && mpi_thread_support < MPI_THREAD_SERIALIZED)
+    {
+        throw std::runtime_error("--scheduler=dynamic with --threads or several ranks requires MPI_THREAD_SERIALIZED");
+    }
+    // Freed right after the tracers, before any other MPI call
+    std::unique_ptr<scheduler::TracerScheduler> tracer_scheduler(
+        new scheduler::TracerScheduler(scheduler_mode, n_tasks,
+            tracers_per_iteration, MPI_COMM_WORLD));
+
+    // Define some helpers to be used to track progress. Ranks do not know
+    // their share of a dynamic schedule, so it is counted against the job
+    const unsigned int total_steps = scheduler_mode == scheduler::STATIC ?
+        (n_tasks + MPI_WORLD_SIZE - 1) / MPI_WORLD_SIZE : n_tasks;
+    unsigned int step_size = total_steps / 10; // Print at 10 percent steps
+    if (step_size == 0){step_size = 1;}
+    unsigned int loop_count = 0;
+
+    // Each item is one tracer, or one batch of tracers, and owns everything
+    // it simulates. Only the scheduler, the progress counter and printing
+    // are shared between the threads
+    std::mutex progress_mutex;
+    thread_pool::run_claimed(p.threads, [&tracer_scheduler](unsigned int &item)
+    {
+        unsigned int last;
+        return tracer_scheduler->next(item, last);
+    }, [&](const unsigned int ii)
+    {
+        const unsigned int end = std::min(ii + tracers_per_iteration, n_tasks);
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+
+        std::vector<parameters::FileNames> fnames_batch;
+        std::vector<parameters::SimulationParameters> params_batch;
+        bool finished = false;
+        for (unsigned int kk=ii; kk<end; kk++)
+        {
+            const sweep::Point &point = points[tasks[kk].first];
+            const unsigned int jj = tasks[kk].second;
+            fnames_batch.push_back(parameters::get_filenames(jj, point.directory));
+
+            // Change the seed based on the tracer index, very important for
+            // seeded runs! This will be ignored later if p.use_manual_seed
+            // is false. The offset is that of the rank which runs the
+            // tracer in the default static schedule, so that seeds do not
+            // depend on the schedule
+            const unsigned int n_tracers_per_MPI_rank = point.params.n_tracers_per_MPI_rank;
+            parameters::SimulationParameters p_tracer = point.params;
+            p_tracer.seed = point.params.seed + jj + (jj / n_tracers_per_MPI_rank) * n_tracers_per_MPI_rank;
+            p_tracer.tracer_index = jj;
+
+            // When resuming, tracers which finished are not run again, and
+            // those without a checkpoint start over
+            if (p.resume)
+            {
+                finished = access(fnames_batch.back().checkpoint_done.c_str(), F_OK) == 0;
+                p_tracer.resume = access(fnames_batch.back().checkpoint.c_str(), F_OK) == 0;
+            }
+            params_batch.push_back(p_tracer);
+        }
+        const parameters::FileNames fnames = fnames_batch.back();
+        const std::string tracer_name = points[tasks[end - 1].first].directory + fnames.ii_str;
 
         // Run dynamics START -------------------------------------------------
-        execute(fnames, p);
+        output::Sink* sink = sinks[tasks[ii].first].get();
+        if (finished){;}
+        else if (p.batch_lanes > 0){execute_batch_dispatch(fnames_batch, params_batch, sink);}
+        else{execute_dispatch(fnames, params_batch[0], sink);}
         // Run dynamics END ---------------------------------------------------
 
+        // The output files are closed by now. The marker goes first, so
+        // that the tracer is never run again once its checkpoint is gone
+        if (checkpointing && !finished)
+        {
+            checkpoint::write_file_atomic(fnames.checkpoint_done, std::vector<char>());
+            remove(fnames.checkpoint.c_str());
+        }
+
         const double duration = time_utils::get_time_delta(t_start);
 
-        loop_count++;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        const unsigned int previous_loop_count = loop_count;
+        loop_count += params_batch.size();
 
         if (MPI_RANK == 0)
         {
-            if (loop_count % step_size == 0 | loop_count == 1)
+            if (loop_count / step_size != previous_loop_count / step_size | previous_loop_count == 0)
             {
                 const std::string dt_string = time_utils::get_datetime();
                 const double global_duration = time_utils::get_time_delta(global_start);
                 printf(
-                    "%s ~ %s done in %.01f s (%i/%i) total elapsed %.01f s\n", dt_string.c_str(), fnames.ii_str.c_str(), duration, loop_count, total_steps, global_duration
+                    "%s ~ %s done in %.01f s (%i/%i) total elapsed %.01f s\n", dt_string.c_str(), tracer_name.c_str(), duration, loop_count, total_steps, global_duration
                 );
                 fflush(stdout);
             }
         }
+    });
+
+    // Rank 0 serves the claims of the other ranks until they have all run
+    // out of tracers
+    tracer_scheduler.reset();
+
+    // The sums of every point, over all ranks, go to rank 0
+    if (output_format == output::REDUCED)
+    {
+        for (unsigned int pp=0; pp<points.size(); pp++)
+        {
+            reduction::Accumulator &sums = static_cast<reduction::Accumulator&>(*sinks[pp]);
+            std::vector<double> &local = sums.get_sums();
+            std::vector<double> total(local.size());
+            MPI_Reduce(local.data(), total.data(), local.size(), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            if (MPI_RANK == 0)
+            {
+                local = total;
+                sums.write_final(points[pp].directory, grids::shared_grid_set(
+                    points[pp].params.log10_N_timesteps, points[pp].params.dw,
+                    points[pp].params.grid_size)->energy);
+            }
+        }
+        if (MPI_RANK == 0)
+        {
+            printf("%s ~ reduced %i tracers to final/\n", time_utils::get_datetime().c_str(), n_tasks);
+            fflush(stdout);
+        }
     }
 
     MPI_Finalize();
@@ -31,25 +31,54 @@ double StreamingMedian::median() const
     return max_heap.top();
 }
 
+void StreamingMedian::save(checkpoint::Writer &writer) const
+{
+    // The heaps are written in pop order, which load pushes back as is
+    std::vector<double> values;
+    std::priority_queue<double> max_copy = max_heap;
+    for (; !max_copy.empty(); max_copy.pop()){values.push_back(max_copy.top());}
+    writer.write_vector(values);
+
+    values.clear();
+    std::priority_queue<double, std::vector<double>, std::greater<double>> min_copy = min_heap;
+    for (; !min_copy.empty(); min_copy.pop()){values.push_back(min_copy.top());}
+    writer.write_vector(values);
+}
+
+void StreamingMedian::load(checkpoint::Reader &reader)
+{
+    std::vector<double> values;
+    reader.read_vector(values);
+    max_heap = std::priority_queue<double>(values.begin(), values.end());
+    reader.read_vector(values);
+    min_heap = std::priority_queue<double, std::vector<double>, std::greater<double>>(
+        values.begin(), values.end());
+}
+
 
-ObsBase::ObsBase(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system) : fnames(fnames), params(params)
+template<unsigned int Words>
+ObsBase<Words>::ObsBase(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer) : fnames(fnames), params(params),
+    output_format(output::from_string(params.output_format)), text_writer(text_writer),
+    grid_set(grids::shared_grid_set(params.log10_N_timesteps, params.dw, params.grid_size)),
+    grid(grid_set->energy)
 {
-    const std::string grid_location = fnames.grids_directory + "/energy.txt";
-    grids::load_long_long_grid_(grid, grid_location);
     grid_length = grid.size();
     spin_system_ptr = &spin_system;
 };
 
-RidgeBase::RidgeBase(const parameters::FileNames fnames,
-    const parameters::SimulationParameters params, const SpinSystem& spin_system) : ObsBase(fnames, params, spin_system){}
+template<unsigned int Words>
+RidgeBase<Words>::RidgeBase(const parameters::FileNames fnames,
+    const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system,
+    output::TextWriter* text_writer) : ObsBase<Words>(fnames, params, spin_system, text_writer){}
 
-void RidgeBase::step(const double waiting_time, const double simulation_clock)
+template<unsigned int Words>
+void RidgeBase<Words>::step(const double waiting_time, const double simulation_clock)
 {
 
     if (!_threshold_valid){return;}
 
-    const parameters::StateProperties prev = spin_system_ptr->get_previous_state();
-    const parameters::StateProperties curr = spin_system_ptr->get_current_state();
+    const parameters::StateProperties<Words> prev = spin_system_ptr->get_previous_state();
+    const parameters::StateProperties<Words> curr = spin_system_ptr->get_current_state();
 
     const double _prev_energy = prev.energy;
     const double _curr_energy = curr.energy;
@@ -95,61 +124,92 @@ void RidgeBase::step(const double waiting_time, const double simulation_clock)
         const double _mean = streaming_mean.mean();
         while (grid[pointer] < simulation_clock)
         {   
-            fprintf(outfile, "%.08f %.08f %lli\n", _mean, _median, _total_steps);
+            const double row[3] = {_mean, _median, (double) _total_steps};
+            outfile->write(row);
             pointer += 1;
             if (pointer > grid_length - 1){return;}
         }
     }
 }
 
-RidgeBase::~RidgeBase()
+template<unsigned int Words>
+void RidgeBase<Words>::save(checkpoint::Writer &writer) const
 {
-    if (_threshold_valid){fclose(outfile);}
+    writer.write(_threshold_valid);
+    if (!_threshold_valid){return;}
+    writer.write(pointer);
+    writer.write(_total_steps);
+    streaming_median.save(writer);
+    streaming_mean.save(writer);
+    writer.write(_last_energy);
+    writer.write(_current_ridge);
+    writer.write(_exited_first_basin);
+    outfile->save(writer);
 }
 
+template<unsigned int Words>
+void RidgeBase<Words>::load(checkpoint::Reader &reader)
+{
+    reader.expect(_threshold_valid, "beta");
+    if (!_threshold_valid){return;}
+    reader.read(pointer);
+    reader.read(_total_steps);
+    streaming_median.load(reader);
+    streaming_mean.load(reader);
+    reader.read(_last_energy);
+    reader.read(_current_ridge);
+    reader.read(_exited_first_basin);
+    outfile->load(reader);
+}
 
-RidgeE::RidgeE(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system) : RidgeBase(fnames, params, spin_system)
+template<unsigned int Words>
+void RidgeBase<Words>::collect_streams(std::vector<const output::Stream*> &streams) const
 {
-    outfile = fopen(fnames.ridge_E.c_str(), "w");
-    _threshold = params.energetic_threshold;
+    if (_threshold_valid){streams.push_back(outfile.get());}
 }
 
 
-RidgeS::RidgeS(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system) : RidgeBase(fnames, params, spin_system)
+template<unsigned int Words>
+RidgeE<Words>::RidgeE(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer) : RidgeBase<Words>(fnames, params, spin_system, text_writer)
 {
-    _threshold_valid = params.valid_entropic_attractor;
-    _threshold = params.entropic_attractor;
-    if (_threshold_valid)
+    this->outfile.reset(new output::Stream(output::RIDGE_E, this->output_format, fnames, params.resume, this->text_writer));
+    this->_threshold = params.energetic_threshold;
+}
+
+
+template<unsigned int Words>
+RidgeS<Words>::RidgeS(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer) : RidgeBase<Words>(fnames, params, spin_system, text_writer)
+{
+    this->_threshold_valid = params.valid_entropic_attractor;
+    this->_threshold = params.entropic_attractor;
+    if (this->_threshold_valid)
     {
-        outfile = fopen(fnames.ridge_S.c_str(), "w");
+        this->outfile.reset(new output::Stream(output::RIDGE_S, this->output_format, fnames, params.resume, this->text_writer));
     }
 }
 
-OnePointObservables::OnePointObservables(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem& spin_system) : ObsBase(fnames, params, spin_system)
+template<unsigned int Words>
+OnePointObservables<Words>::OnePointObservables(const parameters::FileNames fnames, const parameters::SimulationParameters params, const SpinSystem<Words>& spin_system, output::TextWriter* text_writer) : ObsBase<Words>(fnames, params, spin_system, text_writer),
+    outfile_energy(output::ENERGY, this->output_format, fnames, params.resume, text_writer),
+    outfile_energy_IS(output::ENERGY_IS, this->output_format, fnames, params.resume, text_writer),
+    outfile_capacity(output::CACHE_SIZE, this->output_format, fnames, params.resume, text_writer),
+    outfile_acceptance_rate(output::ACCEPTANCE_RATE, this->output_format, fnames, params.resume, text_writer),
+    outfile_walltime_per_waitingtime(output::WALLTIME_PER_WAITINGTIME, this->output_format, fnames, params.resume, text_writer)
 {
-    // Energy
-    outfile_energy = fopen(fnames.energy.c_str(), "w");
-
-    // Inherent structure energy
-    outfile_energy_IS = fopen(fnames.energy_IS.c_str(), "w");
-
     // Cache capacity observable
-    // First line is the total capacity
-    const std::string cache_capacity_string = std::string(spin_system_ptr->get_emap_ptr()->get_capacity());
-    outfile_capacity = fopen(fnames.cache_size.c_str(), "w");
-    fprintf(outfile_capacity, "%s\n", cache_capacity_string.c_str());
+    // First line is the total capacity, already there when resuming
+    const long long cache_capacity = spin_system_ptr->get_emap_ptr()->get_capacity();
+    if (!params.resume){outfile_capacity.write((double) cache_capacity);}
 
-    // Inherent structure calculation time observable
-    outfile_acceptance_rate = fopen(fnames.acceptance_rate.c_str(), "w");
-
-    // Wall time/timestep
-    outfile_walltime_per_waitingtime = fopen(fnames.walltime_per_waitingtime.c_str(), "w");
+    _rejection_runs = params.dynamics == "standard-accelerated"
+        || params.dynamics == "standard-adaptive";
 }
 
-void OnePointObservables::step(const double waiting_time, const double simulation_clock)
+template<unsigned int Words>
+void OnePointObservables<Words>::step(const double waiting_time, const double simulation_clock)
 {
 
-    const parameters::StateProperties prev = spin_system_ptr->get_previous_state(); 
+    const parameters::StateProperties<Words> prev = spin_system_ptr->get_previous_state(); 
 
     // No updates necessary
     if (simulation_clock <= grid[pointer]){return;}
@@ -159,37 +219,78 @@ void OnePointObservables::step(const double waiting_time, const double simulatio
     const double energy = prev.energy;
 
     // Energy inherent structure
-    const ap_uint<PRECISON> inherent_structure = spin_system_ptr->get_emap_ptr()->get_inherent_structure(prev.state);
+    const SpinState<Words> inherent_structure = spin_system_ptr->get_emap_ptr()->get_inherent_structure(prev.state);
     const double energy_IS = spin_system_ptr->get_emap_ptr()->get_config_energy(inherent_structure);
 
     // Get the current simulation statistics for some of the observables
     const parameters::SimulationStatistics sim_stats = spin_system_ptr->get_sim_stats();
 
     // Write to the outfile_capacity
-    const std::string cache_size_string = std::string(spin_system_ptr->get_emap_ptr()->get_size());
+    const long long cache_size = spin_system_ptr->get_emap_ptr()->get_size();
 
     // Get acceptance rates
     const double acceptance_rate = ((double) sim_stats.acceptances) / ((double) sim_stats.total_steps);
 
     while (grid[pointer] < simulation_clock)
     {   
-        fprintf(outfile_energy, "%.08f\n", energy);
-        fprintf(outfile_energy_IS, "%.08f\n", energy_IS);
-        fprintf(outfile_capacity, "%s\n", cache_size_string.c_str());
-        fprintf(outfile_acceptance_rate, "%.08f\n", acceptance_rate);
-        fprintf(outfile_walltime_per_waitingtime, "%.08f\n", sim_stats.total_wall_time/sim_stats.total_waiting_time);
+        outfile_energy.write(energy);
+        outfile_energy_IS.write(energy_IS);
+        outfile_capacity.write((double) cache_size);
+        if (_rejection_runs)
+        {
+            // The standard dynamics would record this grid point at step
+            // grid + 1, part way through the run of rejections, so count
+            // only the steps taken up to there
+            const unsigned long long steps_after = (unsigned long long) (simulation_clock - (grid[pointer] + 1));
+            outfile_acceptance_rate.write(
+                ((double) sim_stats.acceptances) / ((double) (sim_stats.total_steps - steps_after)));
+        }
+        else
+        {
+            outfile_acceptance_rate.write(acceptance_rate);
+        }
+        outfile_walltime_per_waitingtime.write(sim_stats.total_wall_time/sim_stats.total_waiting_time);
 
         pointer += 1;
         if (pointer > grid_length - 1){return;}
     }
 }
 
-OnePointObservables::~OnePointObservables()
+template<unsigned int Words>
+void OnePointObservables<Words>::save(checkpoint::Writer &writer) const
 {
-    fclose(outfile_energy);
-    fclose(outfile_energy_IS);
-    fclose(outfile_capacity);
-    fclose(outfile_acceptance_rate);
-    fclose(outfile_walltime_per_waitingtime);
+    writer.write(pointer);
+    outfile_energy.save(writer);
+    outfile_energy_IS.save(writer);
+    outfile_capacity.save(writer);
+    outfile_acceptance_rate.save(writer);
+    outfile_walltime_per_waitingtime.save(writer);
 }
 
+template<unsigned int Words>
+void OnePointObservables<Words>::load(checkpoint::Reader &reader)
+{
+    reader.read(pointer);
+    outfile_energy.load(reader);
+    outfile_energy_IS.load(reader);
+    outfile_capacity.load(reader);
+    outfile_acceptance_rate.load(reader);
+    outfile_walltime_per_waitingtime.load(reader);
+}
+
+template<unsigned int Words>
+void OnePointObservables<Words>::collect_streams(std::vector<const output::Stream*> &streams) const
+{
+    streams.push_back(&outfile_energy);
+    streams.push_back(&outfile_energy_IS);
+    streams.push_back(&outfile_capacity);
+    streams.push_back(&outfile_acceptance_rate);
+    streams.push_back(&outfile_walltime_per_waitingtime);
+}
+
+
+HDSPIN_INSTANTIATE_STATE_WIDTHS(ObsBase)
+HDSPIN_INSTANTIATE_STATE_WIDTHS(RidgeBase)
+HDSPIN_INSTANTIATE_STATE_WIDTHS(RidgeE)
+HDSPIN_INSTANTIATE_STATE_WIDTHS(RidgeS)
+HDSPIN_INSTANTIATE_STATE_WIDTHS(OnePointObservables)
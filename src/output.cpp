@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <dirent.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "output.h"
+
+
+namespace output
+{
+
+    format_t from_string(const std::string &name)
+    {
+        if (name == "text"){return TEXT;}
+        else if (name == "binary"){return BINARY;}
+        else if (name == "reduced"){return REDUCED;}
+        throw std::runtime_error("Unknown output format " + name);
+    }
+
+    unsigned int n_columns(const observable_t observable)
+    {
+        if (observable == RIDGE_E || observable == RIDGE_S){return 3;}
+        return 1;
+    }
+
+    const char* name(const observable_t observable)
+    {
+        switch (observable)
+        {
+            case ENERGY: return "energy";
+            case ENERGY_IS: return "energy_IS";
+            case RIDGE_E: return "ridge_E";
+            case RIDGE_S: return "ridge_S";
+            case CACHE_SIZE: return "cache_size";
+            case ACCEPTANCE_RATE: return "acceptance_rate";
+            case WALLTIME_PER_WAITINGTIME: return "walltime_per_waitingtime";
+            default: throw std::runtime_error("Unknown observable");
+        }
+    }
+
+    const std::string& text_path(const parameters::FileNames &fnames,
+        const observable_t observable)
+    {
+        switch (observable)
+        {
+            case ENERGY: return fnames.energy;
+            case ENERGY_IS: return fnames.energy_IS;
+            case RIDGE_E: return fnames.ridge_E;
+            case RIDGE_S: return fnames.ridge_S;
+            case CACHE_SIZE: return fnames.cache_size;
+            case ACCEPTANCE_RATE: return fnames.acceptance_rate;
+            case WALLTIME_PER_WAITINGTIME: return fnames.walltime_per_waitingtime;
+            default: throw std::runtime_error("Unknown observable");
+        }
+    }
+
+    void write_text_row(FILE* file, const observable_t observable, const double *row)
+    {
+        // Counts are stored as float64, which holds them exactly
+        if (observable == RIDGE_E || observable == RIDGE_S)
+        {
+            fprintf(file, "%.08f %.08f %lli\n", row[0], row[1], (long long) row[2]);
+        }
+        else if (observable == CACHE_SIZE){fprintf(file, "%lli\n", (long long) row[0]);}
+        else{fprintf(file, "%.08f\n", row[0]);}
+    }
+
+    std::string container_path(const std::string &directory, const int rank)
+    {
+        return directory + "data/rank_" + std::to_string(rank);
+    }
+
+
+    TextWriterThread::TextWriterThread()
+    {
+        _thread = std::thread(&TextWriterThread::_run, this);
+    }
+
+    TextWriterThread& TextWriterThread::shared()
+    {
+        static TextWriterThread thread;
+        return thread;
+    }
+
+    void TextWriterThread::add(TextWriter* writer)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _writers.push_back(writer);
+    }
+
+    void TextWriterThread::remove(TextWriter* writer)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _writers.erase(std::find(_writers.begin(), _writers.end(), writer));
+    }
+
+    void TextWriterThread::_run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            bool written = false;
+            for (TextWriter* writer : _writers){written = writer->_drain() || written;}
+            if (written){continue;}
+            if (_stop){return;}
+
+            // A row pushed after the rings were found empty either sees
+            // _sleeping set, and notifies, or is seen here
+            _sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool pending = false;
+            for (TextWriter* writer : _writers){pending = pending || writer->_pending();}
+            if (!pending){_wake.wait(lock);}
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    TextWriterThread::~TextWriterThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+
+
+    TextWriter::TextWriter() : _ring(TEXT_WRITER_CAPACITY), _thread(TextWriterThread::shared())
+    {
+        _thread.add(this);
+    }
+
+    bool TextWriter::_drain()
+    {
+        // Everything pushed so far, in one go
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        const size_t head = _head.load(std::memory_order_acquire);
+        if (head == tail){return false;}
+        for (; tail != head; tail++)
+        {
+            const Record &record = _ring[tail % TEXT_WRITER_CAPACITY];
+            write_text_row(record.file, record.observable, record.row);
+        }
+        _tail.store(tail, std::memory_order_release);
+        return true;
+    }
+
+    TextWriter::~TextWriter()
+    {
+        wait();
+        _thread.remove(this);
+    }
+
+
+    Stream::Stream(const observable_t observable, const format_t format,
+        const parameters::FileNames &fnames, const bool resume,
+        TextWriter* writer) : _observable(observable)
+    {
+        if (format != TEXT){return;}
+        const std::string &path = text_path(fnames, observable);
+        _file = fopen(path.c_str(), resume ? "r+" : "w");
+        if (_file == nullptr){throw std::runtime_error("Could not open " + path);}
+
+        // The writer thread writes out in large blocks
+        _writer = writer;
+        if (_writer != nullptr){setvbuf(_file, nullptr, _IOFBF, 1 << 16);}
+    }
+
+    void Stream::save(checkpoint::Writer &writer) const
+    {
+        if (_file == nullptr)
+        {
+            writer.write_vector(_values);
+            return;
+        }
+        writer.write(_n_rows);
+
+        // Not waiting for the writer here, the rows saved must be in the
+        // file before the checkpoint is
+        TextWriter* const text_writer = _writer;
+        FILE* const file = _file;
+        const size_t pushed = text_writer != nullptr ? text_writer->pushed() : 0;
+        writer.defer([text_writer, file, pushed](checkpoint::Writer&)
+        {
+            if (text_writer != nullptr){text_writer->wait_for(pushed);}
+            fflush(file);
+        });
+    }
+
+    void Stream::load(checkpoint::Reader &reader)
+    {
+        if (_file == nullptr)
+        {
+            reader.read_vector(_values);
+            return;
+        }
+
+        // Anything written after the checkpoint is dropped, as the tracer
+        // writes it again
+        reader.read(_n_rows);
+        if (_writer != nullptr){_writer->wait();}
+        fflush(_file);
+        rewind(_file);
+        uint64_t n_lines = 0;
+        for (int c = 0; n_lines < _n_rows && (c = fgetc(_file)) != EOF;)
+        {
+            if (c == '\n'){n_lines++;}
+        }
+        const long offset = ftell(_file);
+        if (n_lines != _n_rows || ftruncate(fileno(_file), offset) != 0 || fseek(_file, offset, SEEK_SET) != 0)
+        {
+            throw std::runtime_error("Could not restore an output file from the checkpoint");
+        }
+    }
+
+    Stream::~Stream()
+    {
+        if (_file == nullptr){return;}
+        if (_writer != nullptr){_writer->wait();}
+        fclose(_file);
+    }
+
+
+    static const long HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+    // Tells containers written at different times apart
+    static uint64_t _new_container_id()
+    {
+        std::random_device device;
+        const uint64_t random = ((uint64_t) device() << 32) ^ device();
+        return random ^ (uint64_t) std::chrono::system_clock::now().time_since_epoch().count();
+    }
+
+    // Opens a container file for appending, writing the header if it is
+    // new. Returns the size of the file, header included
+    static FILE* _open_container_file(const std::string &path, const bool resume, long &size)
+    {
+        FILE* file = resume ? fopen(path.c_str(), "r+b") : nullptr;
+        if (file != nullptr)
+        {
+            fseek(file, 0, SEEK_END);
+            size = ftell(file);
+
+            // A file cut short before its header was written starts over
+            if (size < HEADER_SIZE){fclose(file);}
+            else
+            {
+                uint32_t header[2];
+                rewind(file);
+                if (fread(header, sizeof(uint32_t), 2, file) != 2
+                    || header[0] != MAGIC || header[1] != VERSION)
+                {
+                    fclose(file);
+                    throw std::runtime_error(path + " is not an hdspin container of this version");
+                }
+                fseek(file, 0, SEEK_END);
+                return file;
+            }
+        }
+
+        file = fopen(path.c_str(), "w+b");
+        if (file == nullptr){throw std::runtime_error("Could not open " + path);}
+        const uint32_t header[2] = {MAGIC, VERSION};
+        const uint64_t id = _new_container_id();
+        fwrite(header, sizeof(uint32_t), 2, file);
+        fwrite(&id, sizeof(uint64_t), 1, file);
+        fflush(file);
+        size = HEADER_SIZE;
+        return file;
+    }
+
+    ContainerWriter::ContainerWriter(const std::string &path, const bool resume)
+    {
+        long size;
+        _data = _open_container_file(path + ".dat", resume, size);
+        _index = _open_container_file(path + ".idx", resume, size);
+
+        // Drop an entry which was cut short
+        const long entries_size = (size - HEADER_SIZE) / sizeof(IndexEntry) * sizeof(IndexEntry);
+        if (HEADER_SIZE + entries_size != size)
+        {
+            fflush(_index);
+            if (ftruncate(fileno(_index), HEADER_SIZE + entries_size) != 0)
+            {
+                throw std::runtime_error("Could not repair " + path + ".idx");
+            }
+            fseek(_index, 0, SEEK_END);
+        }
+    }
+
+    void ContainerWriter::append(const unsigned int tracer, const std::vector<const Stream*> &streams)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        std::vector<IndexEntry> entries;
+        for (const Stream* stream : streams)
+        {
+            const std::vector<double> &values = stream->get_values();
+            IndexEntry entry;
+            entry.tracer = tracer;
+            entry.observable = stream->get_observable();
+            entry.n_columns = n_columns(stream->get_observable());
+            entry.offset = ftell(_data);
+            entry.n_rows = values.size() / entry.n_columns;
+            if (fwrite(values.data(), sizeof(double), values.size(), _data) != values.size())
+            {
+                throw std::runtime_error("Could not write to an output container");
+            }
+            entries.push_back(entry);
+        }
+        fflush(_data);
+
+        if (fwrite(entries.data(), sizeof(IndexEntry), entries.size(), _index) != entries.size())
+        {
+            throw std::runtime_error("Could not write to an output container");
+        }
+        fflush(_index);
+    }
+
+    ContainerWriter::~ContainerWriter()
+    {
+        fclose(_data);
+        fclose(_index);
+    }
+
+
+    ContainerReader::ContainerReader(const std::string &directory)
+    {
+        static_assert(sizeof(IndexEntry) == 32, "IndexEntry must not be padded");
+
+        // Read in name order, so that entries written again later by a
+        // resumed job (to the same rank) replace the earlier ones
+        const std::string data_directory = directory + "data/";
+        std::vector<std::string> names;
+        DIR* dir = opendir(data_directory.c_str());
+        if (dir == nullptr){throw std::runtime_error("Could not open " + data_directory);}
+        for (struct dirent* ent = readdir(dir); ent != nullptr; ent = readdir(dir))
+        {
+            const std::string name = ent->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".idx") == 0)
+            {
+                names.push_back(name.substr(0, name.size() - 4));
+            }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        for (const std::string &name : names)
+        {
+            const std::string path = data_directory + name;
+            std::vector<char> buffer;
+            if (!checkpoint::read_file(path + ".idx", buffer))
+            {
+                throw std::runtime_error("Could not read " + path + ".idx");
+            }
+            if (buffer.size() < HEADER_SIZE){continue;}
+            checkpoint::Reader reader(buffer);
+            if (reader.read<uint32_t>() != MAGIC || reader.read<uint32_t>() != VERSION)
+            {
+                throw std::runtime_error(path + ".idx is not an hdspin container of this version");
+            }
+
+            const unsigned int data_index = _data_paths.size();
+            _data_paths.push_back(path + ".dat");
+            _ids.push_back(reader.read<uint64_t>());
+            const size_t n_entries = (buffer.size() - HEADER_SIZE) / sizeof(IndexEntry);
+            for (size_t ii=0; ii<n_entries; ii++)
+            {
+                const IndexEntry entry = reader.read<IndexEntry>();
+                _entries[std::make_pair(entry.tracer, entry.observable)] = std::make_pair(data_index, entry);
+            }
+        }
+    }
+
+    std::vector<unsigned int> ContainerReader::tracers() const
+    {
+        std::vector<unsigned int> result;
+        for (const auto &entry : _entries)
+        {
+            if (result.empty() || result.back() != entry.first.first)
+            {
+                result.push_back(entry.first.first);
+            }
+        }
+        return result;
+    }
+
+    bool ContainerReader::contains(const unsigned int tracer, const observable_t observable) const
+    {
+        return _entries.count(std::make_pair((uint32_t) tracer, (uint32_t) observable)) > 0;
+    }
+
+    IndexEntry ContainerReader::entry(const unsigned int tracer, const observable_t observable,
+        uint64_t &container_id) const
+    {
+        const auto it = _entries.find(std::make_pair((uint32_t) tracer, (uint32_t) observable));
+        if (it == _entries.end())
+        {
+            throw std::runtime_error("No output of tracer " + std::to_string(tracer));
+        }
+        container_id = _ids[it->second.first];
+        return it->second.second;
+    }
+
+    std::vector<double> ContainerReader::read(const unsigned int tracer, const observable_t observable) const
+    {
+        const auto it = _entries.find(std::make_pair((uint32_t) tracer, (uint32_t) observable));
+        if (it == _entries.end())
+        {
+            throw std::runtime_error("No output of tracer " + std::to_string(tracer));
+        }
+        const std::string &path = _data_paths[it->second.first];
+        const IndexEntry &entry = it->second.second;
+
+        std::vector<double> values(entry.n_rows * entry.n_columns);
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr){throw std::runtime_error("Could not open " + path);}
+        const bool ok = fseek(file, entry.offset, SEEK_SET) == 0
+            && fread(values.data(), sizeof(double), values.size(), file) == values.size();
+        fclose(file);
+        if (!ok){throw std::runtime_error("Truncated output container " + path);}
+        return values;
+    }
+
+    unsigned int export_text(const std::string &directory)
+    {
+        const ContainerReader reader(directory);
+        const std::vector<unsigned int> tracers = reader.tracers();
+        for (const unsigned int tracer : tracers)
+        {
+            const parameters::FileNames fnames = parameters::get_filenames(tracer, directory);
+            for (uint32_t oo=0; oo<N_OBSERVABLES; oo++)
+            {
+                const observable_t observable = (observable_t) oo;
+                if (!reader.contains(tracer, observable)){continue;}
+
+                const std::vector<double> values = reader.read(tracer, observable);
+                const std::string &path = text_path(fnames, observable);
+                FILE* file = fopen(path.c_str(), "w");
+                if (file == nullptr){throw std::runtime_error("Could not open " + path);}
+                const unsigned int n = n_columns(observable);
+                for (size_t ii=0; ii<values.size(); ii+=n)
+                {
+                    write_text_row(file, observable, &values[ii]);
+                }
+                fclose(file);
+            }
+        }
+        return tracers.size();
+    }
+
+}
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include "reduction.h"
+
+
+namespace reduction
+{
+
+    Accumulator::Accumulator(const unsigned int grid_length) : _grid_length(grid_length),
+        _sums(output::N_OBSERVABLES * grid_length * REDUCTION_N_SUMS, 0.0){}
+
+    // The cache size starts with the capacity
+    static unsigned int _first_row(const output::observable_t observable)
+    {
+        return observable == output::CACHE_SIZE ? 1 : 0;
+    }
+
+    bool Accumulator::complete(const output::observable_t observable, const std::vector<double> &values) const
+    {
+        return values.size() == (_first_row(observable) + _grid_length) * output::n_columns(observable);
+    }
+
+    void Accumulator::add(const unsigned int tracer, const output::observable_t observable,
+        const std::vector<double> &values)
+    {
+        const unsigned int first_row = _first_row(observable);
+        const unsigned int n = output::n_columns(observable);
+        if (!complete(observable, values))
+        {
+            throw std::runtime_error("Tracer " + std::to_string(tracer) + " has "
+                + std::to_string(values.size() / n) + " rows of " + output::name(observable));
+        }
+
+        // Without a cache (--landscape_mode=hashed) the capacity is zero,
+        // and there is no fraction to average
+        if (observable == output::CACHE_SIZE && values[0] == 0.0){return;}
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (unsigned int gg=0; gg<_grid_length; gg++)
+        {
+            const double *row = &values[(first_row + gg) * n];
+            double w = 1.0, x = row[0], y = 0.0;
+            if (observable == output::CACHE_SIZE){x = row[0] / values[0];}
+            else if (n == 3)
+            {
+                w = row[2];
+                y = row[1];
+            }
+
+            double *sums = _at(observable, gg);
+            sums[0] += 1.0;
+            sums[1] += w;
+            sums[2] += w * x;
+            sums[3] += w * x * x;
+            sums[4] += w * y;
+            sums[5] += w * y * y;
+        }
+    }
+
+    void Accumulator::append(const unsigned int tracer, const std::vector<const output::Stream*> &streams)
+    {
+        for (const output::Stream* stream : streams)
+        {
+            add(tracer, stream->get_observable(), stream->get_values());
+        }
+    }
+
+    void Accumulator::save(checkpoint::Writer &writer) const
+    {
+        writer.write(_grid_length);
+        writer.write_vector(_sums);
+    }
+
+    void Accumulator::load(checkpoint::Reader &reader)
+    {
+        reader.expect(_grid_length, "grid_size");
+        std::vector<double> sums;
+        reader.read_vector(sums);
+        if (sums.size() != _sums.size()){throw std::runtime_error("Saved sums do not match the observables");}
+        _sums = sums;
+    }
+
+    // The weighted mean and (population) variance
+    static void _moments(const double w, const double sum, const double sumsq,
+        double &mean, double &variance)
+    {
+        mean = sum / w;
+        variance = std::max(sumsq / w - mean * mean, 0.0);
+    }
+
+    void Accumulator::write_final(const std::string &directory, const std::vector<long long> &grid) const
+    {
+        if (grid.size() != _grid_length){throw std::runtime_error("The grid does not match the sums");}
+        const double nan = std::nan("");
+
+        system(("mkdir -p " + directory + "final").c_str());
+        for (uint32_t oo=0; oo<output::N_OBSERVABLES; oo++)
+        {
+            const output::observable_t observable = (output::observable_t) oo;
+
+            // Every tracer adds to every grid point of the observables it
+            // writes, which may be none of ridge_S
+            const bool ridge = output::n_columns(observable) == 3;
+            if (_at(observable, 0)[0] == 0.0){continue;}
+
+            const std::string path = directory + "final/" + output::name(observable) + ".txt";
+            FILE* file = fopen(path.c_str(), "w");
+            if (file == nullptr){throw std::runtime_error("Could not open " + path);}
+            for (unsigned int gg=0; gg<_grid_length; gg++)
+            {
+                const double *sums = _at(observable, gg);
+                const double w = sums[1];
+                double mean = nan, variance = nan, mean_y = nan, variance_y = nan;
+                if (w > 0.0)
+                {
+                    _moments(w, sums[2], sums[3], mean, variance);
+                    _moments(w, sums[4], sums[5], mean_y, variance_y);
+                }
+
+                // As postprocess.py: the grid, then the mean, the standard
+                // deviation and the standard error of the mean, of the ridge
+                // mean and median weighted by the number of ridges, or of
+                // the tracers. The spread of the medians is about their own
+                // mean, unlike postprocess.py
+                if (ridge)
+                {
+                    fprintf(file, "%.08e %.08e %.08e %.08e %.08e %.08e %.08e\n", (double) grid[gg],
+                        mean, sqrt(variance), sqrt(variance / w),
+                        mean_y, sqrt(variance_y), sqrt(variance_y / w));
+                }
+                else
+                {
+                    const double sem = w > 1.0 ? sqrt(variance / (w - 1.0)) : nan;
+                    fprintf(file, "%.08e %.08e %.08e %.08e\n", (double) grid[gg],
+                        mean, sqrt(variance), sem);
+                }
+            }
+            fclose(file);
+        }
+    }
+
+
+    std::string aggregate_path(const std::string &directory)
+    {
+        return directory + "final/aggregate.bin";
+    }
+
+    void save_aggregate(const std::string &path, const unsigned int grid_length,
+        const std::vector<AggregateBlock> &blocks)
+    {
+        checkpoint::Writer writer;
+        writer.write(MAGIC);
+        writer.write(VERSION);
+        writer.write(grid_length);
+        writer.write((uint32_t) blocks.size());
+        for (const AggregateBlock &block : blocks)
+        {
+            writer.write(block.index);
+            writer.write_vector(block.tracers);
+            writer.write_vector(block.fingerprints);
+            writer.write_vector(block.sums);
+        }
+        checkpoint::write_file_atomic(path, writer.release());
+    }
+
+    bool load_aggregate(const std::string &path, const unsigned int grid_length,
+        std::vector<AggregateBlock> &blocks)
+    {
+        std::vector<char> buffer;
+        if (!checkpoint::read_file(path, buffer)){return false;}
+        checkpoint::Reader reader(buffer);
+        if (reader.read<uint32_t>() != MAGIC || reader.read<uint32_t>() != VERSION)
+        {
+            throw std::runtime_error(path + " is not an hdspin aggregate of this version, see --full");
+        }
+        reader.expect(grid_length, "grid_size");
+        blocks.resize(reader.read<uint32_t>());
+        for (AggregateBlock &block : blocks)
+        {
+            block.index = reader.read<uint32_t>();
+            reader.read_vector(block.tracers);
+            reader.read_vector(block.fingerprints);
+            reader.read_vector(block.sums);
+            if (block.fingerprints.size() != block.tracers.size()
+                || block.sums.size() != output::N_OBSERVABLES * grid_length * REDUCTION_N_SUMS)
+            {
+                throw std::runtime_error(path + " is corrupt");
+            }
+        }
+        return true;
+    }
+
+    // The tracers with an energy file in data/, in increasing order
+    static std::vector<unsigned int> _text_tracers(const std::string &directory)
+    {
+        const std::string data_directory = directory + "data/";
+        const std::string suffix = "_energy.txt";
+        std::vector<unsigned int> tracers;
+        DIR* dir = opendir(data_directory.c_str());
+        if (dir == nullptr){throw std::runtime_error("Could not open " + data_directory);}
+        for (struct dirent* ent = readdir(dir); ent != nullptr; ent = readdir(dir))
+        {
+            const std::string name = ent->d_name;
+            if (name.size() <= suffix.size()
+                || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0){continue;}
+            const std::string index = name.substr(0, name.size() - suffix.size());
+            if (index.find_first_not_of("0123456789") != std::string::npos){continue;}
+            tracers.push_back(std::stoul(index));
+        }
+        closedir(dir);
+        std::sort(tracers.begin(), tracers.end());
+        return tracers;
+    }
+
+    // The values of a text file one after another
+    static bool _read_text(const std::string &path, std::vector<double> &values)
+    {
+        FILE* file = fopen(path.c_str(), "r");
+        if (file == nullptr){return false;}
+        double value;
+        while (fscanf(file, "%lf", &value) == 1){values.push_back(value);}
+        fclose(file);
+        return true;
+    }
+
+    // FNV-1a, continuing from hash
+    static uint64_t _hash(uint64_t hash, const void *data, const size_t n)
+    {
+        const unsigned char *bytes = (const unsigned char*) data;
+        for (size_t ii=0; ii<n; ii++)
+        {
+            hash ^= bytes[ii];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    // Identifies the output of a tracer as it is now, see update_directory.
+    // The same sources as _read_tracer
+    static uint64_t _fingerprint(const std::string &directory, const output::ContainerReader &containers,
+        const unsigned int tracer)
+    {
+        const parameters::FileNames fnames = parameters::get_filenames(tracer, directory);
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (uint32_t oo=0; oo<output::N_OBSERVABLES; oo++)
+        {
+            const output::observable_t observable = (output::observable_t) oo;
+            struct stat info;
+            if (containers.contains(tracer, observable))
+            {
+                // Rows written again go to a new entry, or a new container
+                uint64_t container_id;
+                const output::IndexEntry entry = containers.entry(tracer, observable, container_id);
+                const uint64_t location[3] = {container_id, entry.offset, entry.n_rows};
+                hash = _hash(hash, &oo, sizeof(oo));
+                hash = _hash(hash, location, sizeof(location));
+            }
+            else if (stat(output::text_path(fnames, observable).c_str(), &info) == 0)
+            {
+                const int64_t file[3] = {(int64_t) info.st_size, (int64_t) info.st_mtim.tv_sec,
+                    (int64_t) info.st_mtim.tv_nsec};
+                hash = _hash(hash, &oo, sizeof(oo));
+                hash = _hash(hash, file, sizeof(file));
+            }
+        }
+        return hash;
+    }
+
+    // The rows of every observable of a tracer, from the containers if
+    // there, otherwise from the text files. False unless the tracer has
+    // finished
+    static bool _read_tracer(const std::string &directory, const output::ContainerReader &containers,
+        const Accumulator &accumulator, const unsigned int tracer,
+        std::vector<std::pair<output::observable_t, std::vector<double>>> &rows)
+    {
+        const parameters::FileNames fnames = parameters::get_filenames(tracer, directory);
+        for (uint32_t oo=0; oo<output::N_OBSERVABLES; oo++)
+        {
+            const output::observable_t observable = (output::observable_t) oo;
+            std::vector<double> values;
+            if (containers.contains(tracer, observable)){values = containers.read(tracer, observable);}
+            else if (!_read_text(output::text_path(fnames, observable), values)){continue;}
+            if (!accumulator.complete(observable, values)){return false;}
+            rows.emplace_back(observable, std::move(values));
+        }
+        return !rows.empty();
+    }
+
+    // A finished tracer and its rows, see _read_tracer
+    struct _Tracer
+    {
+        unsigned int tracer;
+        uint64_t fingerprint;
+        std::vector<std::pair<output::observable_t, std::vector<double>>> rows;
+    };
+
+    // Adds tracers, in increasing order, to the sums of a block
+    static void _add_to_block(AggregateBlock &block, const unsigned int grid_length,
+        const std::vector<_Tracer> &tracers)
+    {
+        Accumulator accumulator(grid_length);
+        accumulator.get_sums().swap(block.sums);
+        for (const _Tracer &tracer : tracers)
+        {
+            for (const auto &row : tracer.rows){accumulator.add(tracer.tracer, row.first, row.second);}
+            block.tracers.push_back(tracer.tracer);
+            block.fingerprints.push_back(tracer.fingerprint);
+        }
+        accumulator.get_sums().swap(block.sums);
+    }
+
+    Update update_directory(const std::string &directory, const bool full)
+    {
+        std::vector<long long> grid;
+        grids::load_long_long_grid_(grid, directory + "grids/energy.txt");
+        if (grid.empty()){throw std::runtime_error("No energy grid in " + directory + "grids/");}
+        const unsigned int grid_length = grid.size();
+
+        // Every tracer with output, finished or not
+        const output::ContainerReader containers(directory);
+        std::vector<unsigned int> tracers = containers.tracers();
+        const std::vector<unsigned int> text_tracers = _text_tracers(directory);
+        tracers.insert(tracers.end(), text_tracers.begin(), text_tracers.end());
+        std::sort(tracers.begin(), tracers.end());
+        tracers.erase(std::unique(tracers.begin(), tracers.end()), tracers.end());
+
+        const std::string path = aggregate_path(directory);
+        std::vector<AggregateBlock> saved;
+        if (!full){load_aggregate(path, grid_length, saved);}
+
+        // The saved blocks and the blocks of the tracers, merged by index
+        Update update;
+        const Accumulator empty(grid_length);
+        std::vector<AggregateBlock> blocks;
+        size_t ss = 0, tt = 0;
+        while (ss < saved.size() || tt < tracers.size())
+        {
+            uint32_t index = tt < tracers.size() ? tracers[tt] / AGGREGATE_BLOCK_SIZE : UINT32_MAX;
+            if (ss < saved.size()){index = std::min(index, saved[ss].index);}
+            AggregateBlock block;
+            block.index = index;
+            block.sums = empty.get_sums();
+            const bool was_saved = ss < saved.size() && saved[ss].index == index;
+            if (was_saved){block = std::move(saved[ss++]);}
+            bool rebuild = !was_saved;
+            std::vector<unsigned int> members;
+            while (tt < tracers.size() && tracers[tt] / AGGREGATE_BLOCK_SIZE == index)
+            {
+                members.push_back(tracers[tt++]);
+            }
+
+            // Tracers of the block gone or changed
+            for (size_t ii=0; ii<block.tracers.size() && !rebuild; ii++)
+            {
+                rebuild = !std::binary_search(members.begin(), members.end(), block.tracers[ii])
+                    || _fingerprint(directory, containers, block.tracers[ii]) != block.fingerprints[ii];
+            }
+
+            // The finished tracers not in the block, or all of them if it
+            // is summed again
+            std::vector<_Tracer> finished;
+            for (const unsigned int tracer : members)
+            {
+                if (!rebuild && std::binary_search(block.tracers.begin(), block.tracers.end(), tracer)){continue;}
+                _Tracer read = {tracer, _fingerprint(directory, containers, tracer), {}};
+                if (!_read_tracer(directory, containers, empty, tracer, read.rows)){continue;}
+
+                // Adding it now would not be the order of a rebuild
+                if (!rebuild && !block.tracers.empty() && tracer < block.tracers.back())
+                {
+                    rebuild = true;
+                    finished.clear();
+                    for (const unsigned int member : members)
+                    {
+                        if (member >= tracer){break;}
+                        _Tracer earlier = {member, _fingerprint(directory, containers, member), {}};
+                        if (!_read_tracer(directory, containers, empty, member, earlier.rows)){continue;}
+                        finished.push_back(std::move(earlier));
+                    }
+                }
+                finished.push_back(std::move(read));
+            }
+
+            if (rebuild)
+            {
+                block.tracers.clear();
+                block.fingerprints.clear();
+                block.sums = empty.get_sums();
+                update.n_rebuilt += was_saved;
+            }
+            _add_to_block(block, grid_length, finished);
+            update.n_read += finished.size();
+            if (!block.tracers.empty())
+            {
+                update.n_tracers += block.tracers.size();
+                blocks.push_back(std::move(block));
+            }
+        }
+
+        // Always added in the same order, from zero
+        update.n_blocks = blocks.size();
+        if (blocks.empty()){return update;}
+        Accumulator accumulator(grid_length);
+        std::vector<double> &sums = accumulator.get_sums();
+        for (const AggregateBlock &block : blocks)
+        {
+            for (size_t ii=0; ii<sums.size(); ii++){sums[ii] += block.sums[ii];}
+        }
+        accumulator.write_final(directory, grid);
+        save_aggregate(path, grid_length, blocks);
+        return update;
+    }
+
+}
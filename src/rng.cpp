@@ -0,0 +1,81 @@
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+#include "rng.h"
+
+
+namespace rng
+{
+
+    kind_t kind_from_string(const std::string &name)
+    {
+        if (name == "mt19937"){return MT19937;}
+        else if (name == "xoshiro256pp"){return XOSHIRO256PP;}
+        else if (name == "pcg64"){return PCG64;}
+        else if (name == "philox"){return PHILOX;}
+        throw std::runtime_error("Unknown rng " + name);
+    }
+
+    uint64_t random_seed()
+    {
+        std::random_device device;
+        const uint64_t hi = device();
+        const uint64_t lo = device();
+        return (hi << 32) | lo;
+    }
+
+    namespace ziggurat
+    {
+        double normal_x[LAYERS + 1];
+        double normal_f[LAYERS + 1];
+        double normal_ratio[LAYERS];
+        double exponential_x[LAYERS + 1];
+        double exponential_f[LAYERS + 1];
+        double exponential_ratio[LAYERS];
+
+        // Area of each layer, which together with the start of the tail
+        // determines every other edge
+        static constexpr double NORMAL_V = 4.928673233990e-3;
+        static constexpr double EXPONENTIAL_V = 3.9496598225815571993e-3;
+
+        // Builds the layers top down from the tail: the layer above x_i has
+        // the same area V as every other, which fixes x_{i+1} through the
+        // inverse of the density
+        static bool _build_tables()
+        {
+            normal_x[0] = NORMAL_V / exp(-0.5 * NORMAL_R * NORMAL_R);
+            normal_x[1] = NORMAL_R;
+            for (unsigned int ii=2; ii<LAYERS; ii++)
+            {
+                const double x = normal_x[ii - 1];
+                normal_x[ii] = sqrt(-2.0 * log(NORMAL_V / x + exp(-0.5 * x * x)));
+            }
+            normal_x[LAYERS] = 0.0;
+
+            exponential_x[0] = EXPONENTIAL_V / exp(-EXPONENTIAL_R);
+            exponential_x[1] = EXPONENTIAL_R;
+            for (unsigned int ii=2; ii<LAYERS; ii++)
+            {
+                const double x = exponential_x[ii - 1];
+                exponential_x[ii] = -log(EXPONENTIAL_V / x + exp(-x));
+            }
+            exponential_x[LAYERS] = 0.0;
+
+            for (unsigned int ii=0; ii<=LAYERS; ii++)
+            {
+                normal_f[ii] = exp(-0.5 * normal_x[ii] * normal_x[ii]);
+                exponential_f[ii] = exp(-exponential_x[ii]);
+            }
+            for (unsigned int ii=0; ii<LAYERS; ii++)
+            {
+                normal_ratio[ii] = normal_x[ii + 1] / normal_x[ii];
+                exponential_ratio[ii] = exponential_x[ii + 1] / exponential_x[ii];
+            }
+            return true;
+        }
+
+        static const bool _tables_built = _build_tables();
+    }
+
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "scheduler.h"
+
+
+namespace scheduler
+{
+
+    // The tag of claims, and of their answers, on the scheduler's own
+    // communicator
+    static const int CLAIM_TAG = 1;
+
+    mode_t from_string(const std::string &name)
+    {
+        if (name == "static"){return STATIC;}
+        else if (name == "dynamic"){return DYNAMIC;}
+        throw std::runtime_error("Unknown scheduler " + name);
+    }
+
+    std::vector<unsigned int> static_items(const unsigned int n_items,
+        const int rank, const int world_size)
+    {
+        std::vector<unsigned int> items;
+        for (unsigned int item=rank; item<n_items; item+=world_size){items.push_back(item);}
+        return items;
+    }
+
+    TracerScheduler::TracerScheduler(const mode_t mode,
+        const unsigned int n_tracers, const unsigned int tracers_per_item,
+        MPI_Comm comm) : _mode(mode), _n_tracers(n_tracers),
+        _tracers_per_item(std::max(tracers_per_item, 1u))
+    {
+        _n_items = (_n_tracers + _tracers_per_item - 1) / _tracers_per_item;
+
+        MPI_Comm_rank(comm, &_rank);
+        MPI_Comm_size(comm, &_world_size);
+
+        if (_mode == STATIC)
+        {
+            _items = static_items(_n_items, _rank, _world_size);
+            return;
+        }
+
+        // Claims do not mix with other messages of the job
+        if (_world_size == 1){return;}
+        MPI_Comm_dup(comm, &_comm);
+        if (_rank == 0){_dispatcher = std::thread(&TracerScheduler::_dispatch, this);}
+    }
+
+    long long TracerScheduler::_claim_local()
+    {
+        // Stops counting once past the end, so that it cannot overflow
+        const long long claimed = _counter;
+        if (_counter < (long long) _n_items){_counter++;}
+        return claimed;
+    }
+
+    void TracerScheduler::_dispatch()
+    {
+        // Polls rather than blocks in MPI_Recv, which spins in many MPI
+        // libraries and would take a core from the workers
+        int n_exhausted = 0;
+        while (n_exhausted < _world_size - 1)
+        {
+            int flag;
+            MPI_Status status;
+            MPI_Iprobe(MPI_ANY_SOURCE, CLAIM_TAG, _comm, &flag, &status);
+            if (!flag)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            int request;
+            MPI_Recv(&request, 1, MPI_INT, status.MPI_SOURCE, CLAIM_TAG, _comm, MPI_STATUS_IGNORE);
+            long long claimed;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                claimed = _claim_local();
+            }
+            MPI_Send(&claimed, 1, MPI_LONG_LONG, status.MPI_SOURCE, CLAIM_TAG, _comm);
+            if (claimed >= (long long) _n_items){n_exhausted++;}
+        }
+    }
+
+    bool TracerScheduler::next(unsigned int &first, unsigned int &last)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        unsigned int item;
+        if (_mode == STATIC)
+        {
+            if (_next_item >= _items.size()){return false;}
+            item = _items[_next_item++];
+        }
+        else
+        {
+            long long claimed;
+            if (_rank == 0){claimed = _claim_local();}
+            else if (_exhausted){return false;}
+            else
+            {
+                const int request = 0;
+                MPI_Send(&request, 1, MPI_INT, 0, CLAIM_TAG, _comm);
+                MPI_Recv(&claimed, 1, MPI_LONG_LONG, 0, CLAIM_TAG, _comm, MPI_STATUS_IGNORE);
+            }
+            if (claimed >= (long long) _n_items)
+            {
+                _exhausted = true;
+                return false;
+            }
+            item = (unsigned int) claimed;
+        }
+
+        first = item * _tracers_per_item;
+        last = std::min(first + _tracers_per_item, _n_tracers);
+        return true;
+    }
+
+    TracerScheduler::~TracerScheduler()
+    {
+        if (_dispatcher.joinable()){_dispatcher.join();}
+        if (_comm != MPI_COMM_NULL){MPI_Comm_free(&_comm);}
+    }
+
+}
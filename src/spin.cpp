@@ -1,104 +1,167 @@
 #include <unistd.h>
+#include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <new>
 #include <random>
+#include <type_traits>
 
 #include "utils.h"
 #include "spin.h"
+#include "exit_rates.h"
 
 
-void SpinSystem::_first_time_state_initialization_()
+namespace dynamics
 {
-    if (params.use_manual_seed == true)
+    id_t from_string(const std::string &dynamics)
     {
-        generator.seed(params.seed);
-    }
-    else
-    {
-        const unsigned int seed = std::random_device{}();  
-        generator.seed(seed);
+        if (dynamics == "standard"){return STANDARD;}
+        else if (dynamics == "gillespie"){return GILLESPIE;}
+        else if (dynamics == "standard-accelerated"){return STANDARD_ACCELERATED;}
+        else if (dynamics == "standard-adaptive"){return STANDARD_ADAPTIVE;}
+        throw std::runtime_error("Uknown dynamics " + dynamics);
     }
+}
+
+
+template<unsigned int Words>
+void SpinSystem<Words>::_first_time_state_initialization_()
+{
+    const uint64_t seed = params.use_manual_seed ? params.seed : rng::random_seed();
+    generator.seed(rng::kind_from_string(params.rng), seed,
+        rng::stream_id(params.tracer_index, rng::DYNAMICS_STREAM));
 
     unsigned int* spin_config = 0;
     spin_config = new unsigned int [params.N_spins];
 
-    std::bernoulli_distribution _bernoulli_distribution;
-
     for (unsigned int ii=0; ii<params.N_spins; ii++)
     {
-        spin_config[ii] = _bernoulli_distribution(generator);
+        spin_config[ii] = generator.bit();
     }
 
-    state::arbitrary_precision_integer_from_int_array_(spin_config, params.N_spins, current_state);
+    state::spin_state_from_int_array_(spin_config, params.N_spins, current_state);
 
     delete[] spin_config;
 
-    if (params.dynamics == "standard"){_init_standard();}
-    else if (params.dynamics == "gillespie"){_init_gillespie();}
+    _dynamics = dynamics::from_string(params.dynamics);
+    if (_dynamics == dynamics::STANDARD){_init_standard();}
+    else if (_dynamics == dynamics::GILLESPIE){_init_gillespie();}
     else
     {
-        throw std::runtime_error("Uknown dynamics during setup");
+        _init_standard();
+        _init_gillespie();
+    }
+    _adaptive_window_start = std::chrono::high_resolution_clock::now();
+
+    if (params.landscape == "EREM"){_landscape_is_erem = true;}
+    else if (params.landscape == "GREM"){_landscape_is_erem = false;}
+    else
+    {
+        throw std::runtime_error("Invalid landscape " + params.landscape);
+    }
+
+    if (params.step_timing == "all"){_step_timing_stride = 1;}
+    else if (params.step_timing == "sampled"){_step_timing_stride = STEP_TIMING_SAMPLE_STRIDE;}
+    else if (params.step_timing == "off"){_step_timing_stride = 0;}
+    else
+    {
+        throw std::runtime_error("Invalid step_timing " + params.step_timing);
     }
 
 }
 
-void SpinSystem::_init_previous_state_()
+template<unsigned int Words>
+template<typename Landscape>
+void SpinSystem<Words>::_init_previous_state_()
 {
     _prev.state = current_state;
-    _prev.energy = energy();
+    _prev.energy = emap_ptr->template get_config_energy<Landscape>(current_state);
 }
 
-void SpinSystem::_init_current_state_()
+template<unsigned int Words>
+template<typename Landscape>
+void SpinSystem<Words>::_init_current_state_()
 {
     _curr.state = current_state;
-    _curr.energy = energy();
+    _curr.energy = emap_ptr->template get_config_energy<Landscape>(current_state);
 }
 
-SpinSystem::SpinSystem(const parameters::SimulationParameters params,
-    EnergyMapping& emap) : params(params)
+template<unsigned int Words>
+SpinSystem<Words>::SpinSystem(const parameters::SimulationParameters params,
+    EnergyMapping<Words>& emap) : params(params)
 {
     emap_ptr = &emap;
     _first_time_state_initialization_();
 };
 
-double SpinSystem::energy() const
+template<unsigned int Words>
+double SpinSystem<Words>::energy() const
 {
     return emap_ptr->get_config_energy(current_state);
 }
 
-void SpinSystem::set_state(ap_uint<PRECISON> state)
+template<unsigned int Words>
+void SpinSystem<Words>::set_state(const state_t &state)
 {
     current_state = state;
 }
 
-std::string SpinSystem::binary_state() const
+template<unsigned int Words>
+std::string SpinSystem<Words>::binary_state() const
 {
-    return state::string_rep_from_arbitrary_precision_integer(current_state, params.N_spins);
+    return state::string_rep_from_spin_state(current_state, params.N_spins);
 }
 
 
-void SpinSystem::_init_gillespie()
+// Allocates an array of n doubles aligned to a cache line, to be released
+// with free
+static double* _aligned_double_array(const size_t n)
+{
+    const size_t bytes = ((n * sizeof(double) + 63) / 64) * 64;
+    double* ptr = static_cast<double*>(std::aligned_alloc(64, bytes));
+    if (ptr == 0){throw std::bad_alloc();}
+    return ptr;
+}
+
+template<unsigned int Words>
+void SpinSystem<Words>::_init_gillespie()
 {
+    // The reference kernel is the original discrete_distribution sampler,
+    // kept selectable for regression checks against the default one. The
+    // two make identical draws with mt19937; with the other engines they
+    // only agree in distribution.
+    if (params.gillespie_kernel == "reference"){_use_reference_gillespie = true;}
+    else if (params.gillespie_kernel == "vectorized"){_use_vectorized_exit_rates = true;}
+    else if (params.gillespie_kernel != "linear")
+    {
+        throw std::runtime_error("Unknown gillespie_kernel");
+    }
+
     // Initialize the other pointers to gillespie-only required arrays
-    _exit_rates = new double[params.N_spins];
-    _neighbors = new ap_uint<PRECISON>[params.N_spins];
-    _neighboring_energies = new double[params.N_spins];
+    _exit_rates = _aligned_double_array(params.N_spins);
+    _cumulative_exit_rates = _aligned_double_array(params.N_spins);
+    _neighbors = new state_t[params.N_spins];
+    _neighboring_energies = _aligned_double_array(params.N_spins);
 
     // Initialize the normalized exit rate object
-    for (int ii=0; ii<params.N_spins; ii++)
+    if (_use_reference_gillespie)
     {
-        _normalized_exit_rates.push_back(0.0);
+        _normalized_exit_rates.assign(params.N_spins, 0.0);
     }
 }
 
-void SpinSystem::_teardown_gillespie()
+template<unsigned int Words>
+void SpinSystem<Words>::_teardown_gillespie()
 {
-    delete[] _exit_rates;
+    free(_exit_rates);
+    free(_cumulative_exit_rates);
     delete[] _neighbors;
-    delete[] _neighboring_energies;
+    free(_neighboring_energies);
 }
 
 
-double SpinSystem::_calculate_exit_rates(const double current_energy) const
+template<unsigned int Words>
+double SpinSystem<Words>::_calculate_exit_rates(const double current_energy) const
 {
     double dE;
     for (int ii=0; ii<params.N_spins; ii++)
@@ -121,11 +184,60 @@ double SpinSystem::_calculate_exit_rates(const double current_energy) const
     return total_exit_rate;
 }
 
-double SpinSystem::_step_gillespie()
+template<unsigned int Words>
+double SpinSystem<Words>::_calculate_cumulative_exit_rates(const double current_energy) const
 {
+    double total_exit_rate = 0.0;
+    if (_use_vectorized_exit_rates)
+    {
+        exit_rates::metropolis_rates(_neighboring_energies, current_energy,
+            params.beta, params.N_spins, _exit_rates);
+        for (unsigned int ii=0; ii<params.N_spins; ii++)
+        {
+            total_exit_rate += _exit_rates[ii];
+            _cumulative_exit_rates[ii] = total_exit_rate;
+        }
+        return total_exit_rate;
+    }
+
+    // Same operations in the same order as _calculate_exit_rates, so the
+    // total exit rate (and hence the waiting time) is bit-identical to it
+    const double N = (double) params.N_spins;
+    for (unsigned int ii=0; ii<params.N_spins; ii++)
+    {
+        const double dE = _neighboring_energies[ii] - current_energy;
+        double rate = exp(-params.beta * dE);
+        if (rate > 1.0){rate = 1.0;}
+        total_exit_rate += rate / N;
+        _cumulative_exit_rates[ii] = total_exit_rate;
+    }
+    return total_exit_rate;
+}
+
+template<unsigned int Words>
+unsigned int SpinSystem<Words>::_select_spin_to_flip(const double u,
+    const double total_exit_rate) const
+{
+    // The first neighbor whose cumulative rate reaches u * total, as
+    // std::discrete_distribution does with its normalized cumulative
+    // probabilities. The last neighbor catches any rounding in the sum.
+    const double target = u * total_exit_rate;
+    const unsigned int last = params.N_spins - 1;
+    for (unsigned int ii=0; ii<last; ii++)
+    {
+        if (_cumulative_exit_rates[ii] >= target){return ii;}
+    }
+    return last;
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+double SpinSystem<Words>::_step_gillespie()
+{
+    if (_use_reference_gillespie){return _step_gillespie_reference<Landscape>();}
 
     // Initialize the current state as _prev
-    _init_previous_state_();
+    _init_previous_state_<Landscape>();
 
     // Get the current energy of the state
     const double current_energy = _prev.energy;
@@ -134,7 +246,47 @@ double SpinSystem::_step_gillespie()
     state::get_neighbors_(_neighbors, current_state, params.N_spins);
 
     // Populate the neighboring energies
-    emap_ptr->get_config_energies_array_(_neighbors, _neighboring_energies, params.N_spins);
+    emap_ptr->template get_config_energies_array_<Landscape>(_neighbors, _neighboring_energies, params.N_spins);
+
+    const double total_exit_rate = _calculate_cumulative_exit_rates(current_energy);
+
+    // With mt19937 this draws the uniform exactly as
+    // std::discrete_distribution does, so that both kernels consume the
+    // generator identically
+    const double u = generator.uniform();
+
+    // The spin to flip is actually on the "opposite side" because of how
+    // bits work
+    const unsigned int spin_to_flip = _select_spin_to_flip(u, total_exit_rate);
+
+    // And always flip that spin in a Gillespie simulation
+    current_state = state::flip_bit(current_state, spin_to_flip, params.N_spins);
+
+    // Initialize the current state
+    _init_current_state_<Landscape>();
+
+    // Return the waiting time which is generally != 1, exponentially
+    // distributed with the total exit rate
+    sim_stats.acceptances += 1;  // Gillespie always accepts! =)
+    return generator.exponential() / total_exit_rate;
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+double SpinSystem<Words>::_step_gillespie_reference()
+{
+
+    // Initialize the current state as _prev
+    _init_previous_state_<Landscape>();
+
+    // Get the current energy of the state
+    const double current_energy = _prev.energy;
+
+    // Get the neighboring states
+    state::get_neighbors_(_neighbors, current_state, params.N_spins);
+
+    // Populate the neighboring energies
+    emap_ptr->template get_config_energies_array_<Landscape>(_neighbors, _neighboring_energies, params.N_spins);
 
     const double total_exit_rate = _calculate_exit_rates(current_energy);
 
@@ -149,49 +301,44 @@ double SpinSystem::_step_gillespie()
 
     // The spin to flip is actually on the "opposite side" because of how
     // bits work
-    const unsigned int spin_to_flip = _dist(generator);
+    const unsigned int spin_to_flip = generator.visit(
+        [&_dist](auto &engine){return _dist(engine);});
 
     // And always flip that spin in a Gillespie simulation
     current_state = state::flip_bit(current_state, spin_to_flip, params.N_spins);
 
     // Initialize the current state
-    _init_current_state_();
-
-    // Calculate the waiting time
-    total_exit_rate_dist.param(
-        std::exponential_distribution<double>::param_type(total_exit_rate));
+    _init_current_state_<Landscape>();
 
-    // Return the waiting time which is generally != 1
+    // Return the waiting time which is generally != 1, exponentially
+    // distributed with the total exit rate
     sim_stats.acceptances += 1;  // Gillespie always accepts! =)
-    return total_exit_rate_dist(generator);
+    return generator.exponential() / total_exit_rate;
 }
 
 
-void SpinSystem::_init_standard()
-{
-    uniform_0_1_distribution.param(
-        std::uniform_real_distribution<>::param_type(0.0, 1.0));
-    spin_distribution.param(
-        std::uniform_int_distribution<>::param_type(0, params.N_spins - 1));
-}
+template<unsigned int Words>
+void SpinSystem<Words>::_init_standard(){;}
 
-double SpinSystem::_step_standard()
+template<unsigned int Words>
+template<typename Landscape>
+double SpinSystem<Words>::_step_standard()
 {
 
     // Initialize the current state as _prev
-    _init_previous_state_();
+    _init_previous_state_<Landscape>();
 
     // Get the current energy of the state
     const double current_energy = _prev.energy;
 
     // Select a random spin to flip
-    const unsigned int bit_to_flip = spin_distribution(generator);
+    const unsigned int bit_to_flip = generator.uniform_int(params.N_spins);
 
     // Flip the current state into its new one
-    const ap_uint<PRECISON> possible_state = state::flip_bit(current_state, bit_to_flip, params.N_spins);
+    const state_t possible_state = state::flip_bit(current_state, bit_to_flip, params.N_spins);
 
     // Get the proposed energy (energy of the new configuration)
-    const double proposed_energy = emap_ptr->get_config_energy(possible_state);
+    const double proposed_energy = emap_ptr->template get_config_energy<Landscape>(possible_state);
 
     // Compute the difference between the energies, and find the metropolis
     // selection criterion
@@ -199,7 +346,7 @@ double SpinSystem::_step_standard()
     const double metropolis_prob = exp(-params.beta * dE);
 
     // Sample a random number between 0 and 1
-    const double sampled = uniform_0_1_distribution(generator);
+    const double sampled = generator.uniform();
 
     // Determine whether or not to remain in this configuration or
     // to flip back. If the randomly sampled value is less than the
@@ -219,47 +366,319 @@ double SpinSystem::_step_standard()
         sim_stats.rejections += 1;
     }
 
-    _init_current_state_();
+    _init_current_state_<Landscape>();
 
     return 1.0;
 }
 
-void SpinSystem::_teardown_standard(){;}
+template<unsigned int Words>
+template<typename Landscape>
+double SpinSystem<Words>::_step_standard_accelerated()
+{
+    // Statistically identical to _step_standard, but instead of proposing
+    // and rejecting one spin at a time, the number of rejected proposals
+    // before the next accepted one is drawn from its geometric distribution.
+    // A call either returns that run of rejections at once (waiting time
+    // equal to their number, state unchanged), or the accepted move, chosen
+    // with probability proportional to its Metropolis acceptance probability
+    // (waiting time 1).
+
+    // Initialize the current state as _prev
+    _init_previous_state_<Landscape>();
 
+    if (!_accepted_move_pending)
+    {
+        // Get the neighboring states and their energies
+        state::get_neighbors_(_neighbors, current_state, params.N_spins);
+        emap_ptr->template get_config_energies_array_<Landscape>(_neighbors, _neighboring_energies, params.N_spins);
+
+        // The mean of the min(1, exp(-beta dE)) over all neighbors is the
+        // probability that a single standard step is accepted
+        _acceptance_probability = _calculate_cumulative_exit_rates(_prev.energy);
+
+        // Never run past the step at which the standard dynamics would stop.
+        // The geometric distribution is memoryless, so truncating it there
+        // is exact. Otherwise cap at 2^53, beyond which the clock can no
+        // longer count single steps.
+        const double remaining = (double) (params.N_timesteps + 1) - (double) sim_stats.total_steps;
+        const double max_rejections = remaining > 0.0 ? remaining : 9007199254740992.0;
+
+        double n_rejections = 0.0;
+        if (_acceptance_probability <= 0.0){n_rejections = max_rejections;}
+        else if (_acceptance_probability < 1.0)
+        {
+            const double u = 1.0 - generator.uniform();
+            n_rejections = floor(log(u) / log1p(-_acceptance_probability));
+        }
+        if (n_rejections > max_rejections){n_rejections = max_rejections;}
+
+        if (n_rejections > 0.0)
+        {
+            sim_stats.rejections += (unsigned long long) n_rejections;
+            _accepted_move_pending = true;
+            _init_current_state_<Landscape>();
+            return n_rejections;
+        }
+    }
 
-void SpinSystem::summarize()
+    const double u = generator.uniform();
+    const unsigned int spin_to_flip = _select_spin_to_flip(u, _acceptance_probability);
+    current_state = state::flip_bit(current_state, spin_to_flip, params.N_spins);
+    sim_stats.acceptances += 1;
+    _accepted_move_pending = false;
+
+    _init_current_state_<Landscape>();
+
+    return 1.0;
+}
+
+template<unsigned int Words>
+template<typename Landscape>
+double SpinSystem<Words>::_step_standard_adaptive()
+{
+    if (_adaptive_rejection_free){return _step_standard_accelerated<Landscape>();}
+    return _step_standard<Landscape>();
+}
+
+template<unsigned int Words>
+void SpinSystem<Words>::_adapt_dynamics()
+{
+    _adaptive_window_calls += 1;
+
+    // Only switch between whole rejection-free visits: handing over to the
+    // standard step while an accepted move is pending would drop it and
+    // bias the number of rejections
+    if (_adaptive_window_calls < ADAPTIVE_WINDOW_CALLS){return;}
+    if (_accepted_move_pending){return;}
+
+    // The wall time of the whole window, which also covers whatever the
+    // caller does between steps, such as stepping the observables
+    const double wall_time = time_utils::get_time_delta(_adaptive_window_start);
+    const double steps = (double) (sim_stats.total_steps - _adaptive_window_start_steps);
+    const double acceptances = (double) (sim_stats.acceptances - _adaptive_window_start_acceptances);
+    const double acceptance_rate = acceptances / steps;
+
+    // Cost per unit of simulated time, i.e. per standard step, of the step
+    // in use (measured) and of the other one (predicted). A rejection-free
+    // visit costs about N standard steps until it has been measured, and
+    // there is one visit per accepted step.
+    const double cost = wall_time / steps;
+    double other_cost;
+    if (_adaptive_rejection_free)
+    {
+        if (acceptances > 0.0)
+        {
+            _cost_per_rejection_free_visit = wall_time / acceptances;
+        }
+        other_cost = _cost_per_standard_step > 0.0 ? _cost_per_standard_step
+            : _cost_per_rejection_free_visit / params.N_spins;
+    }
+    else
+    {
+        _cost_per_standard_step = cost;
+        const double cost_per_visit = _cost_per_rejection_free_visit > 0.0
+            ? _cost_per_rejection_free_visit : cost * params.N_spins;
+        other_cost = cost_per_visit * acceptance_rate;
+    }
+
+    // Some hysteresis, so that timing noise does not cause flip-flopping
+    if (other_cost < ADAPTIVE_SWITCH_RATIO * cost)
+    {
+        _adaptive_rejection_free = !_adaptive_rejection_free;
+        _n_dynamics_switches += 1;
+    }
+
+    _adaptive_window_calls = 0;
+    _adaptive_window_start = std::chrono::high_resolution_clock::now();
+    _adaptive_window_start_steps = sim_stats.total_steps;
+    _adaptive_window_start_acceptances = sim_stats.acceptances;
+}
+
+template<unsigned int Words>
+void SpinSystem<Words>::_teardown_standard(){;}
+
+
+template<unsigned int Words>
+void SpinSystem<Words>::summarize()
 {
     printf("Acceptances/rejections: %lli/%lli\n", sim_stats.acceptances, sim_stats.rejections);
+    if (_dynamics == dynamics::STANDARD_ADAPTIVE)
+    {
+        printf("Switches between standard and rejection-free steps: %lli\n", _n_dynamics_switches);
+    }
 }
 
-double SpinSystem::step()
+template<unsigned int Words>
+template<typename Dynamics, typename Landscape>
+double SpinSystem<Words>::step_with()
 {
-    auto t_start = std::chrono::high_resolution_clock::now();    
+    std::chrono::time_point<std::chrono::high_resolution_clock> t_start;
+    const bool timed = _sample_step_timing();
+    if (timed){t_start = std::chrono::high_resolution_clock::now();}
+
+    // Resolved at compile time, so each instantiation is a single branch
+    // free step. For the rejection-free steps every unit of waiting time is
+    // one standard step.
     double waiting_time;
-    if (params.dynamics == "standard")
+    if constexpr (std::is_same<Dynamics, dynamics::Standard>::value)
+    {
+        waiting_time = _step_standard<Landscape>();
+        sim_stats.total_steps += 1;
+    }
+    else if constexpr (std::is_same<Dynamics, dynamics::Gillespie>::value)
     {
-        waiting_time = _step_standard();
+        waiting_time = _step_gillespie<Landscape>();
+        sim_stats.total_steps += 1;
     }
-    else if (params.dynamics == "gillespie")
+    else if constexpr (std::is_same<Dynamics, dynamics::StandardAccelerated>::value)
     {
-        waiting_time = _step_gillespie();
+        waiting_time = _step_standard_accelerated<Landscape>();
+        sim_stats.total_steps += (unsigned long long) waiting_time;
     }
     else
     {
-        throw std::runtime_error("Uknown dynamics during step");
+        static_assert(std::is_same<Dynamics, dynamics::StandardAdaptive>::value,
+            "Unknown dynamics policy");
+        waiting_time = _step_standard_adaptive<Landscape>();
+        sim_stats.total_steps += (unsigned long long) waiting_time;
+        _adapt_dynamics();
+    }
+
+    // A sampled step stands for the _step_timing_stride steps around it
+    if (timed)
+    {
+        sim_stats.total_wall_time += time_utils::get_time_delta(t_start) * _step_timing_stride;
     }
-    const double duration = time_utils::get_time_delta(t_start);
-    sim_stats.total_wall_time += duration;
     sim_stats.total_waiting_time += waiting_time;
-    sim_stats.total_steps += 1;
     return waiting_time;
 }
 
-SpinSystem::~SpinSystem()
+template<unsigned int Words>
+template<typename Landscape>
+double SpinSystem<Words>::_step_with_dynamics()
 {
-    if (params.dynamics == "standard"){_teardown_standard();}
-    else if (params.dynamics == "gillespie"){_teardown_gillespie();}
+    switch (_dynamics)
+    {
+        case dynamics::STANDARD: return step_with<dynamics::Standard, Landscape>();
+        case dynamics::GILLESPIE: return step_with<dynamics::Gillespie, Landscape>();
+        case dynamics::STANDARD_ACCELERATED: return step_with<dynamics::StandardAccelerated, Landscape>();
+        case dynamics::STANDARD_ADAPTIVE: return step_with<dynamics::StandardAdaptive, Landscape>();
+    }
+    throw std::runtime_error("Uknown dynamics during step");
+}
+
+template<unsigned int Words>
+double SpinSystem<Words>::step()
+{
+    if (_landscape_is_erem){return _step_with_dynamics<landscape::EREM>();}
+    return _step_with_dynamics<landscape::GREM>();
+}
+
+template<unsigned int Words>
+void SpinSystem<Words>::record_step(const parameters::StateProperties<Words> &prev,
+    const parameters::StateProperties<Words> &curr, const bool accepted,
+    const double wall_time)
+{
+    _prev = prev;
+    _curr = curr;
+    current_state = curr.state;
+    if (accepted){sim_stats.acceptances += 1;}
+    else{sim_stats.rejections += 1;}
+    sim_stats.total_steps += 1;
+    sim_stats.total_waiting_time += 1.0;
+    sim_stats.total_wall_time += wall_time;
+}
+
+template<unsigned int Words>
+void SpinSystem<Words>::save(checkpoint::Writer &writer) const
+{
+    writer.write(params.N_spins);
+    writer.write(_dynamics);
+    writer.write(current_state);
+    writer.write(_prev);
+    writer.write(_curr);
+    writer.write(sim_stats);
+    writer.write(_step_timing_countdown);
+    generator.save(writer);
+
+    if (_dynamics == dynamics::STANDARD_ACCELERATED || _dynamics == dynamics::STANDARD_ADAPTIVE)
+    {
+        // A pending accepted move is drawn from the cumulative exit rates
+        // computed before the run of rejections
+        writer.write(_acceptance_probability);
+        writer.write(_accepted_move_pending);
+        writer.write_bytes(_cumulative_exit_rates, params.N_spins * sizeof(double));
+
+        writer.write(_adaptive_rejection_free);
+        writer.write(_adaptive_window_calls);
+        writer.write(_adaptive_window_start_steps);
+        writer.write(_adaptive_window_start_acceptances);
+        writer.write(_cost_per_standard_step);
+        writer.write(_cost_per_rejection_free_visit);
+        writer.write(_n_dynamics_switches);
+    }
+}
+
+template<unsigned int Words>
+void SpinSystem<Words>::load(checkpoint::Reader &reader)
+{
+    reader.expect(params.N_spins, "N_spins");
+    reader.expect(_dynamics, "dynamics");
+    reader.read(current_state);
+    reader.read(_prev);
+    reader.read(_curr);
+    reader.read(sim_stats);
+    reader.read(_step_timing_countdown);
+    generator.load(reader);
+
+    if (_dynamics == dynamics::STANDARD_ACCELERATED || _dynamics == dynamics::STANDARD_ADAPTIVE)
+    {
+        reader.read(_acceptance_probability);
+        reader.read(_accepted_move_pending);
+        reader.read_bytes(_cumulative_exit_rates, params.N_spins * sizeof(double));
+
+        reader.read(_adaptive_rejection_free);
+        reader.read(_adaptive_window_calls);
+        reader.read(_adaptive_window_start_steps);
+        reader.read(_adaptive_window_start_acceptances);
+        reader.read(_cost_per_standard_step);
+        reader.read(_cost_per_rejection_free_visit);
+        reader.read(_n_dynamics_switches);
+        _adaptive_window_start = std::chrono::high_resolution_clock::now();
+    }
+}
+
+template<unsigned int Words>
+SpinSystem<Words>::~SpinSystem()
+{
+    if (_dynamics == dynamics::STANDARD){_teardown_standard();}
+    else if (_dynamics == dynamics::GILLESPIE){_teardown_gillespie();}
+    else if (_dynamics == dynamics::STANDARD_ACCELERATED
+        || _dynamics == dynamics::STANDARD_ADAPTIVE)
+    {
+        _teardown_standard();
+        _teardown_gillespie();
+    }
 
     // Else both to be safe
     else{_teardown_standard(); _teardown_gillespie();}
 }
+
+
+HDSPIN_INSTANTIATE_STATE_WIDTHS(SpinSystem)
+
+// The policy steps are called from the tracer loop in main.cpp
+#define HDSPIN_INSTANTIATE_STEP_WITH(Words, D)                                       \
+    template double SpinSystem<Words>::step_with<dynamics::D, landscape::EREM>();   \
+    template double SpinSystem<Words>::step_with<dynamics::D, landscape::GREM>();
+
+#define HDSPIN_INSTANTIATE_STEPS(Words)                                  \
+    HDSPIN_INSTANTIATE_STEP_WITH(Words, Standard)                        \
+    HDSPIN_INSTANTIATE_STEP_WITH(Words, Gillespie)                       \
+    HDSPIN_INSTANTIATE_STEP_WITH(Words, StandardAccelerated)             \
+    HDSPIN_INSTANTIATE_STEP_WITH(Words, StandardAdaptive)
+
+HDSPIN_INSTANTIATE_STEPS(1)
+HDSPIN_INSTANTIATE_STEPS(2)
+HDSPIN_INSTANTIATE_STEPS(4)
+HDSPIN_INSTANTIATE_STEPS(HDSPIN_MAX_STATE_WORDS)
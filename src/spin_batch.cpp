@@ -0,0 +1,286 @@
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "spin_batch.h"
+#include "exit_rates.h"
+#include "rng.h"
+
+
+// The lane kernels below are plain loops over the lane arrays, compiled
+// for AVX-512, AVX2 and the baseline, and selected once at load time. Like
+// exit_rates.cpp, this file is compiled without floating point contraction
+// (see CMakeLists.txt), so that every clone takes the same Metropolis
+// decisions.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define BATCH_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define BATCH_TARGET_CLONES
+#endif
+
+namespace
+{
+
+    // Philox4x32-10 (see counter_rng::philox4x32_10) applied in place to
+    // the counters x0..x3 of n lanes, each with its own key
+    BATCH_TARGET_CLONES
+    void _philox_lanes(const unsigned int n, uint32_t * __restrict x0,
+        uint32_t * __restrict x1, uint32_t * __restrict x2,
+        uint32_t * __restrict x3, const uint32_t * __restrict key_lo,
+        const uint32_t * __restrict key_hi)
+    {
+        for (unsigned int ll=0; ll<n; ll++)
+        {
+            uint32_t c0 = x0[ll], c1 = x1[ll], c2 = x2[ll], c3 = x3[ll];
+            uint32_t k0 = key_lo[ll], k1 = key_hi[ll];
+            for (unsigned int round=0; round<10; round++)
+            {
+                const uint64_t p0 = (uint64_t) 0xD2511F53 * c0;
+                const uint64_t p1 = (uint64_t) 0xCD9E8D57 * c2;
+                const uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+                const uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+                c1 = (uint32_t) p1;
+                c3 = (uint32_t) p0;
+                c0 = n0;
+                c2 = n2;
+                k0 += 0x9E3779B9;
+                k1 += 0xBB67AE85;
+            }
+            x0[ll] = c0; x1[ll] = c1; x2[ll] = c2; x3[ll] = c3;
+        }
+    }
+
+    // From the 128 bits of each lane: the spin k to flip, uniform on
+    // [0, N_spins) from the first 64 bits by multiply-shift (bias at most
+    // N_spins / 2^64), and a uniform on [0, 1) from the last 52 bits. As in
+    // state::flip_bit, spin k is bit N_spins - 1 - k, i.e. the mask of spin
+    // 0 shifted right by k. The mask is read from an array because GCC does
+    // not vectorize shifts of a constant by a variable amount
+    BATCH_TARGET_CLONES
+    void _propose(const unsigned int n, const unsigned int N_spins,
+        const uint32_t * __restrict v0, const uint32_t * __restrict v1,
+        const uint32_t * __restrict v2, const uint32_t * __restrict v3,
+        const uint64_t * __restrict first_spin_masks,
+        const uint64_t * __restrict states, uint64_t * __restrict proposed,
+        double * __restrict uniforms)
+    {
+        for (unsigned int ll=0; ll<n; ll++)
+        {
+            const uint64_t lo = (uint64_t) v0[ll] * N_spins;
+            const uint64_t hi = (uint64_t) v1[ll] * N_spins + (lo >> 32);
+            proposed[ll] = states[ll] ^ (first_spin_masks[ll] >> (hi >> 32));
+
+            const uint64_t mantissa = (((uint64_t) v3[ll] << 32) | v2[ll]) >> 12;
+            const uint64_t one_to_two = 0x3FF0000000000000ULL | mantissa;
+            double u;
+            std::memcpy(&u, &one_to_two, sizeof(double));
+            uniforms[ll] = u - 1.0;
+        }
+    }
+
+    // The Metropolis test of every lane, with exit_rates::exp_nonpositive
+    // written out without branches: the arguments are clamped in a first
+    // pass (GCC does not if-convert the clamp together with the rest), and
+    // a lane below EXP_UNDERFLOW is rejected as exp_nonpositive would
+    // return 0. Downhill moves are always accepted, as std::exp would
+    // exceed 1. The accepted lanes take their proposed state and energy
+    BATCH_TARGET_CLONES
+    void _accept(const unsigned int n, const double beta,
+        const double * __restrict uniforms,
+        const uint64_t * __restrict proposed_states,
+        const double * __restrict proposed_energies,
+        uint64_t * __restrict states, double * __restrict energies,
+        uint64_t * __restrict accepted)
+    {
+        using namespace exit_rates::_constants;
+        alignas(64) double x[BATCH_MAX_LANES];
+        for (unsigned int ll=0; ll<n; ll++)
+        {
+            const double x0 = -beta * (proposed_energies[ll] - energies[ll]);
+            x[ll] = x0 > 0.0 ? 0.0 : (x0 < exit_rates::EXP_UNDERFLOW ? exit_rates::EXP_UNDERFLOW : x0);
+        }
+
+        for (unsigned int ll=0; ll<n; ll++)
+        {
+            const double t = x[ll] * LOG2E + ROUND_MAGIC;
+            const double m = t - ROUND_MAGIC;
+            double r = x[ll] - m * LN2_HI;
+            r = r - m * LN2_LO;
+            double p = POLY[0];
+            for (unsigned int kk=1; kk<14; kk++){p = p * r + POLY[kk];}
+
+            uint64_t t_bits;
+            std::memcpy(&t_bits, &t, sizeof(double));
+            const uint64_t scale_bits = (t_bits - ROUND_MAGIC_BITS + 1023) << 52;
+            double scale;
+            std::memcpy(&scale, &scale_bits, sizeof(double));
+            p = p * scale;
+
+            const double x0 = -beta * (proposed_energies[ll] - energies[ll]);
+            const bool accept = (x0 >= 0.0)
+                | ((x0 >= exit_rates::EXP_UNDERFLOW) & (uniforms[ll] <= p));
+            const uint64_t mask = -(uint64_t) accept;
+            states[ll] = (proposed_states[ll] & mask) | (states[ll] & ~mask);
+            energies[ll] = accept ? proposed_energies[ll] : energies[ll];
+            accepted[ll] = mask;
+        }
+    }
+
+}
+
+
+SpinSystemBatch::SpinSystemBatch(
+    const std::vector<parameters::SimulationParameters> &params,
+    const std::vector<SpinSystem<1>*> &systems)
+{
+    if (params.size() != systems.size() || systems.empty())
+    {
+        throw std::runtime_error("A batch needs one set of parameters per system");
+    }
+    if (systems.size() > BATCH_MAX_LANES)
+    {
+        throw std::runtime_error("A batch holds at most " + std::to_string(BATCH_MAX_LANES) + " systems");
+    }
+
+    const parameters::SimulationParameters &p = params[0];
+    if (p.N_spins > 64)
+    {
+        throw std::runtime_error("Batched tracers must have at most 64 spins");
+    }
+
+    _systems = systems;
+    _n_lanes = systems.size();
+    _n_padded_lanes = (_n_lanes + BATCH_LANE_MULTIPLE - 1) / BATCH_LANE_MULTIPLE * BATCH_LANE_MULTIPLE;
+    _N_spins = p.N_spins;
+    _beta = p.beta;
+    _beta_critical = p.beta_critical;
+
+    if (p.step_timing == "all"){_step_timing_stride = 1;}
+    else if (p.step_timing == "sampled"){_step_timing_stride = STEP_TIMING_SAMPLE_STRIDE;}
+    else if (p.step_timing == "off"){_step_timing_stride = 0;}
+    else
+    {
+        throw std::runtime_error("Invalid step_timing " + p.step_timing);
+    }
+
+    std::memset(_states, 0, sizeof(_states));
+    std::memset(_energies, 0, sizeof(_energies));
+    std::memset(_dynamics_key_lo, 0, sizeof(_dynamics_key_lo));
+    std::memset(_dynamics_key_hi, 0, sizeof(_dynamics_key_hi));
+    std::memset(_stream_lo, 0, sizeof(_stream_lo));
+    std::memset(_stream_hi, 0, sizeof(_stream_hi));
+    std::memset(_landscape_key_lo, 0, sizeof(_landscape_key_lo));
+    std::memset(_landscape_key_hi, 0, sizeof(_landscape_key_hi));
+    std::memset(_proposed_energies, 0, sizeof(_proposed_energies));
+    for (unsigned int ll=0; ll<BATCH_MAX_LANES; ll++)
+    {
+        _first_spin_masks[ll] = uint64_t(1) << (_N_spins - 1);
+    }
+
+    for (unsigned int ll=0; ll<_n_lanes; ll++)
+    {
+        const parameters::SimulationParameters &q = params[ll];
+        if (q.N_spins != p.N_spins || q.beta != p.beta || q.landscape != p.landscape
+            || q.landscape_mode != p.landscape_mode)
+        {
+            throw std::runtime_error("Batched tracers must share N_spins, beta and the landscape");
+        }
+        if (q.dynamics != "standard")
+        {
+            throw std::runtime_error("Batched tracers must run standard dynamics");
+        }
+
+        EnergyMapping<1> *emap = systems[ll]->get_emap_ptr();
+        _emaps.push_back(emap);
+        _states[ll] = systems[ll]->get_state().words[0];
+        _energies[ll] = emap->get_config_energy(_states[ll]);
+
+        const uint64_t seed = q.use_manual_seed ? q.seed : rng::random_seed();
+        const uint64_t key = rng::_splitmix64(seed);
+        const uint64_t stream = rng::stream_id(q.tracer_index, rng::BATCH_DYNAMICS_STREAM);
+        _dynamics_key_lo[ll] = (uint32_t) key;
+        _dynamics_key_hi[ll] = (uint32_t) (key >> 32);
+        _stream_lo[ll] = (uint32_t) stream;
+        _stream_hi[ll] = (uint32_t) (stream >> 32);
+
+        const uint64_t landscape_key = emap->get_landscape_key();
+        _landscape_key_lo[ll] = (uint32_t) landscape_key;
+        _landscape_key_hi[ll] = (uint32_t) (landscape_key >> 32);
+    }
+    _use_hashed_landscape = _emaps[0]->uses_hashed_landscape();
+    _grem_sigma = _emaps[0]->get_grem_sigma();
+}
+
+template<typename Landscape>
+void SpinSystemBatch::step_with()
+{
+    std::chrono::time_point<std::chrono::high_resolution_clock> t_start;
+    bool timed = false;
+    if (_step_timing_stride > 0 && --_step_timing_countdown == 0)
+    {
+        _step_timing_countdown = _step_timing_stride;
+        timed = true;
+        t_start = std::chrono::high_resolution_clock::now();
+    }
+
+    const unsigned int n = _n_padded_lanes;
+
+    // One Philox block per lane, at counter (step, stream)
+    for (unsigned int ll=0; ll<n; ll++)
+    {
+        _bits[0][ll] = (uint32_t) _n_steps;
+        _bits[1][ll] = (uint32_t) (_n_steps >> 32);
+        _bits[2][ll] = _stream_lo[ll];
+        _bits[3][ll] = _stream_hi[ll];
+    }
+    _n_steps++;
+    _philox_lanes(n, _bits[0], _bits[1], _bits[2], _bits[3], _dynamics_key_lo, _dynamics_key_hi);
+    _propose(n, _N_spins, _bits[0], _bits[1], _bits[2], _bits[3],
+        _first_spin_masks, _states, _proposed_states, _uniforms);
+
+    // The energies of the proposed states. The hashed landscape gives the
+    // same energies as EnergyMapping::hashed_energy
+    if (_use_hashed_landscape)
+    {
+        for (unsigned int ll=0; ll<n; ll++)
+        {
+            _bits[0][ll] = (uint32_t) _proposed_states[ll];
+            _bits[1][ll] = (uint32_t) (_proposed_states[ll] >> 32);
+            _bits[2][ll] = 0;
+            _bits[3][ll] = 0;
+        }
+        _philox_lanes(n, _bits[0], _bits[1], _bits[2], _bits[3], _landscape_key_lo, _landscape_key_hi);
+        for (unsigned int ll=0; ll<_n_lanes; ll++)
+        {
+            const counter_rng::Philox4x32 bits = {{_bits[0][ll], _bits[1][ll], _bits[2][ll], _bits[3][ll]}};
+            _proposed_energies[ll] = Landscape::from_bits(bits, _beta_critical, _grem_sigma);
+        }
+    }
+    else
+    {
+        for (unsigned int ll=0; ll<_n_lanes; ll++)
+        {
+            _proposed_energies[ll] = _emaps[ll]->template get_config_energy<Landscape>(_proposed_states[ll]);
+        }
+    }
+
+    std::memcpy(_previous_states, _states, sizeof(uint64_t) * n);
+    std::memcpy(_previous_energies, _energies, sizeof(double) * n);
+    _accept(n, _beta, _uniforms, _proposed_states, _proposed_energies, _states,
+        _energies, _accepted);
+
+    // A sampled step stands for the _step_timing_stride steps around it,
+    // and is shared evenly between the lanes
+    const double wall_time = timed ?
+        time_utils::get_time_delta(t_start) * _step_timing_stride / _n_lanes : 0.0;
+
+    for (unsigned int ll=0; ll<_n_lanes; ll++)
+    {
+        const parameters::StateProperties<1> prev = {_previous_states[ll], _previous_energies[ll]};
+        const parameters::StateProperties<1> curr = {_states[ll], _energies[ll]};
+        _systems[ll]->record_step(prev, curr, _accepted[ll] != 0, wall_time);
+    }
+}
+
+template void SpinSystemBatch::step_with<landscape::EREM>();
+template void SpinSystemBatch::step_with<landscape::GREM>();
@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <stdexcept>
+
+#include "sweep.h"
+
+
+namespace sweep
+{
+
+    // The values of a key which may be a list, or a single value
+    static std::vector<json> _values(const json &value)
+    {
+        if (value.is_array()){return std::vector<json>(value.begin(), value.end());}
+        return std::vector<json>(1, value);
+    }
+
+    // Sets the parameter of the given key, with the checks of the command
+    // line option of the same name
+    static void _set_parameter(parameters::SimulationParameters &p,
+        const std::string &key, const json &value)
+    {
+        if (key == "log10_N_timesteps")
+        {
+            p.log10_N_timesteps = value.get<unsigned int>();
+            if (p.log10_N_timesteps == 0){throw std::runtime_error("log10_N_timesteps must be positive");}
+        }
+        else if (key == "N_spins")
+        {
+            // Accepts 1e6 as well as 1000000, as the input templates do
+            const double N = value.get<double>();
+            if (N < 1 || N > PRECISON || N != (unsigned int) N)
+            {
+                throw std::runtime_error("N_spins must be an integer between 1 and PRECISON");
+            }
+            p.N_spins = (unsigned int) N;
+        }
+        else if (key == "landscape")
+        {
+            p.landscape = value.get<std::string>();
+            if (p.landscape != "EREM" && p.landscape != "GREM")
+            {
+                throw std::runtime_error("Invalid landscape " + p.landscape);
+            }
+        }
+        else if (key == "beta")
+        {
+            p.beta = value.get<double>();
+            if (!(p.beta > 0.0)){throw std::runtime_error("beta must be positive");}
+        }
+        else if (key == "memory")
+        {
+            p.memory = value.get<long long>();
+            if (p.memory <= 0 && p.memory != -1)
+            {
+                throw std::runtime_error("Invalid choice for memory; must be either -1 or >0");
+            }
+        }
+        else if (key == "landscape_mode"){p.landscape_mode = value.get<std::string>();}
+        else if (key == "cache_engine"){p.cache_engine = value.get<std::string>();}
+        else if (key == "dynamics"){p.dynamics = value.get<std::string>();}
+        else if (key == "gillespie_kernel"){p.gillespie_kernel = value.get<std::string>();}
+        else if (key == "step_timing"){p.step_timing = value.get<std::string>();}
+        else if (key == "rng"){p.rng = value.get<std::string>();}
+        else if (key == "energy_buffer_size")
+        {
+            p.energy_buffer_size = value.get<unsigned int>();
+            if (p.energy_buffer_size == 0){throw std::runtime_error("energy_buffer_size must be positive");}
+        }
+        else if (key == "n_tracers_per_MPI_rank")
+        {
+            p.n_tracers_per_MPI_rank = value.get<unsigned int>();
+            if (p.n_tracers_per_MPI_rank == 0){throw std::runtime_error("n_tracers_per_MPI_rank must be positive");}
+        }
+        else if (key == "n_tracers"){p.n_tracers = value.get<unsigned int>();}
+        else if (key == "seed"){p.seed = value.get<unsigned int>();}
+        else if (key == "batch_lanes" || key == "threads" || key == "scheduler"
+            || key == "checkpoint_interval" || key == "resume" || key == "output_format")
+        {
+            throw std::runtime_error(key + " applies to the whole job, set it on the command line");
+        }
+        else
+        {
+            throw std::runtime_error("Unknown sweep parameter " + key);
+        }
+    }
+
+    std::vector<Point> points_from_json(const json &spec,
+        const parameters::SimulationParameters &defaults)
+    {
+        if (!spec.is_object()){throw std::runtime_error("A sweep spec must be a JSON object");}
+
+        parameters::SimulationParameters base = defaults;
+        json dynamics_or_threshold;
+        for (auto it = spec.begin(); it != spec.end(); it++)
+        {
+            if (it.key() == "N_spins" || it.key() == "beta"){continue;}
+            else if (it.key() == "dynamics_or_threshold"){dynamics_or_threshold = it.value();}
+            else{_set_parameter(base, it.key(), it.value());}
+        }
+
+        const std::vector<json> N_values = spec.contains("N_spins") ?
+            _values(spec["N_spins"]) : std::vector<json>(1, json(defaults.N_spins));
+        const std::vector<json> beta_values = spec.contains("beta") ?
+            _values(spec["beta"]) : std::vector<json>(1, json(defaults.beta));
+
+        std::vector<Point> points;
+        for (const json &N : N_values)
+        {
+            for (const json &beta : beta_values)
+            {
+                Point point;
+                point.params = base;
+                _set_parameter(point.params, "N_spins", N);
+                _set_parameter(point.params, "beta", beta);
+
+                if (dynamics_or_threshold.is_number())
+                {
+                    point.params.dynamics = point.params.beta < dynamics_or_threshold.get<double>() ?
+                        "standard" : "gillespie";
+                }
+                else if (dynamics_or_threshold.is_string())
+                {
+                    point.params.dynamics = dynamics_or_threshold.get<std::string>();
+                }
+
+                parameters::update_parameters_(&point.params);
+                point.directory = point_directory(point.params.N_spins, point.params.beta);
+                points.push_back(point);
+            }
+        }
+        return points;
+    }
+
+    std::string point_directory(const unsigned int N_spins, const double beta)
+    {
+        char directory[64];
+        snprintf(directory, sizeof(directory), "%02u_%.04f/", N_spins, beta);
+        return directory;
+    }
+
+    double estimated_cost(const parameters::SimulationParameters &params)
+    {
+        const double lookups_per_time = params.dynamics == "gillespie" ? params.N_spins : 1.0;
+        return lookups_per_time * (double) params.N_timesteps;
+    }
+
+}
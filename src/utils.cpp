@@ -1,7 +1,14 @@
 #include <sstream>  // oss
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <cassert>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #include "utils.h"
-#include "ArbitraryPrecision/ap/ap.hpp"
 
 
 double mean_vector(const std::vector<double> v)
@@ -17,22 +24,6 @@ double variance_vector(const std::vector<double> v)
     return sq_sum / v.size() - mean * mean;
 }
 
-ap_uint<PRECISON> arbitrary_precision_integer_pow(
-    const int base, const int exponent)
-{
-    if (exponent == 0)
-    {
-        ap_uint<PRECISON> val = 1;
-        return val;   
-    }
-    ap_uint<PRECISON> val = base;
-    for (int ii=0; ii<exponent - 1; ii++)
-    {
-        val *= base;
-    }
-    return val;
-}
-
 long long ipow(long long base, long long exp)
 {
     assert(base > 0);
@@ -48,67 +39,6 @@ long long ipow(long long base, long long exp)
     return result;
 }
 
-namespace state
-{
-    void get_neighbors_(ap_uint<PRECISON> *neighbors, ap_uint<PRECISON> n,
-        const unsigned int bitLength)
-    {   
-        for (int b=0; b<bitLength; b++)
-        {
-            ap_uint<PRECISON> one = 1;
-            neighbors[bitLength - 1 - b] = n ^ (one << b);
-        }
-    }
-
-    ap_uint<PRECISON> flip_bit(const ap_uint<PRECISON> state, const unsigned int k, const unsigned int bitLength)
-    {
-        const int bit = bitLength - k;
-        const ap_uint<PRECISON> one = 1;
-        return (state ^ (one << (bit - 1)));
-    }
-
-    void arbitrary_precision_integer_from_int_array_(
-        const unsigned int *config, const unsigned int N, ap_uint<PRECISON> &res)
-    {
-        res = 0;
-        for (int ii=N-1; ii>=0; ii--)
-        {
-            const ap_uint<PRECISON> config_val = config[N - ii - 1];
-            const ap_uint<PRECISON> power_val = arbitrary_precision_integer_pow(2, ii);
-            res += config_val * power_val;
-        }
-    }
-
-    void int_array_from_arbitrary_precision_integer_(
-        unsigned int *config, const unsigned int N, const ap_uint<PRECISON> &integer)
-    {
-        ap_uint<PRECISON> _integer = integer;
-        for (unsigned int ii=0; ii<N; ii++)
-        {
-            ap_uint<PRECISON> remainder = _integer % 2;
-            _integer = _integer / 2;
-            config[N - ii - 1] = int(remainder);
-        }
-    }
-
-    std::string string_rep_from_arbitrary_precision_integer(const ap_uint<PRECISON> current_state, const unsigned int N)
-    {
-        unsigned int* binary_array = 0;
-        binary_array = new unsigned int [N];
-        int_array_from_arbitrary_precision_integer_(binary_array, N, current_state);
-
-        std::string s = "";
-        for (int ii=0; ii<N; ii++)
-        {
-            s += std::to_string(binary_array[ii]);
-        }
-
-        delete[] binary_array;
-
-        return s;
-    }
-}
-
 
 namespace parameters
 {
@@ -139,19 +69,33 @@ namespace parameters
         printf("beta                     \t\t\t= %.05f\n", p.beta);
         printf("beta_critical            \t\t\t= %.05f\n", p.beta_critical);
         printf("landscape                \t\t\t= %s\n", p.landscape.c_str());
+        printf("landscape_mode           \t\t\t= %s\n", p.landscape_mode.c_str());
         printf("dynamics                 \t\t\t= %s\n", p.dynamics.c_str());
+        printf("gillespie_kernel         \t\t\t= %s\n", p.gillespie_kernel.c_str());
+        printf("step_timing              \t\t\t= %s\n", p.step_timing.c_str());
+        printf("rng                      \t\t\t= %s\n", p.rng.c_str());
+        printf("energy_buffer_size       \t\t\t= %i\n", p.energy_buffer_size);
+        printf("batch_lanes              \t\t\t= %i\n", p.batch_lanes);
         printf("memory                   \t\t\t= %lli\n", p.memory);
+        printf("cache_engine             \t\t\t= %s\n", p.cache_engine.c_str());
         printf("energetic threshold      \t\t\t= %.03e\n", p.energetic_threshold);
         printf("entropic attractor       \t\t\t= %.03e\n", p.entropic_attractor);
         printf("valid_entropic_attractor \t\t\t= %i\n", p.valid_entropic_attractor);
         printf("grid_size                \t\t\t= %i\n", p.grid_size);
         printf("dw                       \t\t\t= %.05f\n", p.dw);
         printf("n_tracers_per_MPI_rank   \t\t\t= %i\n", p.n_tracers_per_MPI_rank);
+        printf("n_tracers                \t\t\t= %i\n", p.n_tracers);
+        printf("scheduler                \t\t\t= %s\n", p.scheduler.c_str());
+        printf("threads                  \t\t\t= %i\n", p.threads);
+        printf("checkpoint_interval      \t\t\t= %.01f\n", p.checkpoint_interval);
+        printf("resume                   \t\t\t= %i\n", p.resume);
+        printf("output_format            \t\t\t= %s\n", p.output_format.c_str());
         if (p.use_manual_seed)
         {
             printf("manual seed              \t\t\t= %i\n", p.seed);
         }
         printf("PRECISON                 \t\t\t= %i\n", PRECISON);
+        printf("state width (bits)       \t\t\t= %i\n", 64 * state_words_for_n_spins(p.N_spins));
         printf("----------------------------------------------------------\n");
     }
 
@@ -213,23 +157,37 @@ namespace parameters
             {"beta", p.beta},
             {"beta_critical", p.beta_critical},
             {"landscape", p.landscape},
+            {"landscape_mode", p.landscape_mode},
             {"dynamics", p.dynamics},
+            {"gillespie_kernel", p.gillespie_kernel},
+            {"step_timing", p.step_timing},
+            {"rng", p.rng},
+            {"energy_buffer_size", p.energy_buffer_size},
+            {"batch_lanes", p.batch_lanes},
             {"memory", p.memory},
+            {"cache_engine", p.cache_engine},
             {"energetic_threshold", p.energetic_threshold},
             {"entropic_attractor", p.entropic_attractor},
             {"valid_entropic_attractor", p.valid_entropic_attractor},
             {"grid_size", p.grid_size},
             {"dw", p.dw},
             {"n_tracers_per_MPI_rank", p.n_tracers_per_MPI_rank},
+            {"n_tracers", p.n_tracers},
+            {"scheduler", p.scheduler},
+            {"threads", p.threads},
+            {"checkpoint_interval", p.checkpoint_interval},
+            {"resume", p.resume},
+            {"output_format", p.output_format},
             {"use_manual_seed", p.use_manual_seed},
             {"seed", p.seed},
-            {"PRECISON", PRECISON}
+            {"PRECISON", PRECISON},
+            {"state_bits", 64 * state_words_for_n_spins(p.N_spins)}
         };
 
         return j;
     }
 
-    FileNames get_filenames(const unsigned int ii)
+    FileNames get_filenames(const unsigned int ii, const std::string &directory)
     {
         std::string ii_str = std::to_string(ii);
         ii_str.insert(ii_str.begin(), 8 - ii_str.length(), '0');
@@ -237,36 +195,39 @@ namespace parameters
         FileNames fnames;
 
         // Energy
-        fnames.energy = "data/" + ii_str + "_energy.txt";
-        fnames.energy_IS = "data/" + ii_str + "_energy_IS.txt";
+        fnames.energy = directory + "data/" + ii_str + "_energy.txt";
+        fnames.energy_IS = directory + "data/" + ii_str + "_energy_IS.txt";
 
         // Ridges
-        fnames.ridge_E = "data/" + ii_str + "_ridge_E.txt";
-        fnames.ridge_S = "data/" + ii_str + "_ridge_S.txt";
+        fnames.ridge_E = directory + "data/" + ii_str + "_ridge_E.txt";
+        fnames.ridge_S = directory + "data/" + ii_str + "_ridge_S.txt";
 
         // Misc
-        fnames.cache_size = "data/" + ii_str + "_cache_size.txt";
-        fnames.acceptance_rate = "data/" + ii_str + "_acceptance_rate.txt";
-        fnames.walltime_per_waitingtime = "data/" + ii_str + "_walltime_per_waitingtime.txt";
+        fnames.cache_size = directory + "data/" + ii_str + "_cache_size.txt";
+        fnames.acceptance_rate = directory + "data/" + ii_str + "_acceptance_rate.txt";
+        fnames.walltime_per_waitingtime = directory + "data/" + ii_str + "_walltime_per_waitingtime.txt";
+
+        // Checkpoints
+        fnames.checkpoint = directory + "checkpoints/" + ii_str + ".ckpt";
+        fnames.checkpoint_done = directory + "checkpoints/" + ii_str + ".done";
 
         fnames.ii_str = ii_str;
-        fnames.grids_directory = "grids";
         return fnames;
     }
 }
 
 
-void make_directories()
+void make_directories(const std::string &directory)
 {
-    system("mkdir data");
-    system("mkdir grids");
+    system(("mkdir -p " + directory + "data").c_str());
+    system(("mkdir -p " + directory + "grids").c_str());
 }
 
 
 namespace grids
 {
 
-    void make_energy_grid_logspace(const int log10_timesteps, const int n_gridpoints)
+    std::vector<long long> energy_grid_logspace(const int log10_timesteps, const int n_gridpoints)
     {
         std::vector <long long> v;
         v.push_back(0.0);
@@ -278,20 +239,14 @@ namespace grids
         }
 
         v.erase(unique(v.begin(), v.end()), v.end());
-
-        const std::string fname = "grids/energy.txt";
-        FILE* outfile = fopen(fname.c_str(), "w");
-        for (int ii=0; ii<v.size(); ii++)
-        {
-            fprintf(outfile, "%lli\n", v[ii]);
-        }
-        fclose(outfile);
+        return v;
     }
 
-    void make_pi_grids(const int log10_timesteps, const double dw, const int n_gridpoints)
+    void pi_grids(const int log10_timesteps, const double dw, const int n_gridpoints,
+        std::vector<long long> &v1, std::vector<long long> &v2)
     {
-        std::vector <long long> v1;
-        std::vector <long long> v2;
+        v1.clear();
+        v2.clear();
         const int nMC = int(pow(10, log10_timesteps));
         const int tw_max = int(nMC / (dw + 1.0));
         const double delta = ((double) log10(tw_max)) / ((double) n_gridpoints);
@@ -310,20 +265,42 @@ namespace grids
             _v2 = int(v1[ii] * (dw + 1.0));
             v2.push_back(_v2);
         }
+    }
 
-        const std::string fname1 = "grids/pi1.txt";
-        const std::string fname2 = "grids/pi2.txt";
-        FILE* outfile1 = fopen(fname1.c_str(), "w");
-        FILE* outfile2 = fopen(fname2.c_str(), "w");
+    GridSet::GridSet(const int log10_timesteps, const double dw, const int n_gridpoints)
+    {
+        energy = energy_grid_logspace(log10_timesteps, n_gridpoints);
+        pi_grids(log10_timesteps, dw, n_gridpoints, pi1, pi2);
+    }
 
-        for (int ii=0; ii<v1.size(); ii++)
+    std::shared_ptr<const GridSet> shared_grid_set(const int log10_timesteps,
+        const double dw, const int n_gridpoints)
+    {
+        static std::mutex mutex;
+        static std::map<std::tuple<int, double, int>, std::shared_ptr<const GridSet>> grid_sets;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<const GridSet> &grid_set = grid_sets[
+            std::make_tuple(log10_timesteps, dw, n_gridpoints)];
+        if (!grid_set){grid_set.reset(new GridSet(log10_timesteps, dw, n_gridpoints));}
+        return grid_set;
+    }
+
+    static void _write_grid(const std::vector<long long> &grid, const std::string &fname)
+    {
+        FILE* outfile = fopen(fname.c_str(), "w");
+        for (int ii=0; ii<grid.size(); ii++)
         {
-            fprintf(outfile1, "%lli\n", v1[ii]);
-            fprintf(outfile2, "%lli\n", v2[ii]);
+            fprintf(outfile, "%lli\n", grid[ii]);
         }
+        fclose(outfile);
+    }
 
-        fclose(outfile1);
-        fclose(outfile2);
+    void write_grid_set(const GridSet &grid_set, const std::string &directory)
+    {
+        _write_grid(grid_set.energy, directory + "grids/energy.txt");
+        _write_grid(grid_set.pi1, directory + "grids/pi1.txt");
+        _write_grid(grid_set.pi2, directory + "grids/pi2.txt");
     }
 
     void load_long_long_grid_(std::vector<long long> &grid, const std::string loc)
@@ -1,6 +1,9 @@
 #ifndef TEST_ENERGY_MAPPING_H
 #define TEST_ENERGY_MAPPING_H
 
+#include <random>
+#include <unordered_map>
+
 #include "energy_mapping.h"
 #include "utils.h"
 #include "utils_testing_suite.h"
@@ -8,14 +11,17 @@
 namespace test_energy_mapping
 {
 
-bool test_energy_mapping_sampling_EREM_given_beta_critical(const double beta_critical)
+bool test_energy_mapping_sampling_EREM_given_beta_critical(const double beta_critical,
+    const std::string rng = "mt19937")
 {
     parameters::SimulationParameters sp;
     sp.landscape = "EREM";
+    sp.rng = rng;
+    sp.N_spins = 100;
     sp.beta_critical = beta_critical;
     sp.use_manual_seed = true;
     sp.seed = 1234;
-    EnergyMapping emap = EnergyMapping(sp);
+    EnergyMapping<TEST_STATE_WORDS> emap = EnergyMapping<TEST_STATE_WORDS>(sp);
     const double mean = -1.0 / sp.beta_critical;
     const double variance = 1.0 / sp.beta_critical / sp.beta_critical;
     int N;
@@ -49,14 +55,16 @@ bool test_energy_mapping_sampling_EREM_given_beta_critical(const double beta_cri
 }
 
 
-bool test_energy_mapping_sampling_REM_given_N_spins(const int N_spins)
+bool test_energy_mapping_sampling_REM_given_N_spins(const int N_spins,
+    const std::string rng = "mt19937")
 {
     parameters::SimulationParameters sp;
     sp.landscape = "GREM";
+    sp.rng = rng;
     sp.N_spins = N_spins;
     sp.use_manual_seed = true;
     sp.seed = 4567;
-    EnergyMapping emap = EnergyMapping(sp);
+    EnergyMapping<TEST_STATE_WORDS> emap = EnergyMapping<TEST_STATE_WORDS>(sp);
     const double mean = 0.0;
     const double variance = N_spins;
 
@@ -100,12 +108,13 @@ bool test_small_cache(const int N_spins)
     sp.use_manual_seed = true;
     sp.seed = 4567;
     sp.memory = 3;
-    EnergyMapping emap = EnergyMapping(sp);
+    sp.cache_engine = "lru";
+    EnergyMapping<TEST_STATE_WORDS> emap = EnergyMapping<TEST_STATE_WORDS>(sp);
     
-    const ap_uint<PRECISON> state_1 = 1234;
-    const ap_uint<PRECISON> state_2 = 5678;
-    const ap_uint<PRECISON> state_3 = 9123;
-    const ap_uint<PRECISON> state_4 = 3456;
+    const spin_state_t state_1 = 1234;
+    const spin_state_t state_2 = 5678;
+    const spin_state_t state_3 = 9123;
+    const spin_state_t state_4 = 3456;
 
     const double e1 = emap.get_config_energy(state_1);
     // std::cout << e1 << " " << emap.get_config_energy(state_1) << std::endl;
@@ -136,6 +145,7 @@ bool test_small_cache(const int N_spins)
 }
 
 
+template<unsigned int Words>
 bool test_memory_minus_one(const int N_spins)
 {
     parameters::SimulationParameters sp;
@@ -144,7 +154,7 @@ bool test_memory_minus_one(const int N_spins)
     sp.use_manual_seed = true;
     sp.seed = 4567;
     sp.memory = -1;
-    EnergyMapping emap = EnergyMapping(sp);
+    EnergyMapping<Words> emap = EnergyMapping<Words>(sp);
 
     // For every configuration, we call the get_config_energy()
     // function twice to make sure that nothing was popped.
@@ -166,9 +176,10 @@ bool test_massive_AP_LRU(const int N_spins)
     sp.use_manual_seed = true;
     sp.seed = 45678;
     sp.memory = 1000;
-    EnergyMapping emap = EnergyMapping(sp);
+    EnergyMapping<TEST_STATE_WORDS> emap = EnergyMapping<TEST_STATE_WORDS>(sp);
 
-    ap_uint<PRECISON> large_number = arbitrary_precision_integer_pow(2, N_spins-1);
+    spin_state_t large_number;
+    large_number.flip(N_spins - 1);
 
     double e;
     for (int ii=0; ii<10; ii++)
@@ -178,7 +189,228 @@ bool test_massive_AP_LRU(const int N_spins)
         // correctly
         e = emap.get_config_energy(large_number);
         if (e != emap.get_config_energy(large_number)){return false;}
-        large_number -= 13;
+        large_number.flip(ii);
+    }
+    return true;
+}
+
+
+/**
+ * @brief Stress tests the CLOCK cache against a reference map
+ * @details Inserts random keys from a key space larger than the capacity,
+ * so that eviction and backward-shift deletion happen constantly. Every
+ * key still in the cache must map to the value it was inserted with, and
+ * the size must never exceed the capacity.
+ */
+bool test_clock_cache_consistency(const unsigned int capacity, const unsigned int n_keys)
+{
+    cache::clock_cache<spin_state_t, double> clock_cache;
+    clock_cache.set_capacity(capacity);
+    std::unordered_map<spin_state_t, double> reference;
+
+    std::mt19937 generator;
+    generator.seed(capacity + n_keys);
+    std::uniform_int_distribution<unsigned int> key_distribution(0, n_keys - 1);
+
+    double counter = 0.0;
+    for (unsigned int ii=0; ii<20 * n_keys; ii++)
+    {
+        spin_state_t key = key_distribution(generator);
+        key.flip(PRECISON - 1 - (ii % 3));
+
+        const bool existed = clock_cache.key_exists(key);
+        const double value = clock_cache.get_or_put(key, [&counter](){return counter += 1.0;});
+
+        if (existed && (reference[key] != value)){return false;}
+        reference[key] = value;
+        if (clock_cache.get_size() > capacity){return false;}
+    }
+
+    // With more distinct keys than the capacity, the cache must be full
+    if (clock_cache.get_size() != capacity){return false;}
+    return true;
+}
+
+
+/**
+ * @brief Checks that the dense table reproduces the cached energies
+ * @details The dense table is selected when all 2^N_spins configurations fit
+ * in the memory budget. Since it samples lazily, it must give exactly the
+ * same energies as a cache which never evicts, for the same seed and the
+ * same sequence of lookups.
+ */
+bool test_dense_table_matches_cache(const int N_spins)
+{
+    parameters::SimulationParameters sp;
+    sp.landscape = "EREM";
+    sp.beta_critical = 1.0;
+    sp.N_spins = N_spins;
+    sp.use_manual_seed = true;
+    sp.seed = 97531;
+    sp.memory = -1;
+    EnergyMapping<TEST_STATE_WORDS> dense = EnergyMapping<TEST_STATE_WORDS>(sp);
+    if (!dense.uses_dense_table()){return false;}
+
+    // One short of every configuration, and only half the space is visited
+    sp.memory = (1LL << N_spins) - 1;
+    sp.cache_engine = "lru";
+    EnergyMapping<TEST_STATE_WORDS> cached = EnergyMapping<TEST_STATE_WORDS>(sp);
+    if (cached.uses_dense_table()){return false;}
+
+    std::mt19937 generator;
+    generator.seed(N_spins);
+    std::uniform_int_distribution<unsigned int> state_distribution(0, (1 << (N_spins - 1)) - 1);
+    for (int ii=0; ii<10000; ii++)
+    {
+        const spin_state_t state = state_distribution(generator);
+        if (dense.get_config_energy(state) != cached.get_config_energy(state)){return false;}
+    }
+    if (dense.get_size() != cached.get_size()){return false;}
+    if (dense.get_capacity() != (1LL << N_spins)){return false;}
+    return true;
+}
+
+/**
+ * @brief Checks when the dense table is selected
+ * @details Only if an explicit --memory holds every configuration, or with
+ * --memory=-1 up to DENSE_UNLIMITED_MAX_N_SPINS spins, as the table is
+ * allocated in full up front.
+ */
+bool test_dense_table_selection()
+{
+    parameters::SimulationParameters sp;
+    sp.landscape = "EREM";
+    sp.beta_critical = 1.0;
+    sp.cache_engine = "lru";
+    sp.memory = -1;
+    sp.N_spins = DENSE_UNLIMITED_MAX_N_SPINS;
+    if (!EnergyMapping<TEST_STATE_WORDS>(sp).uses_dense_table()){return false;}
+    sp.N_spins = DENSE_UNLIMITED_MAX_N_SPINS + 1;
+    if (EnergyMapping<TEST_STATE_WORDS>(sp).uses_dense_table()){return false;}
+    sp.memory = 1LL << sp.N_spins;
+    if (!EnergyMapping<TEST_STATE_WORDS>(sp).uses_dense_table()){return false;}
+    return true;
+}
+
+
+/**
+ * @brief Checks Philox4x32-10 against the Random123 known-answer vectors
+ */
+bool test_philox_known_answers()
+{
+    counter_rng::Philox4x32 out = counter_rng::philox4x32_10({{0, 0, 0, 0}}, 0);
+    if (out.v[0] != 0x6627e8d5 || out.v[1] != 0xe169c58d){return false;}
+    if (out.v[2] != 0xbc57ac4c || out.v[3] != 0x9b00dbd8){return false;}
+
+    out = counter_rng::philox4x32_10(
+        {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}}, 0xffffffffffffffffULL);
+    if (out.v[0] != 0x408f276d || out.v[1] != 0x41c83b0e){return false;}
+    if (out.v[2] != 0xa20bc7c6 || out.v[3] != 0x6d5451fd){return false;}
+
+    out = counter_rng::philox4x32_10(
+        {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}}, 0x299f31d0a4093822ULL);
+    if (out.v[0] != 0xd16cfe09 || out.v[1] != 0x94fdcceb){return false;}
+    if (out.v[2] != 0x5001e420 || out.v[3] != 0x24126ea1){return false;}
+
+    return true;
+}
+
+
+/**
+ * @brief Tests the hashed landscape mode
+ * @details Energies must be reproducible across independent mappings with
+ * the same seed, change with the seed, and follow the requested EREM/GREM
+ * distribution over many distinct states.
+ */
+bool test_hashed_landscape(const std::string landscape, const int N_spins)
+{
+    parameters::SimulationParameters sp;
+    sp.landscape = landscape;
+    sp.landscape_mode = "hashed";
+    sp.N_spins = N_spins;
+    sp.beta_critical = 1.0;
+    sp.use_manual_seed = true;
+    sp.seed = 2468;
+    EnergyMapping<TEST_STATE_WORDS> emap1 = EnergyMapping<TEST_STATE_WORDS>(sp);
+    EnergyMapping<TEST_STATE_WORDS> emap2 = EnergyMapping<TEST_STATE_WORDS>(sp);
+    sp.seed = 1357;
+    EnergyMapping<TEST_STATE_WORDS> emap3 = EnergyMapping<TEST_STATE_WORDS>(sp);
+
+    if (emap1.get_capacity() != 0 || emap1.get_size() != 0){return false;}
+
+    const int N = SMOKE == 1 ? 100000 : 1000000;
+    const double eps = SMOKE == 1 ? 0.1 : 0.03;
+
+    std::vector<double> v;
+    unsigned int n_same_as_other_seed = 0;
+    for (int ii=0; ii<N; ii++)
+    {
+        spin_state_t state = ii;
+        state.flip(N_spins - 1);
+        const double e = emap1.get_config_energy(state);
+        if (e != emap2.get_config_energy(state)){return false;}
+        if (e != emap1.get_config_energy(state)){return false;}
+        if (e == emap3.get_config_energy(state)){n_same_as_other_seed++;}
+        v.push_back(e);
+    }
+    if (n_same_as_other_seed > 0){return false;}
+
+    double mean, variance;
+    if (landscape == "EREM"){mean = -1.0; variance = 1.0;}
+    else{mean = 0.0; variance = N_spins;}
+
+    const double num_mean = mean_vector(v);
+    const double num_var = variance_vector(v);
+    if (fabs(num_mean - mean) > eps * sqrt(variance)){return false;}
+    if (fabs(num_var - variance) > eps * variance){return false;}
+    return true;
+}
+
+/**
+ * @brief Energies handed out from the sampling buffer are reproducible for a
+ * given seed and buffer size. With mt19937 they do not depend on the buffer
+ * size, and with any engine a buffer of one matches drawing the energies one
+ * at a time from a generator on the same stream.
+ */
+bool test_energy_buffer(const std::string landscape, const std::string rng)
+{
+    parameters::SimulationParameters sp;
+    sp.landscape = landscape;
+    sp.N_spins = 20;
+    sp.beta_critical = 1.5;
+    sp.use_manual_seed = true;
+    sp.seed = 8642;
+    sp.rng = rng;
+    sp.tracer_index = 3;
+
+    const unsigned int n = 1000;
+    std::vector<std::vector<double>> energies;
+    for (const unsigned int buffer_size : {1, 7, 256})
+    {
+        sp.energy_buffer_size = buffer_size;
+        EnergyMapping<TEST_STATE_WORDS> emap(sp), emap_again(sp);
+        std::vector<double> v;
+        for (unsigned int ii=0; ii<n; ii++)
+        {
+            v.push_back(emap.sample_energy());
+            if (v.back() != emap_again.sample_energy()){return false;}
+        }
+        energies.push_back(v);
+    }
+
+    rng::Generator generator;
+    generator.seed(rng::kind_from_string(rng), sp.seed,
+        rng::stream_id(sp.tracer_index, rng::LANDSCAPE_STREAM));
+    const double sigma = sqrt(sp.N_spins);
+    for (unsigned int ii=0; ii<n; ii++)
+    {
+        const double e = landscape == "EREM" ?
+            -generator.exponential() / sp.beta_critical : generator.normal() * sigma;
+        if (energies[0][ii] != e){return false;}
+        if (rng == "mt19937")
+        {
+            if (energies[1][ii] != e || energies[2][ii] != e){return false;}
+        }
     }
     return true;
 }
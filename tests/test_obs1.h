@@ -2,10 +2,16 @@
 #define TEST_OBS1_H
 
 #include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <random>
+#include <sstream>
 // #include <stdio.h>
 
 #include "obs1.h"
+#include "output.h"
+#include "reduction.h"
+#include "thread_pool.h"
 
 
 namespace test_obs1
@@ -75,6 +81,394 @@ namespace test_obs1
         return true;
     }
 
+    // A median restored from a checkpoint takes further updates as the
+    // original does
+    bool test_streaming_median_checkpoint()
+    {
+        std::default_random_engine generator;
+        generator.seed(123);
+        std::uniform_real_distribution<double> distribution(-10.0, 10.0);
+
+        StreamingMedian streaming_median;
+        for (unsigned int ii=0; ii<1001; ii++){streaming_median.update(distribution(generator));}
+
+        checkpoint::Writer writer;
+        streaming_median.save(writer);
+        const std::vector<char> buffer = writer.release();
+        checkpoint::Reader reader(buffer);
+        StreamingMedian restored;
+        restored.load(reader);
+
+        for (unsigned int ii=0; ii<1000; ii++)
+        {
+            if (restored.median() != streaming_median.median()){return false;}
+            const double v = distribution(generator);
+            streaming_median.update(v);
+            restored.update(v);
+        }
+        return reader.at_end();
+    }
+
+    // Observables written to a container and exported read back as the
+    // text output, a tracer appended again replaces its first output, and
+    // a container resumed after an index entry was cut short drops that
+    // entry, leaving the one appended before
+    bool test_output_container()
+    {
+        const std::string directory = "_test_output/";
+        system(("mkdir -p " + directory + "data").c_str());
+        const std::string path = output::container_path(directory, 0);
+
+        const double ridge[3] = {-1.5, -2.25, 7.0};
+        for (unsigned int attempt=0; attempt<2; attempt++)
+        {
+            output::ContainerWriter container(path, attempt > 0);
+            for (unsigned int tracer=0; tracer<3; tracer++)
+            {
+                const parameters::FileNames fnames = parameters::get_filenames(tracer, directory);
+                output::Stream energy(output::ENERGY, output::BINARY, fnames, false);
+                output::Stream ridge_E(output::RIDGE_E, output::BINARY, fnames, false);
+                for (unsigned int ii=0; ii<10; ii++){energy.write(ii * 0.125 + tracer + attempt);}
+                ridge_E.write(ridge);
+                container.append(tracer, {&energy, &ridge_E});
+            }
+        }
+
+        // Cut the last entry short, then resume without appending
+        FILE* index = fopen((path + ".idx").c_str(), "r+b");
+        fseek(index, 0, SEEK_END);
+        ftruncate(fileno(index), ftell(index) - 5);
+        fclose(index);
+        {output::ContainerWriter container(path, true);}
+
+        const output::ContainerReader reader(directory);
+        bool ok = reader.tracers() == std::vector<unsigned int>({0, 1, 2});
+        ok = ok && reader.read(0, output::ENERGY)[3] == 1.375;
+        ok = ok && reader.read(2, output::ENERGY)[3] == 3.375;
+        ok = ok && reader.contains(2, output::RIDGE_E) && !reader.contains(2, output::CACHE_SIZE);
+        ok = ok && reader.read(1, output::RIDGE_E) == std::vector<double>(ridge, ridge + 3);
+
+        // The exported files are those of text output
+        output::export_text(directory);
+        std::ifstream energy_file(directory + "data/00000001_energy.txt");
+        std::string line;
+        for (unsigned int ii=0; ii<4; ii++){std::getline(energy_file, line);}
+        ok = ok && line == "2.37500000";
+        std::ifstream ridge_file(directory + "data/00000001_ridge_E.txt");
+        std::getline(ridge_file, line);
+        ok = ok && line == "-1.50000000 -2.25000000 7";
+
+        system(("rm -r " + directory).c_str());
+        return ok;
+    }
+
+    // Text rows handed to a writer thread end up as those written directly,
+    // also when the ring fills up and around a checkpoint
+    bool test_text_writer(const unsigned int n_rows)
+    {
+        const std::string directory = "_test_text_writer/";
+        system(("mkdir -p " + directory + "data").c_str());
+        const parameters::FileNames direct = parameters::get_filenames(0, directory);
+        const parameters::FileNames async = parameters::get_filenames(1, directory);
+
+        {
+            output::TextWriter writer;
+            output::Stream direct_energy(output::ENERGY, output::TEXT, direct, false);
+            output::Stream direct_ridge(output::RIDGE_E, output::TEXT, direct, false);
+            output::Stream async_energy(output::ENERGY, output::TEXT, async, false, &writer);
+            output::Stream async_ridge(output::RIDGE_E, output::TEXT, async, false, &writer);
+            for (unsigned int ii=0; ii<n_rows; ii++)
+            {
+                const double row[3] = {ii / 3.0, -(ii / 7.0), (double) ii};
+                direct_energy.write(row[0]);
+                direct_ridge.write(row);
+                async_energy.write(row[0]);
+                async_ridge.write(row);
+                if (ii == n_rows / 2)
+                {
+                    checkpoint::Writer direct_checkpoint, async_checkpoint;
+                    direct_energy.save(direct_checkpoint);
+                    async_energy.save(async_checkpoint);
+                    if (direct_checkpoint.release() != async_checkpoint.release()){return false;}
+                }
+            }
+        }
+
+        bool ok = true;
+        for (const output::observable_t observable : {output::ENERGY, output::RIDGE_E})
+        {
+            std::ifstream direct_file(output::text_path(direct, observable));
+            std::ifstream async_file(output::text_path(async, observable));
+            std::stringstream direct_text, async_text;
+            direct_text << direct_file.rdbuf();
+            async_text << async_file.rdbuf();
+            ok = ok && direct_text.str() == async_text.str() && !direct_text.str().empty();
+        }
+        system(("rm -r " + directory).c_str());
+        return ok;
+    }
+
+    // The running sums of tracers split over two ranks add up to those of
+    // all tracers, and give the mean, spread and standard error of the
+    // tracers, weighted by the number of ridges for the ridges
+    // Tracers on several threads, each with its own TextWriter, all
+    // written by the one writer thread
+    bool test_shared_text_writer(const unsigned int n_tracers, const unsigned int n_threads)
+    {
+        const std::string directory = "_test_shared_text_writer/";
+        system(("mkdir -p " + directory + "data").c_str());
+        const unsigned int n_rows = 5000;
+        thread_pool::run(n_tracers, n_threads, [&](const unsigned int tracer)
+        {
+            const parameters::FileNames direct = parameters::get_filenames(tracer, directory);
+            const parameters::FileNames async = parameters::get_filenames(n_tracers + tracer, directory);
+            output::TextWriter writer;
+            output::Stream direct_energy(output::ENERGY, output::TEXT, direct, false);
+            output::Stream async_energy(output::ENERGY, output::TEXT, async, false, &writer);
+            for (unsigned int ii=0; ii<n_rows; ii++)
+            {
+                direct_energy.write(ii * (tracer + 1.0) / 3.0);
+                async_energy.write(ii * (tracer + 1.0) / 3.0);
+            }
+        });
+
+        bool ok = true;
+        for (unsigned int tracer=0; tracer<n_tracers; tracer++)
+        {
+            std::ifstream direct_file(parameters::get_filenames(tracer, directory).energy);
+            std::ifstream async_file(parameters::get_filenames(n_tracers + tracer, directory).energy);
+            std::stringstream direct_text, async_text;
+            direct_text << direct_file.rdbuf();
+            async_text << async_file.rdbuf();
+            ok = ok && direct_text.str() == async_text.str() && !direct_text.str().empty();
+        }
+        system(("rm -r " + directory).c_str());
+        return ok;
+    }
+
+    // A capacity of zero is that of --landscape_mode=hashed, without a cache
+    bool test_reduction(const unsigned int n_tracers, const double capacity = 200.0)
+    {
+        const unsigned int grid_length = 4;
+        const parameters::FileNames fnames = parameters::get_filenames(0, "");
+        reduction::Accumulator all(grid_length), rank_0(grid_length), rank_1(grid_length);
+        std::vector<std::vector<double>> energies(grid_length);
+        for (unsigned int tracer=0; tracer<n_tracers; tracer++)
+        {
+            output::Stream energy(output::ENERGY, output::REDUCED, fnames, false);
+            output::Stream ridge_E(output::RIDGE_E, output::REDUCED, fnames, false);
+            output::Stream cache_size(output::CACHE_SIZE, output::REDUCED, fnames, false);
+            cache_size.write(capacity);
+            for (unsigned int gg=0; gg<grid_length; gg++)
+            {
+                energies[gg].push_back(-0.5 * gg - tracer % 3);
+                energy.write(energies[gg].back());
+                const double ridge[3] = {(double) tracer, 1.0, (double) (tracer % 2)};
+                ridge_E.write(ridge);
+                cache_size.write(capacity / 2.0);
+            }
+            all.append(tracer, {&energy, &ridge_E, &cache_size});
+            (tracer % 2 == 0 ? rank_0 : rank_1).append(tracer, {&energy, &ridge_E, &cache_size});
+        }
+
+        std::vector<double> merged = rank_0.get_sums();
+        for (unsigned int ii=0; ii<merged.size(); ii++){merged[ii] += rank_1.get_sums()[ii];}
+        for (unsigned int ii=0; ii<merged.size(); ii++)
+        {
+            if (std::abs(merged[ii] - all.get_sums()[ii]) > 1e-9 * std::abs(merged[ii])){return false;}
+        }
+
+        const std::string directory = "_test_reduction/";
+        all.write_final(directory, {1, 10, 100, 1000});
+        bool ok = true;
+        std::ifstream energy_file(directory + "final/energy.txt");
+        for (unsigned int gg=0; gg<grid_length; gg++)
+        {
+            double grid, mean, sd, sem;
+            energy_file >> grid >> mean >> sd >> sem;
+            double expected_mean = 0.0, expected_var = 0.0;
+            for (const double v : energies[gg]){expected_mean += v / n_tracers;}
+            for (const double v : energies[gg]){expected_var += (v - expected_mean) * (v - expected_mean) / n_tracers;}
+            ok = ok && grid == std::pow(10, gg) && std::abs(mean - expected_mean) < 1e-7
+                && std::abs(sd - std::sqrt(expected_var)) < 1e-7
+                && std::abs(sem - std::sqrt(expected_var / (n_tracers - 1))) < 1e-7;
+        }
+
+        // Only the odd tracers have ridges
+        std::ifstream ridge_file(directory + "final/ridge_E.txt");
+        double grid, mean;
+        ridge_file >> grid >> mean;
+        double expected_mean = 0.0;
+        for (unsigned int tracer=1; tracer<n_tracers; tracer+=2){expected_mean += tracer / (double) (n_tracers / 2);}
+        ok = ok && std::abs(mean - expected_mean) < 1e-7;
+
+        std::ifstream cache_file(directory + "final/cache_size.txt");
+        if (capacity > 0.0)
+        {
+            cache_file >> grid >> mean;
+            ok = ok && mean == 0.5;
+        }
+        else{ok = ok && !cache_file.good();}
+        ok = ok && !std::ifstream(directory + "final/ridge_S.txt").good();
+
+        system(("rm -r " + directory).c_str());
+        return ok;
+    }
+
+    // Writes the text files of a tracer, the first n_rows rows of each
+    static void _write_tracer_text(const std::string &directory, const unsigned int tracer,
+        const unsigned int n_rows, const double shift = 0.0)
+    {
+        const parameters::FileNames fnames = parameters::get_filenames(tracer, directory);
+        FILE* energy = fopen(fnames.energy.c_str(), "w");
+        FILE* ridge_E = fopen(fnames.ridge_E.c_str(), "w");
+        FILE* cache_size = fopen(fnames.cache_size.c_str(), "w");
+        const double capacity = 200.0;
+        output::write_text_row(cache_size, output::CACHE_SIZE, &capacity);
+        for (unsigned int gg=0; gg<n_rows; gg++)
+        {
+            const double value = -0.25 * gg - 0.1 * (tracer % 7) + shift;
+            const double ridge[3] = {0.01 * tracer, -0.5, (double) (tracer % 3)};
+            const double size = 10.0 * (tracer % 5 + gg);
+            output::write_text_row(energy, output::ENERGY, &value);
+            output::write_text_row(ridge_E, output::RIDGE_E, ridge);
+            output::write_text_row(cache_size, output::CACHE_SIZE, &size);
+        }
+        fclose(energy);
+        fclose(ridge_E);
+        fclose(cache_size);
+    }
+
+    // Writes the energies of the odd tracers in [first, last) to a new
+    // container, as of --output_format=binary, in place of any text files
+    static void _write_odd_tracers_binary(const std::string &directory, const unsigned int first,
+        const unsigned int last, const unsigned int grid_length, const double shift = 0.0)
+    {
+        const parameters::FileNames fnames = parameters::get_filenames(0, directory);
+        output::ContainerWriter container(output::container_path(directory, 0), false);
+        for (unsigned int tracer=first; tracer<last; tracer++)
+        {
+            if (tracer % 2 == 0){continue;}
+            system(("rm -f " + directory + "data/" + parameters::get_filenames(tracer, directory).ii_str + "_*").c_str());
+            output::Stream energy(output::ENERGY, output::BINARY, fnames, false);
+            for (unsigned int gg=0; gg<grid_length; gg++){energy.write(-0.25 * gg + 1e-3 * tracer + shift);}
+            container.append(tracer, {&energy});
+        }
+    }
+
+    // Checks that final/ and the aggregate of directory are, byte for
+    // byte, those of a recompute over n_tracers tracers
+    static bool _same_as_full(const std::string &directory, const unsigned int n_tracers)
+    {
+        const std::vector<std::string> paths = {"final/energy.txt", "final/ridge_E.txt",
+            "final/cache_size.txt", "final/aggregate.bin"};
+        std::vector<std::vector<char>> incremental(paths.size());
+        bool ok = true;
+        for (unsigned int ii=0; ii<paths.size(); ii++)
+        {
+            ok = ok && checkpoint::read_file(directory + paths[ii], incremental[ii]);
+        }
+
+        const reduction::Update update = reduction::update_directory(directory, true);
+        ok = ok && update.n_tracers == n_tracers && update.n_read == n_tracers && update.n_rebuilt == 0;
+        for (unsigned int ii=0; ii<paths.size(); ii++)
+        {
+            std::vector<char> recomputed;
+            ok = ok && checkpoint::read_file(directory + paths[ii], recomputed) && recomputed == incremental[ii];
+        }
+        return ok;
+    }
+
+    // Postprocesses a run in two parts, the second adding to the aggregate
+    // of the first, and checks that this gives the same bytes as at once
+    bool test_incremental_postprocess(const unsigned int n_tracers)
+    {
+        const unsigned int grid_length = 4;
+        const std::string directory = "_test_postprocess/";
+        system(("mkdir -p " + directory + "data " + directory + "grids").c_str());
+        FILE* grid = fopen((directory + "grids/energy.txt").c_str(), "w");
+        for (unsigned int gg=0; gg<grid_length; gg++){fprintf(grid, "%i\n", (int) std::pow(10, gg));}
+        fclose(grid);
+
+        // The first part, and a tracer which is still running
+        const unsigned int n_first = n_tracers / 2;
+        for (unsigned int tracer=0; tracer<n_first; tracer++){_write_tracer_text(directory, tracer, grid_length);}
+        _write_tracer_text(directory, n_first, grid_length - 1);
+        reduction::Update update = reduction::update_directory(directory, false);
+        bool ok = update.n_tracers == n_first && update.n_read == n_first && update.n_blocks == 1;
+
+        // The second part, with odd tracers in a container
+        for (unsigned int tracer=n_first; tracer<n_tracers; tracer++)
+        {
+            if (tracer % 2 == 0){_write_tracer_text(directory, tracer, grid_length);}
+        }
+        _write_odd_tracers_binary(directory, n_first, n_tracers, grid_length);
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers && update.n_read == n_tracers - n_first && update.n_rebuilt == 0;
+        ok = ok && _same_as_full(directory, n_tracers);
+
+        // Tracers of the aggregate written again, as by a job run again
+        // without --resume, as text and in a container
+        _write_tracer_text(directory, 0, grid_length, -10.0);
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers && update.n_read == n_tracers && update.n_rebuilt == 1;
+        ok = ok && _same_as_full(directory, n_tracers);
+        if (n_tracers > 1)
+        {
+            _write_odd_tracers_binary(directory, n_first, n_tracers, grid_length, 0.5);
+            update = reduction::update_directory(directory, false);
+            ok = ok && update.n_tracers == n_tracers && update.n_read == n_tracers && update.n_rebuilt == 1;
+            ok = ok && _same_as_full(directory, n_tracers);
+        }
+
+        // Nothing new, a tracer after the last one, then one before it,
+        // which the aggregate cannot take in order, then one gone
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers && update.n_read == 0 && update.n_rebuilt == 0;
+        _write_tracer_text(directory, n_tracers + 1, grid_length);
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers + 1 && update.n_read == 1 && update.n_rebuilt == 0;
+        _write_tracer_text(directory, n_tracers, grid_length);
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers + 2 && update.n_read == n_tracers + 2 && update.n_rebuilt == 1;
+        system(("rm " + parameters::get_filenames(0, directory).energy).c_str());
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers + 1 && update.n_rebuilt == 1;
+
+        system(("rm -r " + directory).c_str());
+        return ok;
+    }
+
+    // Postprocesses the tracers of n_blocks blocks but one, then that one,
+    // which only its own block has to be summed again for
+    bool test_late_tracer_postprocess(const unsigned int n_blocks)
+    {
+        const unsigned int grid_length = 3;
+        const unsigned int n_tracers = n_blocks * AGGREGATE_BLOCK_SIZE;
+        const unsigned int late = n_tracers / 2 + 1;
+        const std::string directory = "_test_late_tracer/";
+        system(("mkdir -p " + directory + "data " + directory + "grids").c_str());
+        FILE* grid = fopen((directory + "grids/energy.txt").c_str(), "w");
+        for (unsigned int gg=0; gg<grid_length; gg++){fprintf(grid, "%i\n", (int) std::pow(10, gg));}
+        fclose(grid);
+
+        for (unsigned int tracer=0; tracer<n_tracers; tracer++)
+        {
+            if (tracer != late){_write_tracer_text(directory, tracer, grid_length);}
+        }
+        reduction::Update update = reduction::update_directory(directory, false);
+        bool ok = update.n_tracers == n_tracers - 1 && update.n_blocks == n_blocks;
+
+        _write_tracer_text(directory, late, grid_length);
+        update = reduction::update_directory(directory, false);
+        ok = ok && update.n_tracers == n_tracers && update.n_read == AGGREGATE_BLOCK_SIZE
+            && update.n_rebuilt == 1;
+        ok = ok && _same_as_full(directory, n_tracers);
+
+        system(("rm -r " + directory).c_str());
+        return ok;
+    }
+
 }
 
 #endif
@@ -0,0 +1,152 @@
+#ifndef TEST_RNG_H
+#define TEST_RNG_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "rng.h"
+
+namespace test_rng
+{
+
+// Reference outputs: pcg64_srandom_r(42, 54) from the PCG demo programs,
+// and the first outputs of xoshiro256++ from the state {1, 2, 3, 4}
+bool test_engine_known_answers()
+{
+    rng::Pcg64 pcg;
+    pcg.seed_state(42, 54);
+    const uint64_t pcg_expected[6] = {
+        0x86b1da1d72062b68ULL, 0x1304aa46c9853d39ULL, 0xa3670e9e0dd50358ULL,
+        0xf9090e529a7dae00ULL, 0xc85b9fd837996f2cULL, 0x606121f8e3919196ULL
+    };
+    for (unsigned int ii=0; ii<6; ii++)
+    {
+        if (pcg() != pcg_expected[ii]){return false;}
+    }
+
+    rng::Xoshiro256pp xoshiro;
+    xoshiro.s[0] = 1; xoshiro.s[1] = 2; xoshiro.s[2] = 3; xoshiro.s[3] = 4;
+    if (xoshiro() != 41943041ULL){return false;}
+    if (xoshiro() != 58720359ULL){return false;}
+    return true;
+}
+
+// Kolmogorov-Smirnov distance between the sorted samples and a CDF
+template<typename cdf_t>
+double _ks_distance(std::vector<double> &v, cdf_t cdf)
+{
+    std::sort(v.begin(), v.end());
+    const double n = v.size();
+    double d = 0.0;
+    for (size_t ii=0; ii<v.size(); ii++)
+    {
+        const double F = cdf(v[ii]);
+        d = std::max(d, std::max(std::abs(F - ii / n), std::abs(F - (ii + 1) / n)));
+    }
+    return d;
+}
+
+// The ziggurat samplers follow the exact normal and exponential CDFs, at
+// the 1% level of the KS test, and populate their tails (beyond the last
+// ziggurat layer) at the expected rate
+bool test_ziggurat_distributions(const std::string kind, const unsigned int n)
+{
+    rng::Generator generator;
+    generator.seed(rng::kind_from_string(kind), 2024, 1);
+
+    std::vector<double> normals(n), exponentials(n);
+    double n_normal_tail = 0.0, n_exponential_tail = 0.0;
+    for (unsigned int ii=0; ii<n; ii++)
+    {
+        normals[ii] = generator.normal();
+        exponentials[ii] = generator.exponential();
+        if (std::abs(normals[ii]) > rng::ziggurat::NORMAL_R){n_normal_tail++;}
+        if (exponentials[ii] > rng::ziggurat::EXPONENTIAL_R){n_exponential_tail++;}
+    }
+
+    const double critical = 1.63 / sqrt(n);
+    if (_ks_distance(normals, [](double x){return 0.5 * erfc(-x / sqrt(2.0));}) > critical){return false;}
+    if (_ks_distance(exponentials, [](double x){return 1.0 - exp(-x);}) > critical){return false;}
+
+    const double p_normal_tail = erfc(rng::ziggurat::NORMAL_R / sqrt(2.0));
+    const double p_exponential_tail = exp(-rng::ziggurat::EXPONENTIAL_R);
+    if (std::abs(n_normal_tail - n * p_normal_tail) > 5.0 * sqrt(n * p_normal_tail)){return false;}
+    if (std::abs(n_exponential_tail - n * p_exponential_tail) > 5.0 * sqrt(n * p_exponential_tail)){return false;}
+    return true;
+}
+
+// Uniform integers on [0, n) are unbiased, by a chi-squared test at about
+// five standard deviations
+bool test_uniform_int(const std::string kind, const unsigned int n)
+{
+    rng::Generator generator;
+    generator.seed(rng::kind_from_string(kind), 77, 0);
+
+    const unsigned int n_samples = 1000 * n;
+    std::vector<double> counts(n, 0.0);
+    for (unsigned int ii=0; ii<n_samples; ii++)
+    {
+        const unsigned int k = generator.uniform_int(n);
+        if (k >= n){return false;}
+        counts[k]++;
+    }
+
+    const double expected = n_samples / (double) n;
+    double chi2 = 0.0;
+    for (unsigned int kk=0; kk<n; kk++)
+    {
+        chi2 += (counts[kk] - expected) * (counts[kk] - expected) / expected;
+    }
+    const double dof = n - 1;
+    return chi2 < dof + 5.0 * sqrt(2.0 * dof);
+}
+
+// A (seed, stream) pair always gives the same sequence, and the streams of
+// different tracers, or of the different purposes of one tracer, are
+// different and uncorrelated
+bool test_streams(const std::string kind, const unsigned int n_tracers)
+{
+    const rng::kind_t k = rng::kind_from_string(kind);
+    const unsigned int n_draws = 1000;
+
+    const unsigned int n_purposes = 3;
+    std::vector<std::vector<double>> draws(n_purposes * n_tracers);
+    for (unsigned int tt=0; tt<n_tracers; tt++)
+    {
+        for (unsigned int pp=0; pp<n_purposes; pp++)
+        {
+            const uint64_t stream = rng::stream_id(tt, (rng::purpose_t) pp);
+            rng::Generator generator, again;
+            generator.seed(k, 123, stream);
+            again.seed(k, 123, stream);
+            for (unsigned int ii=0; ii<n_draws; ii++)
+            {
+                const double u = generator.uniform();
+                if (u != again.uniform()){return false;}
+                draws[n_purposes * tt + pp].push_back(u);
+            }
+        }
+    }
+
+    // Correlation of each stream with the next one, which is the next
+    // purpose of the same tracer or the first stream of the next tracer
+    for (unsigned int ss=0; ss+1<draws.size(); ss++)
+    {
+        if (draws[ss][0] == draws[ss + 1][0]){return false;}
+        double c = 0.0;
+        for (unsigned int ii=0; ii<n_draws; ii++)
+        {
+            c += (draws[ss][ii] - 0.5) * (draws[ss + 1][ii] - 0.5);
+        }
+
+        // The draws have variance 1/12
+        c = 12.0 * c / n_draws;
+        if (std::abs(c) > 5.0 / sqrt(n_draws)){return false;}
+    }
+    return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef TEST_SCHEDULER_H
+#define TEST_SCHEDULER_H
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "scheduler.h"
+#include "thread_pool.h"
+
+
+// Built without MPI (see mpi_compat.h), so the job is a single rank
+namespace test_scheduler
+{
+
+    // Claims every item on n_threads threads, and checks that every tracer
+    // is handed out exactly once
+    bool test_items_claimed_once(const scheduler::mode_t mode, const unsigned int n_tracers,
+        const unsigned int tracers_per_item, const unsigned int n_threads)
+    {
+        scheduler::TracerScheduler tracer_scheduler(mode, n_tracers, tracers_per_item, MPI_COMM_WORLD);
+        std::vector<unsigned int> counts(n_tracers, 0);
+        std::mutex counts_mutex;
+        bool ok = true;
+
+        thread_pool::run_claimed(n_threads, [&tracer_scheduler](unsigned int &item)
+        {
+            unsigned int last;
+            return tracer_scheduler.next(item, last);
+        }, [&](const unsigned int first)
+        {
+            std::lock_guard<std::mutex> lock(counts_mutex);
+            ok = ok && first % tracers_per_item == 0;
+            const unsigned int last = std::min(first + tracers_per_item, n_tracers);
+            for (unsigned int ii=first; ii<last; ii++){counts[ii]++;}
+        });
+
+        // And nothing once they have run out
+        unsigned int first, last;
+        ok = ok && !tracer_scheduler.next(first, last);
+        for (const unsigned int count : counts){ok = ok && count == 1;}
+        return ok;
+    }
+
+    // Splits the tracers of a sweep, sorted most expensive first as in
+    // main, over world_size ranks, and checks that every tracer goes to
+    // exactly one rank and that the totals of the ranks differ by at most
+    // the cost of the most expensive tracer
+    bool test_static_balance(const int world_size)
+    {
+        // Points with tracers of very different cost, in no particular order
+        const std::vector<double> point_costs = {1.0, 5000.0, 20.0, 300.0, 1.0e5};
+        const unsigned int n_tracers_per_point = 37;
+        std::vector<double> costs;
+        for (const double cost : point_costs)
+        {
+            for (unsigned int jj=0; jj<n_tracers_per_point; jj++){costs.push_back(cost);}
+        }
+        std::stable_sort(costs.begin(), costs.end(), std::greater<double>());
+
+        std::vector<unsigned int> counts(costs.size(), 0);
+        std::vector<double> totals;
+        for (int rank=0; rank<world_size; rank++)
+        {
+            double total = 0.0;
+            for (const unsigned int item : scheduler::static_items(costs.size(), rank, world_size))
+            {
+                counts[item]++;
+                total += costs[item];
+            }
+            totals.push_back(total);
+        }
+
+        bool ok = true;
+        for (const unsigned int count : counts){ok = ok && count == 1;}
+        const double spread = *std::max_element(totals.begin(), totals.end())
+            - *std::min_element(totals.begin(), totals.end());
+        return ok && spread <= costs[0];
+    }
+
+}
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef TEST_SPIN_H
 #define TEST_SPIN_H
 
+#include <cmath>
+#include <random>
+
 #include "spin.h"
+#include "spin_batch.h"
+#include "exit_rates.h"
 #include "utils.h"
+#include "utils_testing_suite.h"
 
 namespace test_spin
 {
@@ -17,10 +23,11 @@ bool test_basic_lru_cache_with_spin()
     p.beta_critical = 1.0;
     p.dynamics = "standard";
     p.memory = 15;
+    p.cache_engine = "lru";
     p.n_tracers_per_MPI_rank = 1;
 
-    EnergyMapping emap(p);
-    SpinSystem spin(p, emap);
+    EnergyMapping<TEST_STATE_WORDS> emap(p);
+    SpinSystem<TEST_STATE_WORDS> spin(p, emap);
     std::vector<double> vec;
 
     for (int ii=0; ii<16; ii++)
@@ -70,7 +77,7 @@ bool test_basic_lru_cache_with_spin()
 //     EnergyMapping emap(p);
 //     SpinSystem sys(p, emap);
 
-//     for (ap_uint<PRECISON> state=0; state<16; state++)
+//     for (spin_state_t state=0; state<16; state++)
 //     {
 //         sys.set_state(state);
 //         std::cout << state << " "  << sys.binary_state() << " " << sys.energy() << " " << sys.get_inherent_structure() << std::endl;
@@ -79,6 +86,7 @@ bool test_basic_lru_cache_with_spin()
 
 // }
 
+template<unsigned int Words>
 bool test_inherent_structure_min_is_min()
 {
     const unsigned int N = 12;
@@ -95,23 +103,24 @@ bool test_inherent_structure_min_is_min()
     p.use_manual_seed = true;
     p.seed = 123;
 
-    EnergyMapping emap(p);
-    SpinSystem sys(p, emap);
-    EnergyMapping* emap_ptr = &emap;
+    EnergyMapping<Words> emap(p);
+    SpinSystem<Words> sys(p, emap);
+    EnergyMapping<Words>* emap_ptr = &emap;
 
-    ap_uint<PRECISON>* neighbors = 0;
-    neighbors = new ap_uint<PRECISON> [p.N_spins];
+    SpinState<Words>* neighbors = 0;
+    neighbors = new SpinState<Words> [p.N_spins];
 
     double* neighboring_energies = 0;
     neighboring_energies = new double [p.N_spins];
 
     const unsigned int m = pow(2, N);
-    for (ap_uint<PRECISON> s=0; s<m; s++)
+    for (unsigned int ii=0; ii<m; ii++)
     {
+        const SpinState<Words> s = ii;
         sys.set_state(s);
-        // ap_uint<PRECISON> inherent_structure = sys._help_get_inherent_structure();
+        // SpinState<Words> inherent_structure = sys._help_get_inherent_structure();
 
-        ap_uint<PRECISON> inherent_structure = emap_ptr->get_inherent_structure(s);
+        SpinState<Words> inherent_structure = emap_ptr->get_inherent_structure(s);
 
         // std::cout << s << " " << inherent_structure << std::endl;
 
@@ -135,6 +144,315 @@ bool test_inherent_structure_min_is_min()
 
     return true;
 }
+// The linear Gillespie kernel must follow the same trajectory as the
+// reference std::discrete_distribution kernel for the same seed
+bool test_gillespie_kernels_agree(const std::string landscape, const unsigned int N)
+{
+    parameters::SimulationParameters p;
+    p.log10_N_timesteps = 4;
+    p.N_timesteps = ipow(10, int(p.log10_N_timesteps));
+    p.N_spins = N;
+    p.landscape = landscape;
+    p.beta = 2.4;
+    p.beta_critical = 1.0;
+    p.dynamics = "gillespie";
+    p.memory = -1;
+    p.landscape_mode = "hashed";
+    p.n_tracers_per_MPI_rank = 1;
+    p.use_manual_seed = true;
+    p.seed = 123;
+
+    parameters::SimulationParameters p_ref = p;
+    p_ref.gillespie_kernel = "reference";
+
+    EnergyMapping<TEST_STATE_WORDS> emap(p), emap_ref(p_ref);
+    SpinSystem<TEST_STATE_WORDS> sys(p, emap), sys_ref(p_ref, emap_ref);
+
+    for (unsigned int ii=0; ii<p.N_timesteps; ii++)
+    {
+        if (sys.step() != sys_ref.step()){return false;}
+        if (sys.get_current_state().state != sys_ref.get_current_state().state){return false;}
+    }
+    return true;
+}
+bool test_exp_nonpositive_error_bound(const unsigned int n_samples)
+{
+    std::mt19937 generator(123);
+    std::uniform_real_distribution<double> dist(exit_rates::EXP_UNDERFLOW, 0.0);
+    std::uniform_real_distribution<double> dist_small(-1e-6, 0.0);
+
+    for (unsigned int ii=0; ii<n_samples; ii++)
+    {
+        const double x = ii % 2 == 0 ? dist(generator) : dist_small(generator);
+        const double expected = std::exp(x);
+        const double err = std::abs(exit_rates::exp_nonpositive(x) - expected) / expected;
+        if (err > exit_rates::EXP_MAX_RELATIVE_ERROR){return false;}
+    }
+
+    if (exit_rates::exp_nonpositive(0.0) != 1.0){return false;}
+    if (exit_rates::exp_nonpositive(-710.0) != 0.0){return false;}
+    return true;
+}
+
+// Whichever SIMD path is selected must agree bit for bit with the scalar
+// kernel, and to within the error bound with std::exp
+bool test_vectorized_exit_rates(const unsigned int N)
+{
+    std::mt19937 generator(N);
+    std::normal_distribution<double> dist(0.0, 10.0);
+    const double beta = 2.4;
+
+    std::vector<double> energies(N), rates(N), rates_scalar(N);
+    for (unsigned int trial=0; trial<100; trial++)
+    {
+        for (unsigned int ii=0; ii<N; ii++){energies[ii] = dist(generator);}
+        const double current_energy = dist(generator);
+
+        exit_rates::metropolis_rates(energies.data(), current_energy, beta, N, rates.data());
+        exit_rates::metropolis_rates_scalar(energies.data(), current_energy, beta, N, rates_scalar.data());
+
+        for (unsigned int ii=0; ii<N; ii++)
+        {
+            if (rates[ii] != rates_scalar[ii]){return false;}
+
+            const double x = -beta * (energies[ii] - current_energy);
+            if (x < exit_rates::EXP_UNDERFLOW){continue;}
+            double expected = std::exp(x);
+            if (expected > 1.0){expected = 1.0;}
+            expected = expected / N;
+            if (std::abs(rates[ii] - expected) > exit_rates::EXP_MAX_RELATIVE_ERROR * expected)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+// Runs a tracer through the same loop as execute until the end of the
+// simulation, returning the time averaged energy
+double _run_time_averaged_energy(SpinSystem<TEST_STATE_WORDS>& sys,
+    const parameters::SimulationParameters& p)
+{
+    double simulation_clock = 0.0;
+    double energy_time = 0.0;
+    while (true)
+    {
+        const double waiting_time = sys.step();
+        simulation_clock += waiting_time;
+        energy_time += sys.get_previous_state().energy * waiting_time;
+        if (simulation_clock > p.N_timesteps){break;}
+    }
+    return energy_time / simulation_clock;
+}
+
+// Standard-accelerated and standard-adaptive dynamics must sample the same
+// process as standard dynamics: same step bookkeeping, and acceptance rates
+// and time averaged energies which agree with each other and with the exact
+// Boltzmann average
+bool test_rejection_free_matches_standard(const std::string dynamics,
+    const std::string landscape, const unsigned int N, const double beta,
+    const std::string rng = "mt19937")
+{
+    parameters::SimulationParameters p;
+    p.rng = rng;
+    p.log10_N_timesteps = 6;
+    p.N_timesteps = ipow(10, int(p.log10_N_timesteps));
+    p.N_spins = N;
+    p.landscape = landscape;
+    p.beta = beta;
+    p.beta_critical = 1.0;
+    p.landscape_mode = "hashed";
+    p.n_tracers_per_MPI_rank = 1;
+    p.use_manual_seed = true;
+    p.seed = 123;
+
+    parameters::SimulationParameters p_acc = p;
+    p.dynamics = "standard";
+    p_acc.dynamics = dynamics;
+
+    EnergyMapping<TEST_STATE_WORDS> emap(p), emap_acc(p_acc);
+    SpinSystem<TEST_STATE_WORDS> sys(p, emap), sys_acc(p_acc, emap_acc);
+
+    const double energy = _run_time_averaged_energy(sys, p);
+    const double energy_acc = _run_time_averaged_energy(sys_acc, p_acc);
+
+    // Both stop after exactly N_timesteps + 1 steps
+    const parameters::SimulationStatistics stats = sys.get_sim_stats();
+    const parameters::SimulationStatistics stats_acc = sys_acc.get_sim_stats();
+    if (stats_acc.total_steps != stats.total_steps){return false;}
+    if (stats_acc.acceptances + stats_acc.rejections != stats_acc.total_steps){return false;}
+    if (stats_acc.total_waiting_time != (double) stats_acc.total_steps){return false;}
+
+    // Exact equilibrium averages of the energy and of the acceptance
+    // probability over the (hashed, hence quenched) landscape
+    double Z = 0.0, E = 0.0, A = 0.0;
+    const unsigned int m = pow(2, N);
+    for (unsigned int ii=0; ii<m; ii++)
+    {
+        const double e = emap.get_config_energy(ii);
+        double a = 0.0;
+        for (unsigned int kk=0; kk<N; kk++)
+        {
+            const double dE = emap.get_config_energy(ii ^ (1u << kk)) - e;
+            a += std::min(1.0, exp(-beta * dE)) / N;
+        }
+        Z += exp(-beta * e);
+        E += e * exp(-beta * e);
+        A += a * exp(-beta * e);
+    }
+    E = E / Z;
+    A = A / Z;
+
+    const double rate = ((double) stats.acceptances) / stats.total_steps;
+    const double rate_acc = ((double) stats_acc.acceptances) / stats_acc.total_steps;
+    if (std::abs(rate - A) > 0.03 * A){return false;}
+    if (std::abs(rate_acc - A) > 0.03 * A){return false;}
+    if (std::abs(energy - E) > 0.02 * std::abs(E)){return false;}
+    if (std::abs(energy_acc - E) > 0.02 * std::abs(E)){return false;}
+    return true;
+}
+
+// The lanes of a batch take valid standard steps: every lane moves by at
+// most one spin, holds the energy of its state in its own landscape, and
+// the SpinSystem of the lane records every step. Averaged over the lanes,
+// the acceptance rate matches its exact equilibrium value
+bool test_batch_matches_standard(const std::string landscape,
+    const std::string landscape_mode, const unsigned int n_lanes)
+{
+    const unsigned int N = 8;
+    const double beta = 0.5;
+    const unsigned int n_steps = 100000;
+
+    std::vector<parameters::SimulationParameters> params;
+    std::vector<std::unique_ptr<EnergyMapping<1>>> emaps;
+    std::vector<std::unique_ptr<SpinSystem<1>>> systems;
+    std::vector<SpinSystem<1>*> system_ptrs;
+    for (unsigned int ll=0; ll<n_lanes; ll++)
+    {
+        parameters::SimulationParameters p;
+        p.log10_N_timesteps = 5;
+        p.N_timesteps = n_steps;
+        p.N_spins = N;
+        p.landscape = landscape;
+        p.beta = beta;
+        p.beta_critical = 1.0;
+        p.landscape_mode = landscape_mode;
+        p.memory = -1;
+        p.dynamics = "standard";
+        p.use_manual_seed = true;
+        p.seed = 123 + ll;
+        p.tracer_index = ll;
+        params.push_back(p);
+        emaps.emplace_back(new EnergyMapping<1>(p));
+        systems.emplace_back(new SpinSystem<1>(p, *emaps[ll]));
+        system_ptrs.push_back(systems[ll].get());
+    }
+
+    SpinSystemBatch batch(params, system_ptrs);
+    for (unsigned int step=0; step<n_steps; step++)
+    {
+        if (landscape == "EREM"){batch.step_with<landscape::EREM>();}
+        else{batch.step_with<landscape::GREM>();}
+
+        for (unsigned int ll=0; ll<n_lanes; ll++)
+        {
+            const parameters::StateProperties<1> prev = systems[ll]->get_previous_state();
+            const parameters::StateProperties<1> curr = systems[ll]->get_current_state();
+            if (curr.state != systems[ll]->get_state()){return false;}
+            if (curr.state.words[0] != batch.get_lane_state(ll)){return false;}
+            if (curr.energy != emaps[ll]->get_config_energy(curr.state)){return false;}
+            if (prev.energy != emaps[ll]->get_config_energy(prev.state)){return false;}
+            const uint64_t moved = prev.state.words[0] ^ curr.state.words[0];
+            if (__builtin_popcountll(moved) > 1 || moved >> N){return false;}
+        }
+    }
+
+    double rate = 0.0, A = 0.0;
+    for (unsigned int ll=0; ll<n_lanes; ll++)
+    {
+        const parameters::SimulationStatistics stats = systems[ll]->get_sim_stats();
+        if (stats.total_steps != n_steps){return false;}
+        if (stats.acceptances + stats.rejections != stats.total_steps){return false;}
+        if (stats.total_waiting_time != (double) n_steps){return false;}
+        rate += ((double) stats.acceptances) / stats.total_steps / n_lanes;
+
+        // Exact equilibrium acceptance probability over the landscape of
+        // the lane
+        double Z = 0.0, A_lane = 0.0;
+        for (unsigned int ii=0; ii<(1u << N); ii++)
+        {
+            const double e = emaps[ll]->get_config_energy(ii);
+            double a = 0.0;
+            for (unsigned int kk=0; kk<N; kk++)
+            {
+                const double dE = emaps[ll]->get_config_energy(ii ^ (1u << kk)) - e;
+                a += std::min(1.0, exp(-beta * dE)) / N;
+            }
+            Z += exp(-beta * e);
+            A_lane += a * exp(-beta * e);
+        }
+        A += A_lane / Z / n_lanes;
+    }
+    return std::abs(rate - A) < 0.03 * A;
+}
+
+// A tracer restored from a checkpoint continues exactly as the tracer it
+// was taken from: same states, energies, draws and statistics, including
+// through cache evictions, which depend on the saved order of use
+bool test_checkpoint_continues_tracer(const std::string dynamics,
+    const std::string landscape_mode, const std::string cache_engine,
+    const long long memory, const std::string rng)
+{
+    parameters::SimulationParameters p;
+    p.rng = rng;
+    p.log10_N_timesteps = 5;
+    p.N_timesteps = ipow(10, int(p.log10_N_timesteps));
+    p.N_spins = 12;
+    p.landscape = "EREM";
+    p.beta = 2.0;
+    p.beta_critical = 1.0;
+    p.landscape_mode = landscape_mode;
+    p.cache_engine = cache_engine;
+    p.memory = memory;
+    p.dynamics = dynamics;
+    p.energy_buffer_size = 7;
+    p.use_manual_seed = true;
+    p.seed = 123;
+
+    EnergyMapping<1> emap(p);
+    SpinSystem<1> sys(p, emap);
+    for (unsigned int ii=0; ii<5003; ii++){sys.step();}
+
+    checkpoint::Writer writer;
+    emap.save(writer);
+    sys.save(writer);
+    const std::vector<char> buffer = writer.release();
+
+    // Seeded differently, so that nothing carries over but the checkpoint
+    parameters::SimulationParameters p_restored = p;
+    p_restored.seed = 456;
+    EnergyMapping<1> emap_restored(p_restored);
+    SpinSystem<1> sys_restored(p_restored, emap_restored);
+    checkpoint::Reader reader(buffer);
+    emap_restored.load(reader);
+    sys_restored.load(reader);
+    if (!reader.at_end()){return false;}
+
+    for (unsigned int ii=0; ii<20000; ii++)
+    {
+        if (sys.step() != sys_restored.step()){return false;}
+        const parameters::StateProperties<1> curr = sys.get_current_state();
+        const parameters::StateProperties<1> curr_restored = sys_restored.get_current_state();
+        if (!(curr.state == curr_restored.state)){return false;}
+        if (curr.energy != curr_restored.energy){return false;}
+    }
+    const parameters::SimulationStatistics stats = sys.get_sim_stats();
+    const parameters::SimulationStatistics stats_restored = sys_restored.get_sim_stats();
+    if (stats.acceptances != stats_restored.acceptances){return false;}
+    if (stats.total_steps != stats_restored.total_steps){return false;}
+    return emap.get_size() == emap_restored.get_size();
+}
+
 }
 
 #endif
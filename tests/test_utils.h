@@ -1,9 +1,15 @@
 #ifndef TEST_UTILS_H
 #define TEST_UTILS_H
 
+#include <atomic>
 #include <random>
+#include <stdexcept>
+#include <vector>
 
 #include "utils.h"
+#include "thread_pool.h"
+#include "sweep.h"
+#include "utils_testing_suite.h"
 
 namespace test_utils
 {
@@ -40,11 +46,11 @@ bool test_array_to_int_to_array_conversion(
     unsigned int arr[arr_size];
     _fill_binary_vector(arr, arr_size, seed);
 
-    ap_uint<PRECISON> res;
-    state::arbitrary_precision_integer_from_int_array_(arr, arr_size, res);
+    spin_state_t res;
+    state::spin_state_from_int_array_(arr, arr_size, res);
 
     unsigned int arr2[arr_size];
-    state::int_array_from_arbitrary_precision_integer_(arr2, arr_size, res);
+    state::int_array_from_spin_state_(arr2, arr_size, res);
 
     for (unsigned int ii=0; ii<arr_size; ii++)
     {
@@ -77,7 +83,7 @@ bool test_neighbors_correct(const unsigned int seed, const unsigned int arr_size
     _fill_binary_vector(arr, arr_size, seed);
 
     // Get the neighbor values via flipping spins manually
-    ap_uint<PRECISON> neighbors_method_1[arr_size];
+    spin_state_t neighbors_method_1[arr_size];
     for (unsigned int ii=0; ii<arr_size; ii++)
     {
         // Flip the ii'th bit
@@ -85,7 +91,7 @@ bool test_neighbors_correct(const unsigned int seed, const unsigned int arr_size
         else{arr[ii] = 0;}
 
         // Get the decimal representation of this binary vector
-        state::arbitrary_precision_integer_from_int_array_(arr, arr_size, neighbors_method_1[ii]);
+        state::spin_state_from_int_array_(arr, arr_size, neighbors_method_1[ii]);
 
         // Flip the ii'th bit back
         if (arr[ii] == 0){arr[ii] = 1;}
@@ -94,18 +100,18 @@ bool test_neighbors_correct(const unsigned int seed, const unsigned int arr_size
 
     // Now we do the opposite: first convert the array to decimal
     // representation, and find its neighbors from that directly.
-    ap_uint<PRECISON> decimal_rep;
-    state::arbitrary_precision_integer_from_int_array_(arr, arr_size, decimal_rep);
+    spin_state_t decimal_rep;
+    state::spin_state_from_int_array_(arr, arr_size, decimal_rep);
 
-    ap_uint<PRECISON> neighbors_method_2[arr_size];
+    spin_state_t neighbors_method_2[arr_size];
     state::get_neighbors_(neighbors_method_2, decimal_rep, arr_size);
 
     // Compare!
     // Note they save the neighbors in opposite order!
     for (unsigned int ii=0; ii<arr_size; ii++)
     {
-        const ap_uint<PRECISON> val1 = neighbors_method_1[ii];
-        const ap_uint<PRECISON> val2 = neighbors_method_2[ii];
+        const spin_state_t val1 = neighbors_method_1[ii];
+        const spin_state_t val2 = neighbors_method_2[ii];
         // std::cout << val1 << " " << val2 << " " << std::string(val1) << " " << std::string(val2) << std::endl;
         if (val1 != val2){return false;}
     }
@@ -115,8 +121,8 @@ bool test_neighbors_correct(const unsigned int seed, const unsigned int arr_size
 
 bool test_flip_bit_small()
 {
-    ap_uint<PRECISON> thirteen = 13;
-    ap_uint<PRECISON> v2 = state::flip_bit(thirteen, 1, 4);
+    spin_state_t thirteen = 13;
+    spin_state_t v2 = state::flip_bit(thirteen, 1, 4);
     if (v2 == 9){return true;}
     return false;
 }
@@ -127,8 +133,8 @@ bool test_flip_bit_huge(const unsigned int seed, const unsigned int arr_size)
     _fill_binary_vector(arr, arr_size, seed);
     arr[0] = 1;
     arr[arr_size - 1] = 1;
-    ap_uint<PRECISON> v1, v2, ap_rep;
-    state::arbitrary_precision_integer_from_int_array_(arr, arr_size, ap_rep);
+    spin_state_t v1, v2, ap_rep;
+    state::spin_state_from_int_array_(arr, arr_size, ap_rep);
 
     for (unsigned int ii=0; ii<arr_size; ii++)
     {
@@ -137,7 +143,7 @@ bool test_flip_bit_huge(const unsigned int seed, const unsigned int arr_size)
         else{arr[ii] = 0;}
 
         // Calculate the value
-        state::arbitrary_precision_integer_from_int_array_(arr, arr_size, v1);
+        state::spin_state_from_int_array_(arr, arr_size, v1);
 
         // Flip back
         if (arr[ii] == 0){arr[ii] = 1;}
@@ -159,8 +165,8 @@ bool test_flip_bit_big_number(const unsigned int arr_size)
     unsigned int arr[arr_size];
     for (int ii=0; ii<arr_size; ii++){arr[ii] = 1;}
     
-    ap_uint<PRECISON> v1, v2, ap_rep, v2_prime;
-    state::arbitrary_precision_integer_from_int_array_(arr, arr_size, ap_rep);
+    spin_state_t v1, v2, ap_rep, v2_prime;
+    state::spin_state_from_int_array_(arr, arr_size, ap_rep);
 
     for (unsigned int ii=0; ii<arr_size; ii++)
     {
@@ -169,7 +175,7 @@ bool test_flip_bit_big_number(const unsigned int arr_size)
         else{arr[ii] = 0;}
 
         // Calculate the value
-        state::arbitrary_precision_integer_from_int_array_(arr, arr_size, v1);
+        state::spin_state_from_int_array_(arr, arr_size, v1);
 
         // Flip back
         if (arr[ii] == 0){arr[ii] = 1;}
@@ -191,8 +197,8 @@ bool test_flip_bit_big_number_self_consistent(const unsigned int arr_size)
     unsigned int arr[arr_size];
     for (int ii=0; ii<arr_size; ii++){arr[ii] = 1;}
     
-    ap_uint<PRECISON> ap_rep, flipped, ap_rep_2;
-    state::arbitrary_precision_integer_from_int_array_(arr, arr_size, ap_rep);
+    spin_state_t ap_rep, flipped, ap_rep_2;
+    state::spin_state_from_int_array_(arr, arr_size, ap_rep);
 
     for (unsigned int ii=0; ii<arr_size; ii++)
     {
@@ -208,6 +214,151 @@ bool test_flip_bit_big_number_self_consistent(const unsigned int arr_size)
 
     return true;
 }
+
+
+/**
+ * @brief Checks the word-level SpinState operations against a plain binary
+ * array, including flips which straddle the 64-bit word boundaries.
+ * 
+ * @param int The random seed
+ * @param int The size of the binary array
+ * 
+ * @return Returns true if all checks pass, false otherwise.
+ */
+bool test_spin_state_word_operations(const unsigned int seed, const unsigned int arr_size)
+{
+    unsigned int arr[arr_size];
+    _fill_binary_vector(arr, arr_size, seed);
+
+    spin_state_t s1;
+    state::spin_state_from_int_array_(arr, arr_size, s1);
+
+    unsigned int count = 0;
+    for (unsigned int ii=0; ii<arr_size; ii++){count += arr[ii];}
+    if (s1.popcount() != count){return false;}
+
+    for (unsigned int ii=0; ii<arr_size; ii++)
+    {
+        spin_state_t s2 = s1;
+        s2.flip(ii);
+        if (s2 == s1){return false;}
+        if (s2.get(ii) == s1.get(ii)){return false;}
+
+        // The xor of two neighbors is exactly the flipped bit
+        const spin_state_t diff = s1 ^ s2;
+        if (diff.popcount() != 1){return false;}
+        if (!diff.get(ii)){return false;}
+
+        // Flipping back restores both the state and its hash
+        s2.flip(ii);
+        if (s2 != s1){return false;}
+        if (s2.hash() != s1.hash()){return false;}
+    }
+
+    return true;
+}
+
+// The pool runs every item exactly once, whatever the number of threads,
+// and hands an exception thrown by an item back to the caller
+bool test_thread_pool(const unsigned int n_items, const unsigned int n_threads)
+{
+    std::vector<std::atomic<unsigned int>> counts(n_items);
+    for (unsigned int ii=0; ii<n_items; ii++){counts[ii] = 0;}
+    thread_pool::run(n_items, n_threads, [&counts](const unsigned int item)
+    {
+        counts[item]++;
+    });
+    for (unsigned int ii=0; ii<n_items; ii++)
+    {
+        if (counts[ii] != 1){return false;}
+    }
+
+    bool caught = false;
+    try
+    {
+        thread_pool::run(n_items, n_threads, [](const unsigned int item)
+        {
+            if (item == 3){throw std::runtime_error("item 3");}
+        });
+    }
+    catch (const std::runtime_error &e){caught = true;}
+    return caught;
+}
+
+// Every (N_spins, beta) pair of a sweep spec is a point with its own
+// directory, the spec overrides the defaults, and the dynamics threshold
+// splits the points as scripts/construct_inputs.py does
+bool test_sweep_points()
+{
+    parameters::SimulationParameters defaults;
+    defaults.log10_N_timesteps = 3;
+    defaults.N_spins = 10;
+    defaults.beta = 1.0;
+    defaults.landscape = "GREM";
+    defaults.memory = 1000;
+
+    const json spec = json::parse(R"({
+        "landscape": "EREM", "log10_N_timesteps": 5, "n_tracers": 7,
+        "N_spins": [16, 1e2], "beta": [1.0, 2.0, 3.0],
+        "dynamics_or_threshold": 2.0})");
+    const std::vector<sweep::Point> points = sweep::points_from_json(spec, defaults);
+    if (points.size() != 6){return false;}
+    if (points[0].directory != "16_1.0000/"){return false;}
+    if (points[5].directory != "100_3.0000/"){return false;}
+    for (const sweep::Point &point : points)
+    {
+        if (point.params.landscape != "EREM"){return false;}
+        if (point.params.N_timesteps != 100000){return false;}
+        if (point.params.n_tracers != 7){return false;}
+        if (point.params.memory != 1000){return false;}
+        const std::string dynamics = point.params.beta < 2.0 ? "standard" : "gillespie";
+        if (point.params.dynamics != dynamics){return false;}
+    }
+
+    // Gillespie at 100 spins bounds the most expensive point
+    double max_cost = 0.0;
+    for (const sweep::Point &point : points){max_cost = std::max(max_cost, sweep::estimated_cost(point.params));}
+    if (sweep::estimated_cost(points[4].params) != max_cost){return false;}
+
+    // Unknown keys, keys of the whole job and invalid values are rejected
+    for (const std::string bad : {R"({"N_spinz": 16})", R"({"threads": 4})",
+        R"({"N_spins": [16, 0]})", R"({"beta": -1.0})", R"({"landscape": "REM"})"})
+    {
+        try
+        {
+            sweep::points_from_json(json::parse(bad), defaults);
+            return false;
+        }
+        catch (const std::runtime_error &){}
+    }
+    return true;
+}
+
+// The shared grids are those written to grids/ (and formerly read back by
+// every observable), and the same parameters return the same copy
+bool test_shared_grid_set()
+{
+    const std::string directory = "_test_grids/";
+    system(("mkdir -p " + directory + "grids").c_str());
+
+    const std::shared_ptr<const grids::GridSet> grid_set = grids::shared_grid_set(6, 0.5, 100);
+    grids::write_grid_set(*grid_set, directory);
+
+    std::vector<long long> energy, pi1, pi2;
+    grids::load_long_long_grid_(energy, directory + "grids/energy.txt");
+    grids::load_long_long_grid_(pi1, directory + "grids/pi1.txt");
+    grids::load_long_long_grid_(pi2, directory + "grids/pi2.txt");
+    system(("rm -r " + directory).c_str());
+
+    if (energy != grid_set->energy || pi1 != grid_set->pi1 || pi2 != grid_set->pi2){return false;}
+    if (energy.front() != 0 || energy.back() != 1000000){return false;}
+    if (pi1.size() != pi2.size()){return false;}
+
+    if (grids::shared_grid_set(6, 0.5, 100) != grid_set){return false;}
+    if (grids::shared_grid_set(6, 1.0, 100) == grid_set){return false;}
+    return true;
+}
+
 }
 
 #endif
@@ -1,15 +1,16 @@
 #include "catch2/catch_test_macros.hpp"  // New library version of Catch2
 // #include "inc/Catch2/catch.hpp"  // Old header-only version of Catch2
-#include "ArbitraryPrecision/ap/ap.hpp"
 
 // Import the tests themselves
 #include "test_utils.h"
 #include "test_energy_mapping.h"
 #include "test_spin.h"
 #include "test_obs1.h"
+#include "test_rng.h"
+#include "test_scheduler.h"
 
 
-TEST_CASE("Test arbitrary precision interconversion", "[arbitrary_precision]")
+TEST_CASE("Test spin state interconversion", "[spin_state]")
 {
     std::cout << "PRECISON==" << PRECISON << std::endl;
     for (unsigned int seed=1; seed<11; seed++)
@@ -23,7 +24,7 @@ TEST_CASE("Test arbitrary precision interconversion", "[arbitrary_precision]")
     }
 }
 
-TEST_CASE("Test massive arbitrary precision (arr_size==PRECISON) nearest neighbors", "[arbitrary_precision]")
+TEST_CASE("Test massive spin state (arr_size==PRECISON) nearest neighbors", "[spin_state]")
 {
     const unsigned int seed = 1235;
 
@@ -32,7 +33,7 @@ TEST_CASE("Test massive arbitrary precision (arr_size==PRECISON) nearest neighbo
     REQUIRE(test_utils::test_neighbors_correct(seed, PRECISON));
 }
 
-TEST_CASE("Test flip_bit huge", "[arbitrary_precision]")
+TEST_CASE("Test flip_bit huge", "[spin_state]")
 {
     REQUIRE(test_utils::test_flip_bit_small());
     REQUIRE(test_utils::test_flip_bit_huge(123, 5));
@@ -43,6 +44,45 @@ TEST_CASE("Test flip_bit huge", "[arbitrary_precision]")
     REQUIRE(test_utils::test_flip_bit_big_number_self_consistent(PRECISON));
 }
 
+TEST_CASE("Test spin state word operations", "[spin_state]")
+{
+    for (unsigned int seed=1; seed<11; seed++)
+    {
+        REQUIRE(test_utils::test_spin_state_word_operations(seed * 13, PRECISON));
+        REQUIRE(test_utils::test_spin_state_word_operations(seed * 17, seed * 12));
+    }
+}
+
+TEST_CASE("Test state width dispatch", "[spin_state]")
+{
+    REQUIRE(state_words_for_n_spins(1) == 1);
+    REQUIRE(state_words_for_n_spins(64) == 1);
+    REQUIRE(state_words_for_n_spins(65) == 2);
+    REQUIRE(state_words_for_n_spins(128) == 2);
+    REQUIRE(state_words_for_n_spins(129) == 4);
+    REQUIRE(state_words_for_n_spins(256) == 4);
+    REQUIRE(state_words_for_n_spins(257) == HDSPIN_MAX_STATE_WORDS);
+    REQUIRE(state_words_for_n_spins(PRECISON) == HDSPIN_MAX_STATE_WORDS);
+    REQUIRE(state_words_for_n_spins(PRECISON + 1) == 0);
+}
+
+TEST_CASE("Test thread pool", "[utils]")
+{
+    REQUIRE(test_utils::test_thread_pool(10, 1));
+    REQUIRE(test_utils::test_thread_pool(1000, 4));
+    REQUIRE(test_utils::test_thread_pool(5, 16));
+}
+
+TEST_CASE("Test sweep points", "[utils]")
+{
+    REQUIRE(test_utils::test_sweep_points());
+}
+
+TEST_CASE("Test shared grid set", "[utils]")
+{
+    REQUIRE(test_utils::test_shared_grid_set());
+}
+
 TEST_CASE("Test energy mapping EREM sampling", "[energy_mapping]")
 {
     for (int ii=1; ii<11; ii++)
@@ -60,6 +100,24 @@ TEST_CASE("Test energy mapping REM sampling", "[energy_mapping]")
     }
 }
 
+TEST_CASE("Test energy mapping sampling with every rng", "[energy_mapping]")
+{
+    for (const std::string rng : {"xoshiro256pp", "pcg64", "philox"})
+    {
+        REQUIRE(test_energy_mapping::test_energy_mapping_sampling_EREM_given_beta_critical(0.75, rng));
+        REQUIRE(test_energy_mapping::test_energy_mapping_sampling_REM_given_N_spins(50, rng));
+    }
+}
+
+TEST_CASE("Test energy buffer", "[energy_mapping]")
+{
+    for (const std::string rng : {"mt19937", "xoshiro256pp", "pcg64", "philox"})
+    {
+        REQUIRE(test_energy_mapping::test_energy_buffer("EREM", rng));
+        REQUIRE(test_energy_mapping::test_energy_buffer("GREM", rng));
+    }
+}
+
 TEST_CASE("Test small cache", "[energy_mapping]")
 {
     for (int ii=1; ii<10; ii++)
@@ -68,11 +126,42 @@ TEST_CASE("Test small cache", "[energy_mapping]")
     } 
 }
 
+TEST_CASE("Test clock cache consistency", "[energy_mapping]")
+{
+    REQUIRE(test_energy_mapping::test_clock_cache_consistency(1, 10));
+    REQUIRE(test_energy_mapping::test_clock_cache_consistency(3, 50));
+    REQUIRE(test_energy_mapping::test_clock_cache_consistency(100, 1000));
+    REQUIRE(test_energy_mapping::test_clock_cache_consistency(1000, 1500));
+}
+
+TEST_CASE("Test dense table", "[energy_mapping]")
+{
+    for (int ii=2; ii<16; ii+=3)
+    {
+        REQUIRE(test_energy_mapping::test_dense_table_matches_cache(ii));
+    }
+    REQUIRE(test_energy_mapping::test_dense_table_selection());
+}
+
+TEST_CASE("Test philox known answers", "[energy_mapping]")
+{
+    REQUIRE(test_energy_mapping::test_philox_known_answers());
+}
+
+TEST_CASE("Test hashed landscape", "[energy_mapping]")
+{
+    REQUIRE(test_energy_mapping::test_hashed_landscape("EREM", 64));
+    REQUIRE(test_energy_mapping::test_hashed_landscape("EREM", 300));
+    REQUIRE(test_energy_mapping::test_hashed_landscape("GREM", 100));
+    REQUIRE(test_energy_mapping::test_hashed_landscape("GREM", PRECISON));
+}
+
 TEST_CASE("Test memory -1", "[energy_mapping]")
 {
     for (int ii=2; ii<12; ii++)
     {
-        REQUIRE(test_energy_mapping::test_memory_minus_one(ii));
+        REQUIRE(test_energy_mapping::test_memory_minus_one<1>(ii));
+        REQUIRE(test_energy_mapping::test_memory_minus_one<TEST_STATE_WORDS>(ii));
     }
 }
 
@@ -94,12 +183,124 @@ TEST_CASE("Test spin emap", "[spin]")
 TEST_CASE("Test inherent structure", "[spin]")
 {
     // REQUIRE(test_inherent_structure());
-    REQUIRE(test_spin::test_inherent_structure_min_is_min());
+    REQUIRE(test_spin::test_inherent_structure_min_is_min<1>());
+    REQUIRE(test_spin::test_inherent_structure_min_is_min<TEST_STATE_WORDS>());
+}
+
+TEST_CASE("Test gillespie kernels agree", "[spin]")
+{
+    REQUIRE(test_spin::test_gillespie_kernels_agree("EREM", 10));
+    REQUIRE(test_spin::test_gillespie_kernels_agree("EREM", 200));
+    REQUIRE(test_spin::test_gillespie_kernels_agree("GREM", 100));
+}
+
+TEST_CASE("Test vectorized exit rates", "[spin]")
+{
+    REQUIRE(test_spin::test_exp_nonpositive_error_bound(1000000));
+    for (unsigned int N=1; N<40; N++)
+    {
+        REQUIRE(test_spin::test_vectorized_exit_rates(N));
+    }
+    REQUIRE(test_spin::test_vectorized_exit_rates(PRECISON));
+}
+
+TEST_CASE("Test rejection-free standard dynamics", "[spin]")
+{
+    REQUIRE(test_spin::test_rejection_free_matches_standard("standard-accelerated", "EREM", 8, 0.5));
+    REQUIRE(test_spin::test_rejection_free_matches_standard("standard-accelerated", "GREM", 8, 0.5));
+    REQUIRE(test_spin::test_rejection_free_matches_standard("standard-adaptive", "EREM", 8, 0.5));
+    REQUIRE(test_spin::test_rejection_free_matches_standard("standard-adaptive", "GREM", 4, 1.0));
+    for (const std::string rng : {"xoshiro256pp", "pcg64", "philox"})
+    {
+        REQUIRE(test_spin::test_rejection_free_matches_standard("standard-accelerated", "EREM", 8, 0.5, rng));
+    }
+}
+
+TEST_CASE("Test batched standard dynamics", "[spin]")
+{
+    REQUIRE(test_spin::test_batch_matches_standard("EREM", "hashed", 8));
+    REQUIRE(test_spin::test_batch_matches_standard("GREM", "hashed", 13));
+    REQUIRE(test_spin::test_batch_matches_standard("EREM", "cached", 5));
+}
+
+TEST_CASE("Test checkpoint and resume", "[spin]")
+{
+    for (const std::string dynamics : {"standard", "gillespie", "standard-accelerated"})
+    {
+        REQUIRE(test_spin::test_checkpoint_continues_tracer(dynamics, "cached", "clock", 300, "mt19937"));
+        REQUIRE(test_spin::test_checkpoint_continues_tracer(dynamics, "cached", "lru", 300, "pcg64"));
+    }
+    REQUIRE(test_spin::test_checkpoint_continues_tracer("standard", "cached", "clock", -1, "xoshiro256pp"));
+    REQUIRE(test_spin::test_checkpoint_continues_tracer("gillespie", "hashed", "clock", -1, "philox"));
+}
+
+TEST_CASE("Test rng engine known answers", "[rng]")
+{
+    REQUIRE(test_rng::test_engine_known_answers());
+}
+
+TEST_CASE("Test rng samplers and streams", "[rng]")
+{
+    for (const std::string rng : {"xoshiro256pp", "pcg64", "philox"})
+    {
+        REQUIRE(test_rng::test_ziggurat_distributions(rng, 1000000));
+        REQUIRE(test_rng::test_uniform_int(rng, 7));
+        REQUIRE(test_rng::test_uniform_int(rng, PRECISON));
+        REQUIRE(test_rng::test_streams(rng, 100));
+    }
+    REQUIRE(test_rng::test_uniform_int("mt19937", 7));
 }
 
 TEST_CASE("Test streaming median", "[obs1]")
 {
     REQUIRE(test_obs1::test_streaming_median());
+    REQUIRE(test_obs1::test_streaming_median_checkpoint());
+}
+
+TEST_CASE("Test output container", "[obs1]")
+{
+    REQUIRE(test_obs1::test_output_container());
+}
+
+TEST_CASE("Test text writer", "[obs1]")
+{
+    REQUIRE(test_obs1::test_text_writer(10));
+    REQUIRE(test_obs1::test_text_writer(100000));
+    REQUIRE(test_obs1::test_shared_text_writer(1, 1));
+    REQUIRE(test_obs1::test_shared_text_writer(12, 4));
+}
+
+TEST_CASE("Test reduction", "[obs1]")
+{
+    REQUIRE(test_obs1::test_reduction(10));
+    REQUIRE(test_obs1::test_reduction(1001));
+    REQUIRE(test_obs1::test_reduction(10, 0.0));
+}
+
+TEST_CASE("Test incremental postprocessing", "[obs1]")
+{
+    REQUIRE(test_obs1::test_incremental_postprocess(2));
+    REQUIRE(test_obs1::test_incremental_postprocess(41));
+    REQUIRE(test_obs1::test_late_tracer_postprocess(3));
+}
+
+TEST_CASE("Test tracer scheduler", "[scheduler]")
+{
+    for (const scheduler::mode_t mode : {scheduler::STATIC, scheduler::DYNAMIC})
+    {
+        REQUIRE(test_scheduler::test_items_claimed_once(mode, 0, 1, 4));
+        REQUIRE(test_scheduler::test_items_claimed_once(mode, 1, 1, 1));
+        REQUIRE(test_scheduler::test_items_claimed_once(mode, 1000, 1, 8));
+        REQUIRE(test_scheduler::test_items_claimed_once(mode, 1000, 7, 3));
+    }
+}
+
+TEST_CASE("Test static schedule balance", "[scheduler]")
+{
+    for (const int world_size : {1, 2, 3, 8, 64, 200})
+    {
+        REQUIRE(test_scheduler::test_static_balance(world_size));
+    }
 }
 
 // int main(int argc, char const *argv[])
@@ -4,5 +4,12 @@
 #include <vector>
 #include <numeric>
 
+#include "utils.h"
+
+// Tests run on the widest compiled state width unless they explicitly check
+// one of the narrower widths
+#define TEST_STATE_WORDS HDSPIN_MAX_STATE_WORDS
+typedef SpinState<TEST_STATE_WORDS> spin_state_t;
+
 
 #endif